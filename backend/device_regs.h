@@ -12,8 +12,19 @@
 #define KBDR 0xFE02
 #define DSR 0xFE04
 #define DDR 0xFE06
+// Timer: when enabled (TCR[15]) it sets TSR[15] every TIR instructions, and interrupts (vector x81, priority 6)
+// while TSR[15] and TCR[14] are both set. Writing TCR or TIR restarts the count; the ISR acknowledges an expiry by
+// clearing TSR.
+#define TCR 0xFE08
+#define TIR 0xFE0A
+#define TSR 0xFE0C
 #define BSP 0xFFFA
 #define PSR 0xFFFC
 #define MCR 0xFFFE
 
+#define KBD_INT_VECTOR 0x80
+#define KBD_INT_PRIORITY 4
+#define TIMER_INT_VECTOR 0x81
+#define TIMER_INT_PRIORITY 6
+
 #endif
@@ -17,6 +17,8 @@ namespace utils
         virtual void beginInput(void) = 0;
         virtual bool getChar(char & c) = 0;
         virtual void endInput(void) = 0;
+        // Whether getChar can ever return a key. The simulator does not poll an inputter that cannot.
+        virtual bool hasInput(void) const { return true; }
     };
 
     class NullInputter : public IInputter
@@ -25,6 +27,7 @@ namespace utils
         virtual void beginInput(void) override {}
         virtual bool getChar(char &) override { return false; }
         virtual void endInput(void) override {}
+        virtual bool hasInput(void) const override { return false; }
     };
 };
 };
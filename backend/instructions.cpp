@@ -514,7 +514,7 @@ std::vector<PIEvent> LDInstruction::execute(MachineState const & state)
     PIEvent psr_change;
     uint32_t psr_value = state.readMemEvent(PSR, psr_change_mem, psr_change);
 
-    if(! state.ignore_privilege && ((addr <= SYSTEM_END || addr >= MMIO_START) && (psr_value & 0x8000) != 0x0000)) {
+    if(! state.canAccess(addr, MachineState::MEM_PERM_READ)) {
         return buildSysCallEnterHelper(state, INTEX_TABLE_START + 0, MachineState::SysCallType::EX);
     }
 
@@ -556,8 +556,8 @@ std::vector<PIEvent> LDIInstruction::execute(MachineState const & state)
     PIEvent psr_change;
     uint32_t psr_value = state.readMemEvent(PSR, psr_change_mem, psr_change);
 
-    if(! state.ignore_privilege && (((addr1 <= SYSTEM_END || addr1 >= MMIO_START)
-        || (addr2 <= SYSTEM_END || addr2 >= MMIO_START)) && (psr_value & 0x8000) != 0x0000))
+    if(! state.canAccess(addr1, MachineState::MEM_PERM_READ)
+        || ! state.canAccess(addr2, MachineState::MEM_PERM_READ))
     {
         return buildSysCallEnterHelper(state, INTEX_TABLE_START + 0, MachineState::SysCallType::EX);
     }
@@ -593,7 +593,7 @@ std::vector<PIEvent> LDRInstruction::execute(MachineState const & state)
     PIEvent psr_change;
     uint32_t psr_value = state.readMemEvent(PSR, psr_change_mem, psr_change);
 
-    if(! state.ignore_privilege && ((addr <= SYSTEM_END || addr >= MMIO_START) && (psr_value & 0x8000) != 0x0000)) {
+    if(! state.canAccess(addr, MachineState::MEM_PERM_READ)) {
         return buildSysCallEnterHelper(state, INTEX_TABLE_START + 0, MachineState::SysCallType::EX);
     }
 
@@ -676,11 +676,7 @@ std::vector<PIEvent> STInstruction::execute(MachineState const & state)
     uint32_t addr = lc3::utils::computeBasePlusSOffset(state.pc, operands[2]->value, operands[2]->width);
     uint32_t value = state.regs[operands[1]->value] & 0xffff;
 
-    bool psr_change_mem;
-    PIEvent psr_change;
-    uint32_t psr_value = state.readMemEvent(PSR, psr_change_mem, psr_change);
-
-    if(! state.ignore_privilege && ((addr <= SYSTEM_END || addr >= MMIO_START) && (psr_value & 0x8000) != 0x0000)) {
+    if(! state.canAccess(addr, MachineState::MEM_PERM_WRITE)) {
         return buildSysCallEnterHelper(state, INTEX_TABLE_START + 0, MachineState::SysCallType::EX);
     }
 
@@ -688,10 +684,6 @@ std::vector<PIEvent> STInstruction::execute(MachineState const & state)
         std::make_shared<MemWriteEvent>(addr, value)
     };
 
-    if(psr_change_mem) {
-        ret.push_back(psr_change);
-    }
-
     return ret;
 }
 
@@ -703,12 +695,8 @@ std::vector<PIEvent> STIInstruction::execute(MachineState const & state)
     PIEvent change;
     uint32_t addr2 = state.readMemEvent(addr1, change_mem, change);
 
-    bool psr_change_mem;
-    PIEvent psr_change;
-    uint32_t psr_value = state.readMemEvent(PSR, psr_change_mem, psr_change);
-
-    if(! state.ignore_privilege && (((addr1 <= SYSTEM_END || addr1 >= MMIO_START)
-        || (addr2 <= SYSTEM_END || addr2 >= MMIO_START)) && (psr_value & 0x8000) != 0x0000))
+    if(! state.canAccess(addr1, MachineState::MEM_PERM_READ)
+        || ! state.canAccess(addr2, MachineState::MEM_PERM_WRITE))
     {
         return buildSysCallEnterHelper(state, INTEX_TABLE_START + 0, MachineState::SysCallType::EX);
     }
@@ -723,10 +711,6 @@ std::vector<PIEvent> STIInstruction::execute(MachineState const & state)
         ret.push_back(change);
     }
 
-    if(psr_change_mem) {
-        ret.push_back(psr_change);
-    }
-
     return ret;
 }
 
@@ -736,11 +720,7 @@ std::vector<PIEvent> STRInstruction::execute(MachineState const & state)
         operands[3]->width);
     uint32_t value = state.regs[operands[1]->value] & 0xffff;
 
-    bool psr_change_mem;
-    PIEvent psr_change;
-    uint32_t psr_value = state.readMemEvent(PSR, psr_change_mem, psr_change);
-
-    if(! state.ignore_privilege && ((addr <= SYSTEM_END || addr >= MMIO_START) && (psr_value & 0x8000) != 0x0000)) {
+    if(! state.canAccess(addr, MachineState::MEM_PERM_WRITE)) {
         return buildSysCallEnterHelper(state, INTEX_TABLE_START + 0, MachineState::SysCallType::EX);
     }
 
@@ -748,14 +728,247 @@ std::vector<PIEvent> STRInstruction::execute(MachineState const & state)
         std::make_shared<MemWriteEvent>(addr, value)
     };
 
-    if(psr_change_mem) {
-        ret.push_back(psr_change);
-    }
-
     return ret;
 }
 
 std::vector<PIEvent> TRAPInstruction::execute(MachineState const & state)
 {
+    if(state.native_traps) {
+        optional<std::vector<PIEvent>> native_events = buildNativeTrapHelper(state, operands[2]->value);
+        if(native_events) {
+            return *native_events;
+        }
+    }
+
     return buildSysCallEnterHelper(state, operands[2]->value, MachineState::SysCallType::TRAP);
 }
+
+// Instruction counts of the lc3os service routines, used when a native TRAP counts as the routine it replaced. The
+// display is always ready, so OUT never spins.
+static constexpr uint32_t GETC_COST = 5;
+static constexpr uint32_t OUT_COST = 9;
+static constexpr uint32_t PUTS_COST = 13;
+static constexpr uint32_t PUTS_CHAR_COST = 4 + OUT_COST;
+
+// Layout of the lc3os service routines (see lc3os.cpp): return addresses of the TRAPs they make themselves, which
+// are left behind on the supervisor stack, and the BRnzp that TRAP_HALT spins on once the clock is disabled.
+static constexpr uint32_t PUTS_OUT_RETURN_OFFSET = 8;
+static constexpr uint32_t PUTSP_LOW_OUT_RETURN_OFFSET = 14;
+static constexpr uint32_t PUTSP_HIGH_OUT_RETURN_OFFSET = 26;
+static constexpr uint32_t MSG_PUTS_RETURN_OFFSET = 2;
+static constexpr uint32_t IN_LINEFEED_OUT_RETURN_OFFSET = 9;
+static constexpr uint32_t HALT_LOOP_OFFSET = 6;
+
+// Deepest the OS routines (including nested TRAPs) grow the supervisor stack.
+static constexpr uint32_t NATIVE_TRAP_STACK_DEPTH = 16;
+
+static bool readNativeTrapString(MachineState const & state, uint32_t addr, std::vector<uint32_t> & chars)
+{
+    for(; addr < MMIO_START; addr += 1) {
+        uint32_t value = state.readMemRaw(addr);
+        if(value == 0) {
+            return true;
+        }
+        chars.push_back(value);
+    }
+
+    // unterminated string; let the OS routine deal with it
+    return false;
+}
+
+static lc3::optional<uint32_t> findNativeTrapMessage(MachineState const & state, uint32_t handler)
+{
+    // TRAP_IN and TRAP_HALT begin with LEA R0, <message>
+    uint32_t encoded_inst = state.readMemRaw(handler);
+    if(lc3::utils::getBits(encoded_inst, 15, 9) != 0x70) {
+        return {};
+    }
+    return lc3::utils::computeBasePlusSOffset(handler + 1, lc3::utils::getBits(encoded_inst, 8, 0), 9);
+}
+
+// Stack contents and output of TRAP_PUTS, where routine_sp is the stack pointer once the TRAP has pushed its frame.
+static void buildNativePutsEvents(MachineState const & state, std::vector<PIEvent> & events, uint32_t routine_sp,
+    uint32_t psr_value, uint32_t str_addr, std::vector<uint32_t> const & chars)
+{
+    events.push_back(std::make_shared<MemWriteEvent>(routine_sp - 1, str_addr));
+    events.push_back(std::make_shared<MemWriteEvent>(routine_sp - 2, state.regs[1]));
+    for(uint32_t value : chars) {
+        events.push_back(std::make_shared<MemWriteEvent>(DDR, value));
+    }
+
+    if(chars.size() > 0) {
+        events.push_back(std::make_shared<MemWriteEvent>(routine_sp - 3,
+            lc3::utils::computePSRCC(chars.back(), psr_value & 0x7fff)));
+        events.push_back(std::make_shared<MemWriteEvent>(routine_sp - 4,
+            state.os_trap_handlers[0x2] + PUTS_OUT_RETURN_OFFSET));
+        events.push_back(std::make_shared<MemWriteEvent>(routine_sp - 5,
+            str_addr + static_cast<uint32_t>(chars.size()) - 1));
+    }
+}
+
+// TRAP_IN and TRAP_HALT print their message with a nested PUTS right after entering.
+static void buildNativeMessageEvents(MachineState const & state, std::vector<PIEvent> & events, uint32_t sp,
+    uint32_t psr_value, uint32_t handler, uint32_t msg_addr, std::vector<uint32_t> const & chars)
+{
+    events.push_back(std::make_shared<MemWriteEvent>(sp - 3, psr_value & 0x7fff));
+    events.push_back(std::make_shared<MemWriteEvent>(sp - 4, handler + MSG_PUTS_RETURN_OFFSET));
+    buildNativePutsEvents(state, events, sp - 4, psr_value, msg_addr, chars);
+}
+
+lc3::optional<std::vector<PIEvent>> TRAPInstruction::buildNativeTrapHelper(MachineState const & state,
+    uint32_t vector_id)
+{
+    if(vector_id < 0x20 || vector_id > 0x25) {
+        return {};
+    }
+
+    // If the program installed its own handler, run that instead.
+    uint32_t handler = state.os_trap_handlers[vector_id - 0x20];
+    if(state.readMemRaw(vector_id) != handler) {
+        return {};
+    }
+
+    uint32_t psr_value = state.readMemRaw(PSR);
+    uint32_t sp = state.regs[6];
+    if((psr_value & 0x8000) == 0x8000) {
+        sp = state.readMemRaw(BSP);
+    }
+
+    // Stack faults are left to the OS routines so that they are reported exactly as before.
+    if(sp < NATIVE_TRAP_STACK_DEPTH || sp > MMIO_START) {
+        return {};
+    }
+
+    std::vector<uint32_t> chars;
+    std::vector<PIEvent> ret;
+    uint32_t cost = 1;
+
+    if(vector_id == 0x25) {
+        optional<uint32_t> msg_addr = findNativeTrapMessage(state, handler);
+        if(! msg_addr || ! readNativeTrapString(state, *msg_addr, chars)) {
+            return {};
+        }
+
+        // HALT never returns, so enter the routine as usual and leave the machine where TRAP_HALT stops it.
+        ret = buildSysCallEnterHelper(state, vector_id, MachineState::SysCallType::TRAP);
+        buildNativeMessageEvents(state, ret, sp, psr_value, handler, *msg_addr, chars);
+
+        uint32_t mcr_value = state.readMemRaw(MCR) & 0x7fff;
+        ret.push_back(std::make_shared<RegEvent>(0, mcr_value));
+        ret.push_back(std::make_shared<RegEvent>(1, 0x7fff));
+        ret.push_back(std::make_shared<PSREvent>(lc3::utils::computePSRCC(mcr_value, psr_value & 0x7fff)));
+        ret.push_back(std::make_shared<MemWriteEvent>(MCR, mcr_value));
+        ret.push_back(std::make_shared<PCEvent>(handler + HALT_LOOP_OFFSET));
+
+        cost += 1 + PUTS_COST + PUTS_CHAR_COST * static_cast<uint32_t>(chars.size()) + 4;
+        if(state.native_trap_cost) {
+            ret.push_back(std::make_shared<InstCostEvent>(cost));
+        }
+        return ret;
+    }
+
+    // Every other routine returns with RTI, so what is left behind is R0, the devices, and the supervisor stack
+    // contents below the caller's stack pointer.
+    ret.push_back(std::make_shared<MemWriteEvent>(sp - 1, psr_value));
+    ret.push_back(std::make_shared<MemWriteEvent>(sp - 2, state.pc));
+    ret.push_back(std::make_shared<CallbackEvent>(state.sub_enter_callback_v, state.sub_enter_callback));
+
+    if(vector_id == 0x20 || vector_id == 0x23) {
+        // GETC and IN: without a pending keystroke the OS routine is run so that it polls the keyboard as usual.
+        bool kbsr_change_mem;
+        PIEvent kbsr_change;
+        uint32_t kbsr_value = state.readMemEvent(KBSR, kbsr_change_mem, kbsr_change);
+        if((kbsr_value & 0x8000) == 0) {
+            return {};
+        }
+
+        optional<uint32_t> msg_addr;
+        if(vector_id == 0x23) {
+            msg_addr = findNativeTrapMessage(state, handler);
+            if(! msg_addr || ! readNativeTrapString(state, *msg_addr, chars)) {
+                return {};
+            }
+        }
+
+        bool change_mem;
+        PIEvent change;
+        uint32_t value = state.readMemEvent(KBDR, change_mem, change) & 0xffff;
+
+        if(vector_id == 0x20) {
+            cost = GETC_COST;
+        } else {
+            buildNativeMessageEvents(state, ret, sp, psr_value, handler, *msg_addr, chars);
+            ret.push_back(std::make_shared<MemWriteEvent>(DDR, value));
+            ret.push_back(std::make_shared<MemWriteEvent>(DDR, 10));
+            ret.push_back(std::make_shared<MemWriteEvent>(sp - 3, value));
+            ret.push_back(std::make_shared<MemWriteEvent>(sp - 4, lc3::utils::computePSRCC(10, psr_value & 0x7fff)));
+            ret.push_back(std::make_shared<MemWriteEvent>(sp - 5, handler + IN_LINEFEED_OUT_RETURN_OFFSET));
+            ret.push_back(std::make_shared<MemWriteEvent>(sp - 6, state.regs[1]));
+            cost += 1 + PUTS_COST + PUTS_CHAR_COST * static_cast<uint32_t>(chars.size()) + GETC_COST + OUT_COST + 4
+                + OUT_COST + 3;
+        }
+
+        ret.push_back(std::make_shared<RegEvent>(0, value));
+        if(change_mem) {
+            ret.push_back(change);
+        }
+    } else if(vector_id == 0x21) {
+        ret.push_back(std::make_shared<MemWriteEvent>(sp - 3, state.regs[1]));
+        ret.push_back(std::make_shared<MemWriteEvent>(DDR, state.regs[0]));
+        cost = OUT_COST;
+    } else if(vector_id == 0x22) {
+        if(! readNativeTrapString(state, state.regs[0], chars)) {
+            return {};
+        }
+
+        buildNativePutsEvents(state, ret, sp - 2, psr_value, state.regs[0], chars);
+        cost = PUTS_COST + PUTS_CHAR_COST * static_cast<uint32_t>(chars.size());
+    } else if(vector_id == 0x24) {
+        if(! readNativeTrapString(state, state.regs[0], chars)) {
+            return {};
+        }
+
+        ret.push_back(std::make_shared<MemWriteEvent>(sp - 3, state.regs[0]));
+        ret.push_back(std::make_shared<MemWriteEvent>(sp - 4, state.regs[1]));
+        ret.push_back(std::make_shared<MemWriteEvent>(sp - 5, state.regs[2]));
+        ret.push_back(std::make_shared<MemWriteEvent>(sp - 6, state.regs[3]));
+
+        // TRAP_PUTSP stops at the first NUL byte, whichever half of the word it is in.
+        cost = 10 + 4 + 9;
+        for(uint32_t i = 0; i < chars.size(); i += 1) {
+            uint32_t low = chars[i] & 0xff;
+            uint32_t high = (chars[i] >> 8) & 0xff;
+            if(low == 0) {
+                break;
+            }
+
+            ret.push_back(std::make_shared<MemWriteEvent>(DDR, low));
+            ret.push_back(std::make_shared<MemWriteEvent>(sp - 7, lc3::utils::computePSRCC(low, psr_value & 0x7fff)));
+            ret.push_back(std::make_shared<MemWriteEvent>(sp - 8, handler + PUTSP_LOW_OUT_RETURN_OFFSET));
+            ret.push_back(std::make_shared<MemWriteEvent>(sp - 9, state.regs[0] + i));
+
+            // the high byte is shifted down one bit at a time, with an extra ADD for every set bit
+            uint32_t set_bits = 0;
+            for(uint32_t bit = 0; bit < 8; bit += 1) {
+                set_bits += (high >> bit) & 1;
+            }
+            cost += OUT_COST + 2 + 48 + set_bits + 2;
+            if(high == 0) {
+                break;
+            }
+
+            ret.push_back(std::make_shared<MemWriteEvent>(DDR, high));
+            ret.push_back(std::make_shared<MemWriteEvent>(sp - 7, lc3::utils::computePSRCC(high, psr_value & 0x7fff)));
+            ret.push_back(std::make_shared<MemWriteEvent>(sp - 8, handler + PUTSP_HIGH_OUT_RETURN_OFFSET));
+            ret.push_back(std::make_shared<MemWriteEvent>(sp - 9, state.regs[0] + i));
+            cost += OUT_COST + 2 + 4;
+        }
+    }
+
+    ret.push_back(std::make_shared<CallbackEvent>(state.sub_exit_callback_v, state.sub_exit_callback));
+    if(state.native_trap_cost) {
+        ret.push_back(std::make_shared<InstCostEvent>(cost));
+    }
+
+    return ret;
+}
@@ -435,6 +435,9 @@ namespace core
             std::make_shared<NumOperand>(8, false)
         }) {}
         virtual std::vector<PIEvent> execute(MachineState const & state) override;
+
+    protected:
+        static optional<std::vector<PIEvent>> buildNativeTrapHelper(MachineState const & state, uint32_t vector_id);
     };
 
     class GETCInstruction : public TRAPInstruction
@@ -9,6 +9,10 @@
 #include "device_regs.h"
 #include "interface.h"
 #include "lc3os.h"
+#include "lockstep.h"
+
+// Most instructions that can run between calls to the pre/post instruction callbacks.
+static constexpr uint32_t INST_BATCH_SIZE = 4096;
 
 lc3::sim::sim(utils::IPrinter & printer, utils::IInputter & inputter, bool threaded_input, uint32_t print_level,
     bool propagate_exceptions) :
@@ -41,8 +45,20 @@ lc3::sim::sim(utils::IPrinter & printer, utils::IInputter & inputter, bool threa
     run_type = RunType::NORMAL;
 }
 
+lc3::sim::~sim(void)
+{
+    setLockstepGroup(nullptr);
+}
+
 bool lc3::sim::loadObjFile(std::string const & obj_filename)
 {
+    std::shared_ptr<core::ObjImage const> image = core::ObjImage::fromFile(obj_filename);
+    if(image) {
+        loadObjImage(*image);
+        return true;
+    }
+
+    // Load the file directly so that the usual errors are reported.
     std::ifstream obj_file(obj_filename, std::ios_base::binary);
     if(! obj_file) {
         printer.print("could not open file " + obj_filename);
@@ -74,36 +90,81 @@ bool lc3::sim::loadObjFile(std::string const & obj_filename)
     return true;
 }
 
+void lc3::sim::loadObjImage(core::ObjImage const & image)
+{
+    simulator.loadObjImage(image);
+    restart();
+}
+
+// Also starts the instruction and output counts over, so that a reused machine runs like a new one.
 void lc3::sim::reinitialize(void)
 {
     simulator.reinitialize();
+    inst_exec_count = 0;
+    total_inst_limit = 0;
+    stopped_at_inst_limit = false;
     loadOS();
 }
 
-void lc3::sim::loadOS(void)
+// The OS never changes, so it is only assembled by the first machine in the process; every machine after that loads
+// the same object image.
+static std::string const & getOSObj(lc3::utils::IPrinter & printer)
 {
-    core::Assembler assembler(printer, 0, false);
-    assembler.setFilename("lc3os");
+    static std::string const os_obj = [&printer]() {
+        lc3::core::Assembler assembler(printer, 0, false);
+        assembler.setFilename("lc3os");
+
+        std::stringstream src_buffer;
+        src_buffer << lc3::core::getOSSrc();
+        return assembler.assemble(src_buffer)->str();
+    }();
+    return os_obj;
+}
 
-    std::stringstream src_buffer;
-    src_buffer << lc3::core::getOSSrc();
-    std::shared_ptr<std::stringstream> obj_stream = assembler.assemble(src_buffer);
-    simulator.loadObj(*obj_stream);
+void lc3::sim::loadOS(void)
+{
+    std::istringstream obj_stream(getOSObj(printer));
+    simulator.loadObj(obj_stream);
+    simulator.recordOSTrapHandlers();
     getMachineState().pc = RESET_PC;
 }
 
 void lc3::sim::randomize(void)
 {
     std::random_device dev;
-    std::mt19937 gen(dev());
-    std::uniform_int_distribution<> dis(0x0000, 0xffff);
+    randomize((static_cast<uint64_t>(dev()) << 32) | dev());
+}
 
-    for(uint32_t i = 0x3000; i < 0xfe00; i += 1) {
-        setMem(i, dis(gen));
+// Fills user memory and the general purpose registers from a SplitMix64 generator, four words per 64-bit value, so
+// the same seed always produces the same machine. User memory lies below the device registers, so the words are
+// written directly instead of through setMem. Few words have source lines, so only those are cleared.
+void lc3::sim::randomize(uint64_t seed)
+{
+    uint64_t state = seed;
+    auto next = [&state]() {
+        state += 0x9e3779b97f4a7c15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    };
+
+    std::vector<core::MemEntry> & mem = getMachineState().mem;
+    for(uint32_t addr = 0x3000; addr < 0xfe00; addr += 4) {
+        uint64_t bits = next();
+        for(uint32_t i = 0; i < 4; i += 1) {
+            mem[addr + i].setValue(static_cast<uint16_t>(bits >> (16 * i)));
+            if(mem[addr + i].hasLine()) {
+                mem[addr + i].setLine("");
+            }
+        }
     }
 
-    for(uint32_t i = 0; i <= 7; i += 1) {
-        setReg(i, dis(gen));
+    for(uint32_t i = 0; i <= 7; i += 4) {
+        uint64_t bits = next();
+        for(uint32_t j = 0; j < 4; j += 1) {
+            setReg(i + j, static_cast<uint16_t>(bits >> (16 * j)));
+        }
     }
 
     restart();
@@ -126,6 +187,52 @@ void lc3::sim::setRunInstLimit(uint64_t inst_limit)
     this->inst_limit = inst_limit;
 }
 
+// Ceiling on the number of instructions the machine executes across all runs, whatever the limit of each run is. This
+// stops a program that never halts even if the caller runs it without a limit. 0 means no ceiling.
+void lc3::sim::setMaxInstCount(uint64_t max_inst_count)
+{
+    this->max_inst_count = max_inst_count;
+}
+
+// Ceiling on the number of characters the machine prints across all runs. The character past the ceiling is dropped
+// and pauses the machine, which then counts as having exceeded its instruction limit. 0 means no ceiling.
+void lc3::sim::setMaxOutputCount(uint64_t max_output_count)
+{
+    getMachineState().max_output_count = max_output_count;
+}
+
+// Stops a run as soon as the machine comes back to a state it was in earlier in the run, without printing anything in
+// between and with no input or timer still to come, since it would then repeat itself forever. The run then counts as
+// having exceeded its instruction limit. Only a machine without a real inputter is checked, as it could otherwise be
+// waiting for a keystroke.
+void lc3::sim::setLoopDetection(bool enable)
+{
+    getMachineState().detect_loops = enable;
+}
+
+// Types input on the keyboard once the machine has executed inst_count more instructions, one character each time the
+// program reads the previous one. The input is kept on the machine's scheduler, so nothing polls for it in between.
+void lc3::sim::scheduleInput(uint64_t inst_count, std::string const & input)
+{
+    core::MachineState & state = getMachineState();
+    uint64_t generation = state.input_generation;
+    state.scheduler.schedule(state.inst_time + inst_count, [&state, generation, input]() {
+        if(state.input_generation != generation) {
+            return;
+        }
+        state.scripted_input.insert(state.scripted_input.end(), input.begin(), input.end());
+        state.deliverScriptedInput();
+    });
+}
+
+// Drops scheduled input that has not been read yet.
+void lc3::sim::clearInput(void)
+{
+    core::MachineState & state = getMachineState();
+    state.scripted_input.clear();
+    state.input_generation += 1;
+}
+
 bool lc3::sim::run(void)
 {
     return run(RunType::NORMAL);
@@ -163,13 +270,39 @@ bool lc3::sim::stepOut(void)
 
 
 bool lc3::sim::run(lc3::sim::RunType cur_run_type)
+{
+    // The lockstep engine does not track subroutine depth, so stepping over or out of a subroutine never waits.
+    if(lockstep != nullptr && cur_run_type != RunType::UNTIL_DEPTH) {
+        return lockstep->run(*this, cur_run_type);
+    }
+
+    startRun(cur_run_type);
+    return continueRun();
+}
+
+void lc3::sim::startRun(lc3::sim::RunType cur_run_type)
 {
     restart();
 
     run_type = cur_run_type;
     total_inst_limit += inst_limit;
     remaining_inst_count = inst_limit;
+    getMachineState().detected_loop = false;
+    if(max_inst_count != 0 && inst_exec_count < max_inst_count) {
+        int64_t inst_count_left = static_cast<int64_t>(max_inst_count - inst_exec_count);
+        if(remaining_inst_count <= 0 || inst_count_left < remaining_inst_count) {
+            remaining_inst_count = inst_count_left;
+        }
+    }
     hit_internal_exception = false;
+    stopped_at_inst_limit = false;
+}
+
+bool lc3::sim::continueRun(void)
+{
+    if(didExceedMaxInstCount() || didExceedMaxOutputCount() || didDetectLoop() || isCancelled()) {
+        return ! hit_internal_exception;
+    }
 
     if(propagate_exceptions) {
         simulator.simulate();
@@ -193,13 +326,54 @@ void lc3::sim::pause(void)
     simulator.disableClock();
 }
 
+// Stops the machine from any thread: the current run returns once it finishes its batch of instructions, and later
+// runs return straight away until the machine is reinitialized. The machine then counts as having exceeded its
+// instruction limit.
+void lc3::sim::cancel(void)
+{
+    simulator.requestStop();
+}
+
 lc3::core::MachineState & lc3::sim::getMachineState(void) { return simulator.getMachineState(); }
 
 lc3::core::MachineState const & lc3::sim::getMachineState(void) const { return simulator.getMachineState(); }
 
 uint64_t lc3::sim::getInstExecCount(void) const { return inst_exec_count; }
 
-bool lc3::sim::didExceedInstLimit(void) const { return inst_exec_count >= total_inst_limit; }
+bool lc3::sim::didExceedInstLimit(void) const
+{
+    return inst_exec_count >= total_inst_limit || didExceedMaxInstCount() || didExceedMaxOutputCount()
+        || didDetectLoop() || isCancelled();
+}
+
+// Whether the last run was stopped by its instruction limit or the ceiling from setMaxInstCount, rather than halting
+// (or reaching the HALT that runUntilHalt stops at) or pausing for any other reason. Unlike didExceedInstLimit, this
+// is false for a run without a limit.
+bool lc3::sim::didStopAtInstLimit(void) const
+{
+    return stopped_at_inst_limit;
+}
+
+bool lc3::sim::didExceedMaxInstCount(void) const
+{
+    return max_inst_count != 0 && inst_exec_count >= max_inst_count;
+}
+
+bool lc3::sim::didExceedMaxOutputCount(void) const
+{
+    return getMachineState().exceeded_max_output_count;
+}
+
+// Whether the last run was stopped by loop detection.
+bool lc3::sim::didDetectLoop(void) const
+{
+    return getMachineState().detected_loop;
+}
+
+bool lc3::sim::isCancelled(void) const
+{
+    return simulator.isStopRequested();
+}
 
 std::vector<lc3::Breakpoint> const & lc3::sim::getBreakpoints(void) const { return breakpoints; }
 
@@ -324,6 +498,7 @@ lc3::Breakpoint lc3::sim::setBreakpoint(uint16_t addr)
     Breakpoint bp(breakpoint_id, addr, this);
     breakpoints.push_back(bp);
     breakpoint_id += 1;
+    getMachineState().batch_stops[addr] = true;
     return bp;
 }
 
@@ -339,7 +514,9 @@ bool lc3::sim::removeBreakpointByID(uint32_t id)
     }
 
     if(found) {
+        uint32_t loc = it->loc;
         breakpoints.erase(it);
+        updateBatchStop(loc);
     }
 
     return found;
@@ -357,12 +534,26 @@ bool lc3::sim::removeBreakpointByAddr(uint16_t addr)
     }
 
     if(found) {
+        uint32_t loc = it->loc;
         breakpoints.erase(it);
+        updateBatchStop(loc);
     }
 
     return found;
 }
 
+void lc3::sim::updateBatchStop(uint32_t addr)
+{
+    bool stop = false;
+    for(auto const & x : breakpoints) {
+        if(x.loc == addr) {
+            stop = true;
+            break;
+        }
+    }
+    getMachineState().batch_stops[addr] = stop;
+}
+
 void lc3::sim::registerPreInstructionCallback(callback_func_t func)
 {
     pre_instruction_callback_v = true;
@@ -429,6 +620,32 @@ void lc3::sim::setPrintLevel(uint32_t print_level) { simulator.setPrintLevel(pri
 void lc3::sim::setPropagateExceptions(void) { propagate_exceptions = true; }
 void lc3::sim::clearPropagateExceptions(void) { propagate_exceptions = false; }
 void lc3::sim::setIgnorePrivilege(bool ignore) { simulator.setIgnorePrivilege(ignore); }
+void lc3::sim::setNativeTraps(bool enable) { simulator.setNativeTraps(enable); }
+void lc3::sim::setNativeTrapCost(bool enable) { simulator.setNativeTrapCost(enable); }
+
+// Leaving a group, by joining another or passing nullptr, tells it that this machine will not run in it again.
+void lc3::sim::setLockstepGroup(lockstep_group * group)
+{
+    if(group == lockstep) {
+        return;
+    }
+    if(lockstep != nullptr) {
+        lockstep->leave();
+    }
+    lockstep = group;
+}
+
+void lc3::sim::setUserMemAccess(uint16_t start, uint16_t end, bool read, bool write, bool execute)
+{
+    simulator.setPagePermissions(start, end, false, (read ? core::MachineState::MEM_PERM_READ : 0)
+        | (write ? core::MachineState::MEM_PERM_WRITE : 0) | (execute ? core::MachineState::MEM_PERM_EXEC : 0));
+}
+
+void lc3::sim::setSupervisorMemAccess(uint16_t start, uint16_t end, bool read, bool write, bool execute)
+{
+    simulator.setPagePermissions(start, end, true, (read ? core::MachineState::MEM_PERM_READ : 0)
+        | (write ? core::MachineState::MEM_PERM_WRITE : 0) | (execute ? core::MachineState::MEM_PERM_EXEC : 0));
+}
 
 void lc3::sim::preInstructionCallback(lc3::sim & sim_inst, lc3::core::MachineState & state)
 {
@@ -436,6 +653,18 @@ void lc3::sim::preInstructionCallback(lc3::sim & sim_inst, lc3::core::MachineSta
         sim_inst.pause();
     }
 
+    // Without per-instruction hooks, run up to the instruction limit in one batch (see Simulator::executeBatch).
+    state.inst_batch = 1;
+    state.batch_stop_at_halt = sim_inst.run_type == RunType::UNTIL_HALT;
+    if(! sim_inst.pre_instruction_callback_v && ! sim_inst.post_instruction_callback_v
+        && sim_inst.run_type != RunType::UNTIL_DEPTH)
+    {
+        state.inst_batch = INST_BATCH_SIZE;
+        if(sim_inst.remaining_inst_count > 0 && sim_inst.remaining_inst_count < INST_BATCH_SIZE) {
+            state.inst_batch = static_cast<uint32_t>(sim_inst.remaining_inst_count);
+        }
+    }
+
     if(sim_inst.pre_instruction_callback_v) {
         sim_inst.pre_instruction_callback(state);
     }
@@ -443,11 +672,18 @@ void lc3::sim::preInstructionCallback(lc3::sim & sim_inst, lc3::core::MachineSta
 
 void lc3::sim::postInstructionCallback(lc3::sim & sim_inst, core::MachineState & state)
 {
-    sim_inst.inst_exec_count += 1;
-
-    if(sim_inst.remaining_inst_count >= 0) {
-        sim_inst.remaining_inst_count -= 1;
-        if(sim_inst.remaining_inst_count == 0) {
+    // a batch of instructions, or a natively serviced TRAP, may count as more than one instruction
+    uint32_t inst_cost = state.inst_cost;
+    state.inst_cost = 1;
+    sim_inst.inst_exec_count += inst_cost;
+
+    if(sim_inst.remaining_inst_count > 0) {
+        sim_inst.remaining_inst_count -= inst_cost;
+        if(sim_inst.remaining_inst_count <= 0) {
+            // a program that halts on its last allowed instruction, or reaches the HALT that runUntilHalt stops
+            // at, was not stopped by the limit
+            sim_inst.stopped_at_inst_limit = sim_inst.simulator.isClockEnabled()
+                && ! (sim_inst.run_type == RunType::UNTIL_HALT && state.readMemRaw(state.pc) == 0xf025);
             sim_inst.pause();
         }
     }
@@ -562,10 +798,10 @@ lc3::optional<std::string> lc3::as::assemble(std::string const & asm_filename)
 #endif
 
     if(propagate_exceptions) {
-        out_stream = assembler.assemble(in_file);
+        out_stream = cache_dir.empty() ? assembler.assemble(in_file) : assembleCached(in_file, asm_filename);
     } else {
         try {
-            out_stream = assembler.assemble(in_file);
+            out_stream = cache_dir.empty() ? assembler.assemble(in_file) : assembleCached(in_file, asm_filename);
         } catch(utils::exception const & e) {
             (void) e;
 #ifdef _ENABLE_DEBUG
@@ -674,4 +910,186 @@ lc3::optional<std::string> lc3::conv::convertBin(std::string const & bin_filenam
 
 void lc3::as::setPropagateExceptions(void) { propagate_exceptions = true; }
 void lc3::as::clearPropagateExceptions(void) { propagate_exceptions = false; }
-void lc3::as::setEnableLiberalAsm(bool enable) { assembler.setLiberalAsm(enable); }
+void lc3::as::setCacheDir(std::string const & cache_dir) { this->cache_dir = cache_dir; }
+
+void lc3::as::setEnableLiberalAsm(bool enable)
+{
+    assembler.setLiberalAsm(enable);
+    enable_liberal_asm = enable;
+}
+
+namespace
+{
+    // Passes everything through to another printer while recording it in the format of an assembly cache entry.
+    // Occurrences of the source file name are recorded separately so that a cached entry can be replayed for a file
+    // with the same contents at a different path.
+    class RecordingPrinter : public lc3::utils::IPrinter
+    {
+    public:
+        RecordingPrinter(lc3::utils::IPrinter & printer, std::string const & filename) :
+            printer(printer), filename(filename) {}
+
+        std::ostringstream record;
+
+        virtual void setColor(lc3::utils::PrintColor color) override
+        {
+            printer.setColor(color);
+            record << "c " << static_cast<int>(color) << "\n";
+        }
+
+        virtual void print(std::string const & string) override
+        {
+            printer.print(string);
+
+            std::size_t start = 0;
+            std::size_t match;
+            while(! filename.empty() && (match = string.find(filename, start)) != std::string::npos) {
+                recordString(string.substr(start, match - start));
+                record << "f\n";
+                start = match + filename.size();
+            }
+            recordString(string.substr(start));
+        }
+
+        virtual void newline(void) override
+        {
+            printer.newline();
+            record << "n\n";
+        }
+
+    private:
+        lc3::utils::IPrinter & printer;
+        std::string filename;
+
+        void recordString(std::string const & string)
+        {
+            if(! string.empty()) {
+                record << "p " << string.size() << "\n" << string;
+            }
+        }
+    };
+
+    // Replays a cache entry on printer. Returns false, without printing anything, if the entry is not valid or was
+    // recorded for a different key. Otherwise, obj is set to the object file, or error to the message of the exception
+    // the assembler threw.
+    bool replayCacheEntry(std::string const & entry, std::string const & key, std::string const & filename,
+        lc3::utils::IPrinter & printer, std::string & obj, std::string & error, bool & success)
+    {
+        struct Event
+        {
+            char type;
+            int color;
+            std::string string;
+        };
+        std::vector<Event> events;
+
+        std::istringstream in(entry);
+        std::string header;
+        if(! std::getline(in, header) || header != "lc3 asm cache 2") {
+            return false;
+        }
+        // The key is stored in full, so an entry is never replayed for a source that merely has the same hash.
+        std::size_t key_size = 0;
+        if(! (in >> key_size) || in.get() != '\n' || key_size != key.size()) {
+            return false;
+        }
+        std::string entry_key(key_size, '\0');
+        if(key_size > 0 && ! in.read(&entry_key[0], key_size)) {
+            return false;
+        }
+        if(entry_key != key) {
+            return false;
+        }
+
+        while(true) {
+            Event event;
+            event.color = 0;
+            std::size_t length = 0;
+            if(! (in >> event.type)) {
+                return false;
+            }
+            if(event.type == 'c') {
+                in >> event.color;
+            } else if(event.type == 'p' || event.type == 'o' || event.type == 'x') {
+                in >> length;
+            } else if(event.type != 'f' && event.type != 'n') {
+                return false;
+            }
+            if(in.get() != '\n') {
+                return false;
+            }
+            event.string.resize(length);
+            if(length > 0 && ! in.read(&event.string[0], length)) {
+                return false;
+            }
+
+            if(event.type == 'o' || event.type == 'x') {
+                success = event.type == 'o';
+                (success ? obj : error) = event.string;
+                break;
+            }
+            events.push_back(event);
+        }
+
+        for(Event const & event : events) {
+            if(event.type == 'c') {
+                printer.setColor(static_cast<lc3::utils::PrintColor>(event.color));
+            } else if(event.type == 'p') {
+                printer.print(event.string);
+            } else if(event.type == 'f') {
+                printer.print(filename);
+            } else {
+                printer.newline();
+            }
+        }
+        return true;
+    }
+};
+
+// Cache entries are keyed by everything that can change the output of the assembler: its version and options, and
+// the source itself. An entry is named after the SHA-256 of the key and holds the key itself as well.
+std::shared_ptr<std::stringstream> lc3::as::assembleCached(std::istream & in_file, std::string const & asm_filename)
+{
+    std::stringstream source_buffer;
+    source_buffer << in_file.rdbuf();
+    std::string source = source_buffer.str();
+
+    std::ostringstream key;
+    key << utils::getVersionString() << "\n" << enable_liberal_asm << "\n" << print_level << "\n" << source;
+    std::string cache_filename = cache_dir + "/" + utils::sha256Hash(key.str()) + ".asmc";
+
+    std::ifstream cache_file(cache_filename, std::ios_base::binary);
+    if(cache_file) {
+        std::stringstream entry;
+        entry << cache_file.rdbuf();
+        std::string obj, error;
+        bool success = false;
+        if(replayCacheEntry(entry.str(), key.str(), asm_filename, printer, obj, error, success)) {
+            if(! success) {
+                throw utils::exception(error);
+            }
+            return std::make_shared<std::stringstream>(obj);
+        }
+    }
+
+    RecordingPrinter recorder(printer, asm_filename);
+    recorder.record << "lc3 asm cache 2\n" << key.str().size() << "\n" << key.str();
+    core::Assembler cache_assembler(recorder, print_level, enable_liberal_asm);
+    cache_assembler.setFilename(asm_filename);
+
+    std::istringstream source_stream(source);
+    std::shared_ptr<std::stringstream> out_stream;
+    try {
+        out_stream = cache_assembler.assemble(source_stream);
+    } catch(utils::exception const & e) {
+        std::string error = e.what();
+        recorder.record << "x " << error.size() << "\n" << error;
+        utils::writeFileAtomic(cache_filename, recorder.record.str());
+        throw;
+    }
+
+    std::string obj = out_stream->str();
+    recorder.record << "o " << obj.size() << "\n" << obj;
+    utils::writeFileAtomic(cache_filename, recorder.record.str());
+    return out_stream;
+}
@@ -23,6 +23,7 @@
 namespace lc3
 {
     class sim;
+    class lockstep_group;
 
     struct Breakpoint
     {
@@ -41,18 +42,26 @@ namespace lc3
     public:
         sim(utils::IPrinter & printer, utils::IInputter & inputter, bool threaded_input,
             uint32_t print_level, bool propagate_exceptions);
-        ~sim(void) = default;
+        ~sim(void);
 
         bool loadObjFile(std::string const & obj_filename);
+        void loadObjImage(core::ObjImage const & image);
         void reinitialize(void);
         void randomize(void);
+        void randomize(uint64_t seed);
         void restart(void);
 
         void setRunInstLimit(uint64_t inst_limit);
+        void setMaxInstCount(uint64_t max_inst_count);
+        void setMaxOutputCount(uint64_t max_output_count);
+        void setLoopDetection(bool enable);
+        void scheduleInput(uint64_t inst_count, std::string const & input);
+        void clearInput(void);
         bool run(void);
         bool runUntilHalt(void);
         bool runUntilInputPoll(void);
         void pause(void);
+        void cancel(void);
         bool stepIn(void);
         bool stepOver(void);
         bool stepOut(void);
@@ -61,6 +70,11 @@ namespace lc3
         core::MachineState const & getMachineState(void) const;
         uint64_t getInstExecCount(void) const;
         bool didExceedInstLimit(void) const;
+        bool didStopAtInstLimit(void) const;
+        bool didExceedMaxInstCount(void) const;
+        bool didExceedMaxOutputCount(void) const;
+        bool didDetectLoop(void) const;
+        bool isCancelled(void) const;
         std::vector<Breakpoint> const & getBreakpoints() const;
 
         uint16_t getReg(uint16_t id) const;
@@ -100,10 +114,18 @@ namespace lc3
         void setPropagateExceptions(void);
         void clearPropagateExceptions(void);
         void setIgnorePrivilege(bool ignore);
+        void setUserMemAccess(uint16_t start, uint16_t end, bool read, bool write, bool execute);
+        void setSupervisorMemAccess(uint16_t start, uint16_t end, bool read, bool write, bool execute);
+        void setNativeTraps(bool enable);
+        void setNativeTrapCost(bool enable);
+        void setLockstepGroup(lockstep_group * group);
 
     private:
         utils::IPrinter & printer;
         core::Simulator simulator;
+        lockstep_group * lockstep = nullptr;
+
+        void updateBatchStop(uint32_t addr);
 
         friend class core::Simulator;
         static void preInstructionCallback(sim & sim_int, core::MachineState & state);
@@ -119,9 +141,11 @@ namespace lc3
         uint64_t inst_exec_count = 0;
         uint64_t total_inst_limit = 0;
         uint64_t inst_limit = 0;
+        uint64_t max_inst_count = 0;
         int64_t remaining_inst_count = -1;
         int32_t sub_depth = 0;
         bool hit_internal_exception = false;
+        bool stopped_at_inst_limit = false;
 
         bool pre_instruction_callback_v = false;
         bool post_instruction_callback_v = false;
@@ -159,6 +183,11 @@ namespace lc3
 
         void loadOS(void);
         bool run(RunType cur_run_type);
+        void startRun(RunType cur_run_type);
+        bool continueRun(void);
+
+        friend class lockstep_sim;
+        friend class lockstep_group;
     };
 
     class as
@@ -166,7 +195,8 @@ namespace lc3
     public:
         as(utils::IPrinter & printer, uint32_t print_level, bool propagate_exceptions, bool enable_liberal_asm)
             : printer(printer), assembler(printer, print_level, enable_liberal_asm),
-              propagate_exceptions(propagate_exceptions) {}
+              propagate_exceptions(propagate_exceptions), print_level(print_level),
+              enable_liberal_asm(enable_liberal_asm) {}
         ~as(void) = default;
 
         optional<std::string> assemble(std::string const & asm_filename);
@@ -174,6 +204,9 @@ namespace lc3
         void setPropagateExceptions(void);
         void clearPropagateExceptions(void);
         void setEnableLiberalAsm(bool enable);
+        // Directory in which assembled objects and their messages are kept, so that a source file that was assembled
+        // before is not assembled again. Empty (the default) disables the cache.
+        void setCacheDir(std::string const & cache_dir);
 
     private:
         friend class sim;
@@ -182,6 +215,11 @@ namespace lc3
         core::Assembler assembler;
 
         bool propagate_exceptions;
+        uint32_t print_level;
+        bool enable_liberal_asm;
+        std::string cache_dir;
+
+        std::shared_ptr<std::stringstream> assembleCached(std::istream & in_file, std::string const & asm_filename);
     };
 
     class conv
@@ -0,0 +1,1013 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stack>
+#include <string>
+
+#include "device_regs.h"
+#include "instruction_decoder.h"
+#include "lockstep.h"
+#include "utils.h"
+
+namespace
+{
+    // Steps between checks for machines cancelled from another thread, about as often as a single machine checks.
+    constexpr uint32_t CANCEL_CHECK_INTERVAL = 4096;
+
+    enum class Kind : uint8_t {
+          INVALID
+        , ADD_REG
+        , ADD_IMM
+        , AND_REG
+        , AND_IMM
+        , BR
+        , JMP
+        , JSR
+        , JSRR
+        , LD
+        , LDI
+        , LDR
+        , LEA
+        , NOT
+        , RTI
+        , ST
+        , STI
+        , STR
+        , TRAP
+    };
+
+    // Instruction kind of every 16-bit word, using the same decoder as the simulator to tell which are valid.
+    std::vector<Kind> const & getDecodeTable(void)
+    {
+        static std::vector<Kind> const table = []() {
+            static Kind const kind_by_opcode[16] = {
+                Kind::BR, Kind::ADD_REG, Kind::LD, Kind::ST, Kind::JSR, Kind::AND_REG, Kind::LDR, Kind::STR,
+                Kind::RTI, Kind::NOT, Kind::LDI, Kind::STI, Kind::JMP, Kind::INVALID, Kind::LEA, Kind::TRAP
+            };
+
+            lc3::core::sim::InstructionDecoder decoder;
+            std::vector<Kind> ret(1 << 16, Kind::INVALID);
+            for(uint32_t word = 0; word < (1 << 16); word += 1) {
+                if(! decoder.findInstructionByEncoding(word)) {
+                    continue;
+                }
+
+                Kind kind = kind_by_opcode[word >> 12];
+                if(kind == Kind::ADD_REG && (word & 0x0020) != 0) {
+                    kind = Kind::ADD_IMM;
+                } else if(kind == Kind::AND_REG && (word & 0x0020) != 0) {
+                    kind = Kind::AND_IMM;
+                } else if(kind == Kind::JSR && (word & 0x0800) == 0) {
+                    kind = Kind::JSRR;
+                }
+                ret[word] = kind;
+            }
+            return ret;
+        }();
+        return table;
+    }
+
+    uint16_t sext(uint32_t word, uint32_t width)
+    {
+        return static_cast<uint16_t>(lc3::utils::sextTo32(word & ((1 << width) - 1), width));
+    }
+
+    uint16_t computeCC(uint16_t value)
+    {
+        return value == 0 ? 0x2 : ((value & 0x8000) != 0 ? 0x4 : 0x1);
+    }
+
+    bool isTimerReg(uint32_t addr)
+    {
+        return addr == TCR || addr == TIR || addr == TSR;
+    }
+};
+
+// The state of a group of machines, one lane per machine. Memory and registers are interleaved by lane so that a
+// group of lanes at the same instruction reads and writes consecutive entries.
+class lc3::lockstep_sim::Lanes
+{
+public:
+    Lanes(uint32_t lane_count, sim::RunType run_type);
+
+    void load(uint32_t lane, sim & sim_inst);
+    void execute(void);
+    bool store(uint32_t lane);
+
+private:
+    using SysCallType = core::MachineState::SysCallType;
+    using PagePerms = std::array<uint8_t, core::MachineState::PAGE_COUNT>;
+
+    enum class Status {
+          RUNNING
+        , DONE        // the machine paused, just as it would have on its own
+        , HANDOVER    // the machine must finish the run on its own, starting at the current PC
+        , FAULT       // the machine triple faulted
+    };
+
+    uint32_t lane_count;
+    sim::RunType run_type;
+    std::vector<Kind> const & decode_table;
+
+    std::vector<sim *> sims;
+    std::vector<Status> status;
+    std::vector<uint16_t> mem;
+    std::vector<uint16_t> regs;
+    std::vector<uint16_t> pc;
+    // The PSR lives here rather than in mem, as most instructions update the condition codes.
+    std::vector<uint16_t> psr;
+    std::vector<uint8_t> group;
+    std::vector<uint8_t> exec_ok;
+
+    std::vector<uint64_t> inst_count;
+    std::vector<uint64_t> inst_time;
+    std::vector<int64_t> remaining_inst_count;
+    std::vector<uint8_t> stopped_at_inst_limit;
+    std::vector<int32_t> sub_depth;
+    std::vector<uint8_t> hit_exception;
+    std::vector<std::vector<SysCallType>> sys_call_types;
+    std::vector<std::string> output;
+    // Characters each machine may still print before reaching its output ceiling.
+    std::vector<uint64_t> output_left;
+    std::vector<uint8_t> exceeded_output;
+
+    std::vector<uint8_t> ignore_privilege;
+    std::vector<PagePerms> user_page_perms;
+    std::vector<PagePerms> supervisor_page_perms;
+
+    // Side effects of keyboard register reads, which only happen if the instruction completes.
+    std::vector<uint8_t> kbdr_read;
+    std::vector<uint16_t> kbdr_read_kbsr;
+    std::vector<uint8_t> kbsr_wait;
+
+    std::vector<uint8_t> fault_bottom;
+    std::vector<uint16_t> fault_addr;
+
+    uint16_t & memAt(uint32_t addr, uint32_t lane) { return mem[addr * lane_count + lane]; }
+    uint16_t & regAt(uint32_t reg, uint32_t lane) { return regs[reg * lane_count + lane]; }
+    bool canAccess(uint32_t lane, uint32_t addr, uint32_t perms) const;
+    void pause(uint32_t lane) { memAt(MCR, lane) &= 0x7fff; }
+    void swapSP(uint32_t lane);
+
+    uint16_t readMem(uint32_t lane, uint32_t addr);
+    void writeMem(uint32_t lane, uint32_t addr, uint16_t value);
+    void applyReadEffects(uint32_t lane);
+    void clearReadEffects(uint32_t lane);
+
+    bool enterSysCall(uint32_t lane, uint32_t vector_id, SysCallType sys_call_type, uint16_t new_psr);
+    bool exitSysCall(uint32_t lane);
+    void fault(uint32_t lane, bool bottom, uint32_t addr);
+
+    void step(uint16_t cur_pc, uint16_t word);
+    void executeScalar(uint32_t lane, Kind kind, uint16_t word, uint16_t cur_pc);
+    void finishInstruction(uint32_t lane);
+    void countInstructions(uint32_t lane, uint32_t inst_cost);
+};
+
+lc3::lockstep_sim::Lanes::Lanes(uint32_t lane_count, sim::RunType run_type) : lane_count(lane_count),
+    run_type(run_type), decode_table(getDecodeTable()), sims(lane_count, nullptr),
+    status(lane_count, Status::DONE), mem((1 << 16) * lane_count), regs(8 * lane_count), pc(lane_count),
+    psr(lane_count), group(lane_count), exec_ok(lane_count), inst_count(lane_count), inst_time(lane_count),
+    remaining_inst_count(lane_count), stopped_at_inst_limit(lane_count), sub_depth(lane_count), hit_exception(lane_count), sys_call_types(lane_count),
+    output(lane_count), output_left(lane_count), exceeded_output(lane_count), ignore_privilege(lane_count), user_page_perms(lane_count),
+    supervisor_page_perms(lane_count), kbdr_read(lane_count), kbdr_read_kbsr(lane_count), kbsr_wait(lane_count),
+    fault_bottom(lane_count), fault_addr(lane_count)
+{}
+
+void lc3::lockstep_sim::Lanes::load(uint32_t lane, sim & sim_inst)
+{
+    core::MachineState const & state = sim_inst.getMachineState();
+
+    sims[lane] = &sim_inst;
+    for(uint32_t addr = 0; addr < (1 << 16); addr += 1) {
+        memAt(addr, lane) = static_cast<uint16_t>(state.readMemRaw(addr));
+    }
+    for(uint32_t reg = 0; reg < 8; reg += 1) {
+        regAt(reg, lane) = static_cast<uint16_t>(state.regs[reg]);
+    }
+    pc[lane] = static_cast<uint16_t>(state.pc);
+    psr[lane] = static_cast<uint16_t>(state.readMemRaw(PSR));
+
+    std::stack<SysCallType> stack_copy = state.sys_call_types;
+    sys_call_types[lane].clear();
+    while(! stack_copy.empty()) {
+        sys_call_types[lane].push_back(stack_copy.top());
+        stack_copy.pop();
+    }
+    std::reverse(sys_call_types[lane].begin(), sys_call_types[lane].end());
+
+    inst_count[lane] = 0;
+    inst_time[lane] = 0;
+    remaining_inst_count[lane] = sim_inst.remaining_inst_count;
+    stopped_at_inst_limit[lane] = 0;
+    sub_depth[lane] = 0;
+    hit_exception[lane] = 0;
+    output[lane].clear();
+    output_left[lane] = state.max_output_count == 0 ? std::numeric_limits<uint64_t>::max()
+        : state.max_output_count - state.output_count;
+    exceeded_output[lane] = 0;
+
+    ignore_privilege[lane] = state.ignore_privilege;
+    user_page_perms[lane] = state.user_page_perms;
+    supervisor_page_perms[lane] = state.supervisor_page_perms;
+    clearReadEffects(lane);
+
+    sim_inst.simulator.getInputter().beginInput();
+    status[lane] = (memAt(MCR, lane) & 0x8000) != 0 ? Status::RUNNING : Status::DONE;
+}
+
+bool lc3::lockstep_sim::Lanes::store(uint32_t lane)
+{
+    sim & sim_inst = *sims[lane];
+    core::MachineState & state = sim_inst.getMachineState();
+
+    if(status[lane] == Status::FAULT) {
+        pause(lane);
+    }
+
+    for(uint32_t reg = 0; reg < 8; reg += 1) {
+        state.regs[reg] = regAt(reg, lane);
+    }
+    state.pc = pc[lane];
+    for(uint32_t addr = 0; addr < (1 << 16); addr += 1) {
+        if(addr != PSR && memAt(addr, lane) != state.readMemRaw(addr)) {
+            state.writeMemRaw(addr, memAt(addr, lane));
+        }
+    }
+    if(psr[lane] != state.readMemRaw(PSR)) {
+        state.writeMemRaw(PSR, psr[lane]);
+    }
+
+    state.sys_call_types = std::stack<SysCallType>();
+    for(SysCallType sys_call_type : sys_call_types[lane]) {
+        state.sys_call_types.push(sys_call_type);
+    }
+
+    sim_inst.inst_exec_count += inst_count[lane];
+    sim_inst.remaining_inst_count = remaining_inst_count[lane];
+    sim_inst.stopped_at_inst_limit = stopped_at_inst_limit[lane] != 0;
+    sim_inst.sub_depth += sub_depth[lane];
+    if(hit_exception[lane]) {
+        sim_inst.hit_internal_exception = true;
+    }
+    state.inst_time += inst_time[lane];
+    state.output_count += output[lane].size();
+    if(exceeded_output[lane]) {
+        state.exceeded_max_output_count = true;
+    }
+
+    std::string const & lane_output = output[lane];
+    std::size_t start = 0;
+    for(std::size_t i = 0; i <= lane_output.size(); i += 1) {
+        if(i == lane_output.size() || lane_output[i] == 10 || lane_output[i] == 13) {
+            if(i > start) {
+                state.logger.print(lane_output.substr(start, i - start));
+            }
+            if(i < lane_output.size()) {
+                state.logger.newline(utils::PrintType::P_NONE);
+            }
+            start = i + 1;
+        }
+    }
+
+    sim_inst.simulator.getInputter().endInput();
+
+    if(status[lane] == Status::HANDOVER) {
+        return sim_inst.continueRun();
+    } else if(status[lane] == Status::FAULT) {
+        std::string location = fault_bottom[lane] ? "bottom" : "top";
+        state.logger.printf(utils::PrintType::P_ERROR, true, "triple fault: invalid %s of stack address 0x%0.4x",
+            location.c_str(), fault_addr[lane]);
+        if(sim_inst.propagate_exceptions) {
+            throw utils::exception("triple fault: invalid " + location + " of stack address");
+        }
+        return false;
+    }
+
+    return ! sim_inst.hit_internal_exception;
+}
+
+void lc3::lockstep_sim::Lanes::execute(void)
+{
+    uint32_t steps_to_cancel_check = CANCEL_CHECK_INTERVAL;
+    while(true) {
+        steps_to_cancel_check -= 1;
+        if(steps_to_cancel_check == 0) {
+            steps_to_cancel_check = CANCEL_CHECK_INTERVAL;
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                if(status[lane] == Status::RUNNING && sims[lane]->isCancelled()) {
+                    pause(lane);
+                    status[lane] = Status::DONE;
+                }
+            }
+        }
+
+        // Run the lanes that are furthest behind, so that lanes that diverged at a branch can meet up again.
+        uint32_t leader = lane_count;
+        for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+            if(status[lane] == Status::RUNNING && (leader == lane_count || pc[lane] < pc[leader])) {
+                leader = lane;
+            }
+        }
+
+        if(leader == lane_count) {
+            break;
+        }
+
+        uint16_t cur_pc = pc[leader];
+        uint16_t word = memAt(cur_pc, leader);
+        uint16_t const * words = &mem[cur_pc * lane_count];
+        for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+            group[lane] = status[lane] == Status::RUNNING && pc[lane] == cur_pc && words[lane] == word;
+        }
+
+        step(cur_pc, word);
+    }
+}
+
+void lc3::lockstep_sim::Lanes::step(uint16_t cur_pc, uint16_t word)
+{
+    if(run_type == sim::RunType::UNTIL_HALT && word == 0xf025) {
+        for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+            if(group[lane]) {
+                pause(lane);
+                status[lane] = Status::DONE;
+            }
+        }
+        return;
+    }
+
+    if(cur_pc >= MMIO_START) {
+        for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+            if(group[lane]) {
+                status[lane] = Status::HANDOVER;
+            }
+        }
+        return;
+    }
+
+    Kind kind = decode_table[word];
+    uint16_t next_pc = static_cast<uint16_t>(cur_pc + 1);
+    for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+        exec_ok[lane] = group[lane] && canAccess(lane, cur_pc, core::MachineState::MEM_PERM_EXEC);
+        if(group[lane] && ! exec_ok[lane]) {
+            enterSysCall(lane, INTEX_TABLE_START + 0x0, SysCallType::EX, psr[lane] & 0x7fff);
+        } else if(exec_ok[lane] && kind == Kind::INVALID) {
+            exec_ok[lane] = 0;
+            enterSysCall(lane, INTEX_TABLE_START + 0x1, SysCallType::EX, psr[lane] & 0x7fff);
+        } else if(exec_ok[lane]) {
+            pc[lane] = next_pc;
+        }
+    }
+
+    uint32_t dr = (word >> 9) & 0x7;
+    uint32_t sr1 = (word >> 6) & 0x7;
+    uint16_t * dst = &regs[dr * lane_count];
+    uint16_t const * src1 = &regs[sr1 * lane_count];
+    uint16_t const * src2 = &regs[(word & 0x7) * lane_count];
+    uint16_t imm5 = sext(word, 5);
+
+    switch(kind) {
+        case Kind::ADD_REG:
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                uint16_t result = static_cast<uint16_t>(src1[lane] + src2[lane]);
+                dst[lane] = exec_ok[lane] ? result : dst[lane];
+                psr[lane] = exec_ok[lane] ? ((psr[lane] & 0xfff8) | computeCC(result)) : psr[lane];
+            }
+            break;
+
+        case Kind::ADD_IMM:
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                uint16_t result = static_cast<uint16_t>(src1[lane] + imm5);
+                dst[lane] = exec_ok[lane] ? result : dst[lane];
+                psr[lane] = exec_ok[lane] ? ((psr[lane] & 0xfff8) | computeCC(result)) : psr[lane];
+            }
+            break;
+
+        case Kind::AND_REG:
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                uint16_t result = src1[lane] & src2[lane];
+                dst[lane] = exec_ok[lane] ? result : dst[lane];
+                psr[lane] = exec_ok[lane] ? ((psr[lane] & 0xfff8) | computeCC(result)) : psr[lane];
+            }
+            break;
+
+        case Kind::AND_IMM:
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                uint16_t result = src1[lane] & imm5;
+                dst[lane] = exec_ok[lane] ? result : dst[lane];
+                psr[lane] = exec_ok[lane] ? ((psr[lane] & 0xfff8) | computeCC(result)) : psr[lane];
+            }
+            break;
+
+        case Kind::NOT:
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                uint16_t result = static_cast<uint16_t>(~src1[lane]);
+                dst[lane] = exec_ok[lane] ? result : dst[lane];
+                psr[lane] = exec_ok[lane] ? ((psr[lane] & 0xfff8) | computeCC(result)) : psr[lane];
+            }
+            break;
+
+        case Kind::LEA: {
+            uint16_t addr = static_cast<uint16_t>(next_pc + sext(word, 9));
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                dst[lane] = exec_ok[lane] ? addr : dst[lane];
+            }
+            break;
+        }
+
+        case Kind::BR: {
+            uint16_t nzp = static_cast<uint16_t>(dr);
+            uint16_t addr = static_cast<uint16_t>(next_pc + sext(word, 9));
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                pc[lane] = (exec_ok[lane] && (nzp & psr[lane]) != 0) ? addr : pc[lane];
+            }
+            break;
+        }
+
+        case Kind::JMP:
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                pc[lane] = exec_ok[lane] ? src1[lane] : pc[lane];
+                if(exec_ok[lane] && sr1 == 7) {
+                    sub_depth[lane] -= 1;
+                }
+            }
+            break;
+
+        case Kind::JSR:
+        case Kind::JSRR: {
+            uint16_t addr = static_cast<uint16_t>(next_pc + sext(word, 11));
+            uint16_t * r7 = &regs[7 * lane_count];
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                if(exec_ok[lane]) {
+                    uint16_t target = kind == Kind::JSR ? addr : src1[lane];
+                    r7[lane] = next_pc;
+                    pc[lane] = target;
+                    sub_depth[lane] += 1;
+                }
+            }
+            break;
+        }
+
+        case Kind::LD:
+        case Kind::ST: {
+            // Every lane uses the same PC-relative address, so (outside of device memory) a whole row is accessed.
+            uint16_t addr = static_cast<uint16_t>(next_pc + sext(word, 9));
+            if(addr >= MMIO_START) {
+                for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                    if(exec_ok[lane]) {
+                        executeScalar(lane, kind, word, cur_pc);
+                    }
+                }
+                break;
+            }
+
+            uint32_t perm = kind == Kind::LD ? core::MachineState::MEM_PERM_READ : core::MachineState::MEM_PERM_WRITE;
+            uint16_t * row = &mem[addr * lane_count];
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                if(! exec_ok[lane]) {
+                    continue;
+                }
+                if(! canAccess(lane, addr, perm)) {
+                    enterSysCall(lane, INTEX_TABLE_START + 0x0, SysCallType::EX, psr[lane] & 0x7fff);
+                } else if(kind == Kind::LD) {
+                    dst[lane] = row[lane];
+                    psr[lane] = (psr[lane] & 0xfff8) | computeCC(row[lane]);
+                } else {
+                    row[lane] = dst[lane];
+                }
+            }
+            break;
+        }
+
+        default:
+            for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+                if(exec_ok[lane]) {
+                    executeScalar(lane, kind, word, cur_pc);
+                }
+            }
+            break;
+    }
+
+    for(uint32_t lane = 0; lane < lane_count; lane += 1) {
+        if(group[lane] && status[lane] == Status::RUNNING) {
+            finishInstruction(lane);
+        }
+    }
+}
+
+void lc3::lockstep_sim::Lanes::executeScalar(uint32_t lane, Kind kind, uint16_t word, uint16_t cur_pc)
+{
+    uint32_t reg = (word >> 9) & 0x7;
+    uint16_t pc_offset = static_cast<uint16_t>(pc[lane] + sext(word, 9));
+    uint16_t base_offset = static_cast<uint16_t>(regAt((word >> 6) & 0x7, lane) + sext(word, 6));
+    uint32_t const read = core::MachineState::MEM_PERM_READ;
+    uint32_t const write = core::MachineState::MEM_PERM_WRITE;
+
+    clearReadEffects(lane);
+
+    switch(kind) {
+        case Kind::LD:
+        case Kind::LDR: {
+            uint16_t addr = kind == Kind::LD ? pc_offset : base_offset;
+            if(! canAccess(lane, addr, read)) {
+                enterSysCall(lane, INTEX_TABLE_START + 0x0, SysCallType::EX, psr[lane] & 0x7fff);
+                return;
+            }
+            uint16_t value = readMem(lane, addr);
+            psr[lane] = (psr[lane] & 0xfff8) | computeCC(value);
+            regAt(reg, lane) = value;
+            break;
+        }
+
+        case Kind::LDI: {
+            uint16_t addr2 = readMem(lane, pc_offset);
+            uint16_t value = readMem(lane, addr2);
+            if(! canAccess(lane, pc_offset, read) || ! canAccess(lane, addr2, read)) {
+                clearReadEffects(lane);
+                enterSysCall(lane, INTEX_TABLE_START + 0x0, SysCallType::EX, psr[lane] & 0x7fff);
+                return;
+            }
+            psr[lane] = (psr[lane] & 0xfff8) | computeCC(value);
+            regAt(reg, lane) = value;
+            break;
+        }
+
+        case Kind::ST:
+        case Kind::STR: {
+            uint16_t addr = kind == Kind::ST ? pc_offset : base_offset;
+            if(isTimerReg(addr)) {
+                pc[lane] = cur_pc;
+                status[lane] = Status::HANDOVER;
+                return;
+            }
+            if(! canAccess(lane, addr, write)) {
+                enterSysCall(lane, INTEX_TABLE_START + 0x0, SysCallType::EX, psr[lane] & 0x7fff);
+                return;
+            }
+            writeMem(lane, addr, regAt(reg, lane));
+            break;
+        }
+
+        case Kind::STI: {
+            uint16_t addr2 = readMem(lane, pc_offset);
+            if(isTimerReg(addr2)) {
+                clearReadEffects(lane);
+                pc[lane] = cur_pc;
+                status[lane] = Status::HANDOVER;
+                return;
+            }
+            if(! canAccess(lane, pc_offset, read) || ! canAccess(lane, addr2, write)) {
+                clearReadEffects(lane);
+                enterSysCall(lane, INTEX_TABLE_START + 0x0, SysCallType::EX, psr[lane] & 0x7fff);
+                return;
+            }
+            writeMem(lane, addr2, regAt(reg, lane));
+            break;
+        }
+
+        case Kind::RTI:
+            if((psr[lane] & 0x8000) == 0 && regAt(6, lane) == 0xffff) {
+                // the return PSR would be read from past the end of memory
+                pc[lane] = cur_pc;
+                status[lane] = Status::HANDOVER;
+                return;
+            }
+            if(sys_call_types[lane].empty() && ! ignore_privilege[lane] && (psr[lane] & 0x8000) != 0) {
+                enterSysCall(lane, INTEX_TABLE_START + 0x0, SysCallType::EX, psr[lane] & 0x7fff);
+            } else {
+                exitSysCall(lane);
+            }
+            return;
+
+        case Kind::TRAP:
+            enterSysCall(lane, word & 0xff, SysCallType::TRAP, psr[lane] & 0x7fff);
+            return;
+
+        default:
+            break;
+    }
+
+    applyReadEffects(lane);
+}
+
+void lc3::lockstep_sim::Lanes::finishInstruction(uint32_t lane)
+{
+    // Same order as Simulator::executeBatch: collect input, then check for an interrupt, whose entry counts as an
+    // instruction of its own.
+    inst_time[lane] += 1;
+
+    char c;
+    core::Simulator & simulator = sims[lane]->simulator;
+    if(simulator.isPollingInput() && (memAt(KBSR, lane) & 0x8000) == 0 && simulator.getInputter().getChar(c)) {
+        memAt(KBSR, lane) |= 0x8000;
+        memAt(KBDR, lane) = static_cast<uint16_t>(c) & 0xff;
+    }
+
+    uint32_t inst_cost = 1;
+    if((memAt(KBSR, lane) & 0xc000) == 0xc000 && ((psr[lane] >> 8) & 0x7) < KBD_INT_PRIORITY) {
+        uint16_t new_psr = (psr[lane] & 0x78ff) | (KBD_INT_PRIORITY << 8);
+        inst_time[lane] += 1;
+        if(! enterSysCall(lane, INTEX_TABLE_START + KBD_INT_VECTOR, SysCallType::INT, new_psr)) {
+            countInstructions(lane, inst_cost);
+            return;
+        }
+        inst_cost += 1;
+    }
+    countInstructions(lane, inst_cost);
+
+    if((memAt(MCR, lane) & 0x8000) == 0) {
+        status[lane] = Status::DONE;
+    }
+}
+
+// Mirrors lc3::sim::postInstructionCallback.
+void lc3::lockstep_sim::Lanes::countInstructions(uint32_t lane, uint32_t inst_cost)
+{
+    inst_count[lane] += inst_cost;
+    if(remaining_inst_count[lane] > 0) {
+        remaining_inst_count[lane] -= inst_cost;
+        if(remaining_inst_count[lane] <= 0) {
+            // a machine that halts on its last allowed instruction, or reaches the HALT that runUntilHalt stops at,
+            // was not stopped by the limit
+            stopped_at_inst_limit[lane] = (memAt(MCR, lane) & 0x8000) != 0
+                && ! (run_type == sim::RunType::UNTIL_HALT && memAt(pc[lane], lane) == 0xf025);
+            pause(lane);
+        }
+    }
+}
+
+bool lc3::lockstep_sim::Lanes::canAccess(uint32_t lane, uint32_t addr, uint32_t perms) const
+{
+    if(ignore_privilege[lane]) {
+        return true;
+    }
+
+    PagePerms const & page_perms = (psr[lane] & 0x8000) != 0 ? user_page_perms[lane] : supervisor_page_perms[lane];
+    return (page_perms[addr >> core::MachineState::PAGE_BITS] & perms) == perms;
+}
+
+void lc3::lockstep_sim::Lanes::swapSP(uint32_t lane)
+{
+    uint16_t old_sp = regAt(6, lane);
+    regAt(6, lane) = memAt(BSP, lane);
+    memAt(BSP, lane) = old_sp;
+}
+
+uint16_t lc3::lockstep_sim::Lanes::readMem(uint32_t lane, uint32_t addr)
+{
+    if(addr == PSR) {
+        return psr[lane];
+    }
+
+    uint16_t value = memAt(addr, lane);
+    if(addr == KBDR) {
+        kbdr_read[lane] = 1;
+        kbdr_read_kbsr[lane] = memAt(KBSR, lane);
+    } else if(addr == KBSR && (value & 0x8000) == 0) {
+        kbsr_wait[lane] = 1;
+    }
+    return value;
+}
+
+void lc3::lockstep_sim::Lanes::writeMem(uint32_t lane, uint32_t addr, uint16_t value)
+{
+    if(addr == DDR) {
+        if(output_left[lane] == 0) {
+            exceeded_output[lane] = 1;
+            pause(lane);
+        } else {
+            output[lane].push_back(static_cast<char>(value & 0xff));
+            output_left[lane] -= 1;
+        }
+    } else if(addr == KBSR) {
+        value &= 0x4000;
+    } else if(addr == DSR) {
+        // the display is always ready
+        value |= 0x8000;
+    } else if(addr == PSR) {
+        uint16_t old_psr = psr[lane];
+        psr[lane] = value;
+        if(((old_psr ^ value) & 0x8000) != 0) {
+            swapSP(lane);
+        }
+        return;
+    }
+
+    memAt(addr, lane) = value;
+}
+
+void lc3::lockstep_sim::Lanes::applyReadEffects(uint32_t lane)
+{
+    if(kbdr_read[lane]) {
+        // reading the data register clears the ready bit
+        memAt(KBSR, lane) = kbdr_read_kbsr[lane] & 0x4000;
+    }
+    if(kbsr_wait[lane] && run_type == sim::RunType::UNTIL_INPUT) {
+        pause(lane);
+    }
+    clearReadEffects(lane);
+}
+
+void lc3::lockstep_sim::Lanes::clearReadEffects(uint32_t lane)
+{
+    kbdr_read[lane] = 0;
+    kbsr_wait[lane] = 0;
+}
+
+bool lc3::lockstep_sim::Lanes::enterSysCall(uint32_t lane, uint32_t vector_id, SysCallType sys_call_type,
+    uint16_t new_psr)
+{
+    // Mirrors IInstruction::buildSysCallEnterHelper.
+    uint16_t cur_psr = psr[lane];
+    uint32_t sp = (cur_psr & 0x8000) != 0 ? memAt(BSP, lane) : regAt(6, lane);
+
+    uint32_t top_of_stack = (sp - 2) & 0xffff;
+    if(top_of_stack > MMIO_START) {
+        fault(lane, false, top_of_stack);
+        return false;
+    }
+
+    if(((cur_psr ^ new_psr) & 0x8000) != 0) {
+        swapSP(lane);
+    }
+    regAt(6, lane) = static_cast<uint16_t>(sp - 1);
+    writeMem(lane, sp - 1, cur_psr);
+    regAt(6, lane) = static_cast<uint16_t>(sp - 2);
+    writeMem(lane, sp - 2, pc[lane]);
+    psr[lane] = new_psr;
+    pc[lane] = memAt(vector_id, lane);
+
+    sub_depth[lane] += 1;
+    if(sys_call_type == SysCallType::EX) {
+        hit_exception[lane] = 1;
+    }
+    sys_call_types[lane].push_back(sys_call_type);
+    return true;
+}
+
+bool lc3::lockstep_sim::Lanes::exitSysCall(uint32_t lane)
+{
+    // Mirrors IInstruction::buildSysCallExitHelper.
+    uint16_t cur_psr = psr[lane];
+    uint32_t sp = (cur_psr & 0x8000) != 0 ? memAt(BSP, lane) : regAt(6, lane);
+
+    uint32_t bottom_of_stack = (sp + 2) & 0xffff;
+    if(bottom_of_stack >= MMIO_START) {
+        fault(lane, true, bottom_of_stack);
+        return false;
+    }
+
+    if((cur_psr & 0x8000) != 0) {
+        return enterSysCall(lane, INTEX_TABLE_START + 0x0, SysCallType::INT, cur_psr & 0x7fff);
+    }
+
+    // The stack is below device memory here, so these reads have no side effects.
+    uint16_t new_pc = memAt(sp, lane);
+    uint16_t new_psr = memAt(sp + 1, lane);
+    pc[lane] = new_pc;
+    psr[lane] = new_psr;
+    regAt(6, lane) = static_cast<uint16_t>(sp + 2);
+    if(((cur_psr ^ new_psr) & 0x8000) != 0) {
+        swapSP(lane);
+    }
+
+    sub_depth[lane] -= 1;
+    if(! sys_call_types[lane].empty()) {
+        sys_call_types[lane].pop_back();
+    }
+    return true;
+}
+
+void lc3::lockstep_sim::Lanes::fault(uint32_t lane, bool bottom, uint32_t addr)
+{
+    status[lane] = Status::FAULT;
+    fault_bottom[lane] = bottom;
+    fault_addr[lane] = static_cast<uint16_t>(addr);
+}
+
+lc3::lockstep_sim::lockstep_sim(uint32_t lane_count) : lane_count(std::max<uint32_t>(lane_count, 1)),
+    scalar_run_count(0)
+{}
+
+std::vector<bool> lc3::lockstep_sim::run(std::vector<sim *> const & sims)
+{
+    return run(sims, sim::RunType::NORMAL);
+}
+
+std::vector<bool> lc3::lockstep_sim::runUntilHalt(std::vector<sim *> const & sims)
+{
+    return run(sims, sim::RunType::UNTIL_HALT);
+}
+
+std::vector<bool> lc3::lockstep_sim::runUntilInputPoll(std::vector<sim *> const & sims)
+{
+    return run(sims, sim::RunType::UNTIL_INPUT);
+}
+
+std::vector<bool> lc3::lockstep_sim::run(std::vector<sim *> const & sims, sim::RunType run_type)
+{
+    // As with a single machine, an exception is only thrown by a machine that propagates exceptions, and in that
+    // case the first one is rethrown once every machine has run.
+    std::vector<bool> results;
+    std::vector<std::exception_ptr> exceptions;
+    run(sims, run_type, results, exceptions);
+    for(std::exception_ptr const & exception : exceptions) {
+        if(exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    return results;
+}
+
+void lc3::lockstep_sim::run(std::vector<sim *> const & sims, sim::RunType run_type, std::vector<bool> & results,
+    std::vector<std::exception_ptr> & exceptions)
+{
+    results.assign(sims.size(), false);
+    exceptions.assign(sims.size(), nullptr);
+    std::vector<uint32_t> lockstep_ids;
+
+    for(uint32_t i = 0; i < sims.size(); i += 1) {
+        if(canRunInLockstep(*sims[i])) {
+            lockstep_ids.push_back(i);
+            continue;
+        }
+
+        // not sim::run, which would hand a machine in a lockstep group back to the group
+        scalar_run_count += 1;
+        try {
+            sims[i]->startRun(run_type);
+            results[i] = sims[i]->continueRun();
+        } catch(utils::exception const &) {
+            exceptions[i] = std::current_exception();
+        }
+    }
+
+    for(uint32_t chunk_start = 0; chunk_start < lockstep_ids.size(); chunk_start += lane_count) {
+        uint32_t chunk_size = std::min<uint32_t>(lane_count, static_cast<uint32_t>(lockstep_ids.size()) - chunk_start);
+        Lanes lanes(chunk_size, run_type);
+        for(uint32_t lane = 0; lane < chunk_size; lane += 1) {
+            sim & sim_inst = *sims[lockstep_ids[chunk_start + lane]];
+            sim_inst.startRun(run_type);
+            lanes.load(lane, sim_inst);
+        }
+
+        lanes.execute();
+
+        for(uint32_t lane = 0; lane < chunk_size; lane += 1) {
+            uint32_t id = lockstep_ids[chunk_start + lane];
+            try {
+                results[id] = lanes.store(lane);
+            } catch(utils::exception const &) {
+                exceptions[id] = std::current_exception();
+            }
+        }
+    }
+}
+
+bool lc3::lockstep_sim::canRunInLockstep(sim & sim_inst) const
+{
+    if(sim_inst.pre_instruction_callback_v || sim_inst.post_instruction_callback_v
+        || sim_inst.interrupt_enter_callback_v || sim_inst.interrupt_exit_callback_v
+        || sim_inst.exception_enter_callback_v || sim_inst.exception_exit_callback_v
+        || sim_inst.sub_enter_callback_v || sim_inst.sub_exit_callback_v || sim_inst.wait_for_input_callback_v
+        || sim_inst.breakpoint_callback_v || ! sim_inst.breakpoints.empty() || sim_inst.didExceedMaxInstCount()
+        || sim_inst.didExceedMaxOutputCount() || sim_inst.getMachineState().detect_loops || sim_inst.isCancelled())
+    {
+        return false;
+    }
+
+    core::MachineState const & state = sim_inst.getMachineState();
+    if(state.native_traps || sim_inst.simulator.isThreadedInput()
+        || sim_inst.simulator.getPrintLevel() >= static_cast<uint32_t>(utils::PrintType::P_EXTRA))
+    {
+        return false;
+    }
+
+    // Only the keyboard is emulated in lockstep, so the timer must be off, there must be no other devices, and no
+    // scheduled input may be waiting.
+    return state.readMemRaw(TCR) == 0 && state.scheduler.getNextTime() == std::numeric_limits<uint64_t>::max()
+        && state.interrupt_sources.size() <= 2 && state.scripted_input.empty();
+}
+
+struct lc3::lockstep_group::Request
+{
+    sim * sim_inst;
+    sim::RunType run_type;
+    bool done = false;
+    bool result = false;
+    std::exception_ptr exception;
+};
+
+lc3::lockstep_group::lockstep_group(uint32_t member_count, uint32_t lane_count) : runner(lane_count),
+    member_count(member_count), scalar_running_count(0), scalar_run_count(0), batch_running(false)
+{}
+
+void lc3::lockstep_group::leave(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if(member_count > 0) {
+        member_count -= 1;
+    }
+    changed.notify_all();
+}
+
+uint64_t lc3::lockstep_group::getScalarRunCount(void) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return scalar_run_count + runner.getScalarRunCount();
+}
+
+bool lc3::lockstep_group::run(sim & sim_inst, sim::RunType run_type)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if(! runner.canRunInLockstep(sim_inst)) {
+        scalar_run_count += 1;
+        scalar_running_count += 1;
+        changed.notify_all();
+        guard.unlock();
+
+        std::exception_ptr exception;
+        bool result = false;
+        try {
+            sim_inst.startRun(run_type);
+            result = sim_inst.continueRun();
+        } catch(utils::exception const &) {
+            exception = std::current_exception();
+        }
+
+        guard.lock();
+        scalar_running_count -= 1;
+        guard.unlock();
+        if(exception) {
+            std::rethrow_exception(exception);
+        }
+        return result;
+    }
+
+    Request request;
+    request.sim_inst = &sim_inst;
+    request.run_type = run_type;
+    waiting.push_back(&request);
+    while(! request.done) {
+        if(isBatchReady()) {
+            runBatch(guard);
+        } else {
+            changed.wait(guard);
+        }
+    }
+    guard.unlock();
+
+    if(request.exception) {
+        std::rethrow_exception(request.exception);
+    }
+    return request.result;
+}
+
+bool lc3::lockstep_group::isBatchReady(void) const
+{
+    return ! batch_running && ! waiting.empty() && waiting.size() + scalar_running_count >= member_count;
+}
+
+// Called with the lock held, by one of the waiting threads. The lock is released while the machines run, as every
+// other member is either waiting for this batch or running on its own.
+void lc3::lockstep_group::runBatch(std::unique_lock<std::mutex> & guard)
+{
+    std::vector<Request *> batch;
+    batch.swap(waiting);
+    batch_running = true;
+    guard.unlock();
+
+    for(sim::RunType run_type : {sim::RunType::NORMAL, sim::RunType::UNTIL_HALT, sim::RunType::UNTIL_INPUT}) {
+        std::vector<sim *> sims;
+        std::vector<Request *> requests;
+        for(Request * request : batch) {
+            if(request->run_type == run_type) {
+                sims.push_back(request->sim_inst);
+                requests.push_back(request);
+            }
+        }
+        if(sims.empty()) {
+            continue;
+        }
+
+        std::vector<bool> results;
+        std::vector<std::exception_ptr> exceptions;
+        runner.run(sims, run_type, results, exceptions);
+        for(uint32_t i = 0; i < requests.size(); i += 1) {
+            requests[i]->result = results[i];
+            requests[i]->exception = exceptions[i];
+        }
+    }
+
+    guard.lock();
+    for(Request * request : batch) {
+        request->done = true;
+    }
+    batch_running = false;
+    changed.notify_all();
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+#include "interface.h"
+
+namespace lc3
+{
+    // Runs many independent machines together, lane_count at a time. Machines that are at the same PC execute the
+    // instruction as a group, with the machine state laid out lane by lane so that the group is updated by simple
+    // loops over the lanes. Each machine ends up exactly as if it had been run on its own with the same run* call.
+    // A machine with callbacks, breakpoints, native TRAPs, threaded input, scheduled input, instruction tracing, loop
+    // detection, or a running timer is simply run on its own, as is one that touches the timer or executes out of
+    // device memory partway through.
+    class lockstep_sim
+    {
+    public:
+        lockstep_sim(uint32_t lane_count = 16);
+        ~lockstep_sim(void) = default;
+
+        std::vector<bool> run(std::vector<sim *> const & sims);
+        std::vector<bool> runUntilHalt(std::vector<sim *> const & sims);
+        std::vector<bool> runUntilInputPoll(std::vector<sim *> const & sims);
+
+        // Number of machines, across all runs, that could not be run in lockstep.
+        uint64_t getScalarRunCount(void) const { return scalar_run_count; }
+
+    private:
+        class Lanes;
+        friend class lockstep_group;
+
+        uint32_t lane_count;
+        uint64_t scalar_run_count;
+
+        std::vector<bool> run(std::vector<sim *> const & sims, sim::RunType run_type);
+        // Runs every machine, keeping the exception (if any) that each one threw.
+        void run(std::vector<sim *> const & sims, sim::RunType run_type, std::vector<bool> & results,
+            std::vector<std::exception_ptr> & exceptions);
+        bool canRunInLockstep(sim & sim_inst) const;
+    };
+
+    // Runs machines that are each driven by a thread of their own in lockstep, for callers that make their run*
+    // calls one machine at a time (e.g. grader test cases). The group is made for a fixed number of machines, which
+    // join it with lc3::sim::setLockstepGroup and leave it once they will not run again. A run on a machine in the
+    // group waits until every other machine in the group is also waiting on a run, running on its own, or gone, and
+    // then the waiting machines all run together on one of the waiting threads. A machine that cannot run in lockstep
+    // (see lockstep_sim) runs on its own thread straight away.
+    class lockstep_group
+    {
+    public:
+        lockstep_group(uint32_t member_count, uint32_t lane_count = 16);
+        ~lockstep_group(void) = default;
+
+        // Leaves the group on behalf of a member that never joined (e.g. one that had nothing to run).
+        void leave(void);
+
+        // Number of runs, across all members, that did not run in lockstep.
+        uint64_t getScalarRunCount(void) const;
+
+    private:
+        struct Request;
+        friend class sim;
+
+        lockstep_sim runner;
+
+        mutable std::mutex lock;
+        std::condition_variable changed;
+        uint32_t member_count;
+        uint32_t scalar_running_count;
+        uint64_t scalar_run_count;
+        bool batch_running;
+        std::vector<Request *> waiting;
+
+        bool run(sim & sim_inst, sim::RunType run_type);
+        bool isBatchReady(void) const;
+        void runBatch(std::unique_lock<std::mutex> & guard);
+    };
+};
+
+#endif
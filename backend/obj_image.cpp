@@ -0,0 +1,127 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#include "mem.h"
+#include "obj_image.h"
+#include "utils.h"
+
+// Most object files kept in the cache. Once it is full, the file that was used least recently is dropped.
+static constexpr uint32_t OBJ_IMAGE_CACHE_SIZE = 256;
+
+lc3::core::ObjImage::ObjImage(std::istream & buffer, bool keep_lines)
+{
+    std::string expected_header = utils::getMagicHeader();
+    std::string header(expected_header.size(), '\0');
+    if(! buffer.read(&header[0], header.size())) {
+        throw utils::exception("could not read header");
+    }
+    if(header != expected_header) {
+        throw utils::exception("invalid header (is this a .obj file?); try re-assembling");
+    }
+
+    std::string expected_version = utils::getVersionString();
+    std::string version(expected_version.size(), '\0');
+    if(! buffer.read(&version[0], version.size())) {
+        throw utils::exception("could not read version number; try re-assembling");
+    }
+    if(version != expected_version) {
+        throw utils::exception("mismatched version numbers; try re-assembling");
+    }
+
+    Segment * segment = nullptr;
+    while(! buffer.eof()) {
+        MemEntry statement;
+        buffer >> statement;
+
+        if(buffer.eof()) {
+            break;
+        }
+
+        if(statement.isOrig()) {
+            if(! has_start_pc) {
+                start_pc = statement.getValue();
+                has_start_pc = true;
+            }
+            segments.emplace_back();
+            segment = &segments.back();
+            segment->start = statement.getValue();
+            continue;
+        }
+
+        if(segment == nullptr) {
+            segments.emplace_back();
+            segment = &segments.back();
+        }
+
+        segment->words.push_back(statement.getValue());
+        if(keep_lines) {
+            segment->lines.push_back(statement.getLine());
+        }
+    }
+}
+
+namespace
+{
+    struct CacheEntry
+    {
+        uint64_t hash;
+        std::shared_ptr<lc3::core::ObjImage const> image;
+        std::list<std::string>::iterator use_pos;
+    };
+
+    std::mutex cache_lock;
+    std::unordered_map<std::string, CacheEntry> cache;
+    // Paths in the cache, most recently used first.
+    std::list<std::string> cache_uses;
+};
+
+std::shared_ptr<lc3::core::ObjImage const> lc3::core::ObjImage::fromFile(std::string const & obj_filename)
+{
+    std::ifstream obj_file(obj_filename, std::ios_base::binary);
+    if(! obj_file) {
+        return nullptr;
+    }
+    std::stringstream contents;
+    contents << obj_file.rdbuf();
+    std::string data = contents.str();
+    uint64_t hash = utils::fnv1aHash(data);
+
+    {
+        std::lock_guard<std::mutex> guard(cache_lock);
+        auto entry = cache.find(obj_filename);
+        if(entry != cache.end() && entry->second.hash == hash) {
+            cache_uses.splice(cache_uses.begin(), cache_uses, entry->second.use_pos);
+            return entry->second.image;
+        }
+    }
+
+    std::shared_ptr<ObjImage const> image;
+    try {
+        std::istringstream buffer(data);
+        image = std::make_shared<ObjImage const>(buffer);
+    } catch(utils::exception const & e) {
+        (void) e;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(cache_lock);
+    auto entry = cache.find(obj_filename);
+    if(entry != cache.end()) {
+        cache_uses.erase(entry->second.use_pos);
+        cache.erase(entry);
+    }
+    if(cache.size() >= OBJ_IMAGE_CACHE_SIZE) {
+        cache.erase(cache_uses.back());
+        cache_uses.pop_back();
+    }
+    cache_uses.push_front(obj_filename);
+    cache[obj_filename] = CacheEntry{hash, image, cache_uses.begin()};
+
+    return image;
+}
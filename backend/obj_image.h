@@ -0,0 +1,51 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#ifndef OBJ_IMAGE_H
+#define OBJ_IMAGE_H
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lc3
+{
+namespace core
+{
+    // A parsed object file: the words of each .orig block and, optionally, the source line of each word. An image is
+    // never modified once it is parsed, so the same image can be loaded into any number of machines.
+    class ObjImage
+    {
+    public:
+        struct Segment
+        {
+            uint16_t start = 0;
+            std::vector<uint16_t> words;
+            // Empty if the image was parsed without its source lines.
+            std::vector<std::string> lines;
+        };
+
+        // Throws utils::exception if the buffer does not hold a valid object file.
+        ObjImage(std::istream & buffer, bool keep_lines = true);
+
+        std::vector<Segment> const & getSegments(void) const { return segments; }
+        // The PC is set to the address of the first .orig, if there is one.
+        bool hasStartPC(void) const { return has_start_pc; }
+        uint16_t getStartPC(void) const { return start_pc; }
+
+        // Returns the image of the object file at obj_filename. Images are cached by path for the whole process and
+        // reused as long as the contents of the file are unchanged. Returns nullptr if the file cannot be read or is
+        // not a valid object file.
+        static std::shared_ptr<ObjImage const> fromFile(std::string const & obj_filename);
+
+    private:
+        std::vector<Segment> segments;
+        bool has_start_pc = false;
+        uint16_t start_pc = 0;
+    };
+};
+};
+
+#endif
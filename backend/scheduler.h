@@ -0,0 +1,70 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <vector>
+
+namespace lc3
+{
+namespace core
+{
+    // Runs device events once the machine has executed a given number of instructions, so that devices with nothing
+    // due cost a single comparison per instruction.
+    class EventScheduler
+    {
+    public:
+        using event_func_t = std::function<void(void)>;
+
+        EventScheduler(void) : next_seq(0) {}
+
+        void schedule(uint64_t time, event_func_t func)
+        {
+            events.push(ScheduledEvent(time, next_seq, func));
+            next_seq += 1;
+        }
+
+        uint64_t getNextTime(void) const
+        {
+            return events.empty() ? std::numeric_limits<uint64_t>::max() : events.top().time;
+        }
+
+        // Events run in time order, and in the order they were scheduled when due at the same time. An event may
+        // schedule further events, which also run if they are due.
+        void runDueEvents(uint64_t time)
+        {
+            while(! events.empty() && events.top().time <= time) {
+                event_func_t func = events.top().func;
+                events.pop();
+                func();
+            }
+        }
+
+        void clear(void) { events = decltype(events)(); }
+
+    private:
+        struct ScheduledEvent
+        {
+            ScheduledEvent(uint64_t time, uint64_t seq, event_func_t func) : time(time), seq(seq), func(func) {}
+
+            uint64_t time, seq;
+            event_func_t func;
+
+            bool operator>(ScheduledEvent const & other) const
+            {
+                return time > other.time || (time == other.time && seq > other.seq);
+            }
+        };
+
+        std::priority_queue<ScheduledEvent, std::vector<ScheduledEvent>, std::greater<ScheduledEvent>> events;
+        uint64_t next_seq;
+    };
+};
+};
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <algorithm>
+#include <deque>
+#include <thread>
+
+#include "sim_pool.h"
+
+namespace
+{
+    class PoolPrinter : public lc3::utils::IPrinter
+    {
+    public:
+        std::string output;
+
+        virtual void setColor(lc3::utils::PrintColor color) override { (void) color; }
+        virtual void print(std::string const & string) override { output += string; }
+        virtual void newline(void) override { output += "\n"; }
+    };
+};
+
+struct lc3::sim_pool::QueuedJob
+{
+    uint64_t id;
+    Job job;
+};
+
+class lc3::sim_pool::Worker
+{
+public:
+    Worker(void) : simulator(printer, inputter, false, 1, false) {}
+
+    PoolPrinter printer;
+    lc3::utils::NullInputter inputter;
+    lc3::sim simulator;
+    bool fresh = true;
+
+    // The owner takes jobs from the front, and other workers steal from the back.
+    std::mutex queue_lock;
+    std::deque<QueuedJob> queue;
+
+    std::thread thread;
+};
+
+lc3::sim_pool::sim_pool(uint32_t worker_count) : next_job_id(0), queued_job_count(0), unfinished_job_count(0),
+    stolen_job_count(0), next_worker(0), stopping(false)
+{
+    if(worker_count == 0) {
+        worker_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for(uint32_t i = 0; i < worker_count; i += 1) {
+        workers.emplace_back(new Worker());
+    }
+    for(uint32_t i = 0; i < worker_count; i += 1) {
+        workers[i]->thread = std::thread(&lc3::sim_pool::workerLoop, this, i);
+    }
+}
+
+lc3::sim_pool::~sim_pool(void)
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_available.notify_all();
+
+    for(std::unique_ptr<Worker> & worker : workers) {
+        worker->thread.join();
+    }
+}
+
+uint64_t lc3::sim_pool::submit(Job const & job)
+{
+    uint64_t id;
+    {
+        // The job is counted before it is published, so a worker that takes it straight away can not take the count
+        // below zero. takeJob never holds a queue lock while it waits for this one.
+        std::lock_guard<std::mutex> guard(lock);
+        id = next_job_id;
+        next_job_id += 1;
+        uint32_t worker_id = next_worker;
+        next_worker = (next_worker + 1) % workers.size();
+        unfinished_job_count += 1;
+        queued_job_count += 1;
+
+        std::lock_guard<std::mutex> queue_guard(workers[worker_id]->queue_lock);
+        workers[worker_id]->queue.push_back(QueuedJob{id, job});
+    }
+    work_available.notify_one();
+
+    return id;
+}
+
+void lc3::sim_pool::wait(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    jobs_finished.wait(guard, [this]() { return unfinished_job_count == 0; });
+}
+
+uint64_t lc3::sim_pool::getStolenJobCount(void) const
+{
+    std::lock_guard<std::mutex> guard(const_cast<std::mutex &>(lock));
+    return stolen_job_count;
+}
+
+bool lc3::sim_pool::takeJob(uint32_t worker_id, QueuedJob & job)
+{
+    bool stolen = false;
+    bool found = false;
+    for(uint32_t i = 0; i < workers.size() && ! found; i += 1) {
+        Worker & victim = *workers[(worker_id + i) % workers.size()];
+        std::lock_guard<std::mutex> guard(victim.queue_lock);
+        if(victim.queue.empty()) {
+            continue;
+        }
+
+        if(i == 0) {
+            job = std::move(victim.queue.front());
+            victim.queue.pop_front();
+        } else {
+            job = std::move(victim.queue.back());
+            victim.queue.pop_back();
+            stolen = true;
+        }
+        found = true;
+    }
+
+    if(found) {
+        std::lock_guard<std::mutex> guard(lock);
+        queued_job_count -= 1;
+        if(stolen) {
+            stolen_job_count += 1;
+        }
+    }
+    return found;
+}
+
+void lc3::sim_pool::workerLoop(uint32_t worker_id)
+{
+    while(true) {
+        QueuedJob job;
+        if(takeJob(worker_id, job)) {
+            runJob(worker_id, job);
+
+            std::lock_guard<std::mutex> guard(lock);
+            unfinished_job_count -= 1;
+            if(unfinished_job_count == 0) {
+                jobs_finished.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(lock);
+        work_available.wait(guard, [this]() { return stopping || queued_job_count > 0; });
+        if(stopping && queued_job_count == 0) {
+            return;
+        }
+    }
+}
+
+void lc3::sim_pool::runJob(uint32_t worker_id, QueuedJob & queued_job)
+{
+    Worker & worker = *workers[worker_id];
+    lc3::sim & simulator = worker.simulator;
+    Job const & job = queued_job.job;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if(! worker.fresh) {
+        simulator.reinitialize();
+    }
+    worker.fresh = false;
+    worker.printer.output.clear();
+
+    JobResult result;
+    result.id = queued_job.id;
+    result.worker = worker_id;
+    result.loaded = true;
+    for(std::string const & obj_filename : job.obj_filenames) {
+        if(! simulator.loadObjFile(obj_filename)) {
+            result.loaded = false;
+            break;
+        }
+    }
+
+    simulator.setMaxOutputCount(job.max_output_count);
+    simulator.setLoopDetection(job.detect_loops);
+    simulator.setIgnorePrivilege(job.ignore_privilege);
+    simulator.setNativeTraps(job.native_traps);
+
+    if(result.loaded) {
+        for(std::pair<uint16_t, uint16_t> const & write : job.mem_writes) {
+            simulator.setMem(write.first, write.second);
+        }
+        if(! job.input.empty()) {
+            simulator.scheduleInput(0, job.input);
+        }
+
+        simulator.setRunInstLimit(job.inst_limit);
+        result.success = job.until_halt ? simulator.runUntilHalt() : simulator.run();
+        result.inst_count = simulator.getInstExecCount();
+        // didExceedInstLimit would also count a program that halts on its last allowed instruction, or any run
+        // without a limit.
+        result.exceeded_limit = simulator.didStopAtInstLimit() || simulator.didExceedMaxOutputCount()
+            || simulator.didDetectLoop() || simulator.isCancelled();
+    }
+
+    result.output = worker.printer.output;
+    result.run_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    if(job.on_complete) {
+        job.on_complete(simulator, result);
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#ifndef SIM_POOL_H
+#define SIM_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "interface.h"
+
+namespace lc3
+{
+    // Runs simulation jobs on a fixed set of worker threads. Each worker reuses a single lc3::sim, which is
+    // reinitialized and configured from scratch before every job, so nothing carries over from one job to the next.
+    // Jobs are spread across the workers' queues as they are submitted, and a worker whose queue is empty steals from
+    // the other queues, so a few long jobs do not hold up the short ones behind them.
+    class sim_pool
+    {
+    public:
+        struct JobResult
+        {
+            uint64_t id = 0;
+            uint32_t worker = 0;
+            bool loaded = false;
+            bool success = false;
+            // The run was stopped by its instruction limit, the output ceiling, loop detection, or a cancel.
+            bool exceeded_limit = false;
+            uint64_t inst_count = 0;
+            std::string output;
+            std::chrono::nanoseconds run_time = std::chrono::nanoseconds(0);
+        };
+
+        // Called on the worker thread once the job has run, with the machine still in its final state. It must not
+        // change the configuration of the machine (callbacks, breakpoints, etc.), as the machine is reused.
+        using completion_func_t = std::function<void(sim &, JobResult const &)>;
+
+        struct Job
+        {
+            std::vector<std::string> obj_filenames;
+            // Written, in order, after the object files are loaded.
+            std::vector<std::pair<uint16_t, uint16_t>> mem_writes;
+            // Keyboard input, consumed one character at a time as the program reads it.
+            std::string input;
+            // Instruction limit for the run; 0 means no limit.
+            uint64_t inst_limit = 0;
+            // Stop at a HALT rather than running the OS routine (see lc3::sim::runUntilHalt).
+            bool until_halt = false;
+            // Ceiling on the characters printed (see lc3::sim::setMaxOutputCount); 0 means no ceiling.
+            uint64_t max_output_count = 0;
+            bool detect_loops = false;
+            bool ignore_privilege = false;
+            bool native_traps = false;
+            completion_func_t on_complete;
+        };
+
+        sim_pool(uint32_t worker_count = 0);
+        ~sim_pool(void);
+
+        uint64_t submit(Job const & job);
+        void wait(void);
+
+        uint32_t getWorkerCount(void) const { return static_cast<uint32_t>(workers.size()); }
+        uint64_t getStolenJobCount(void) const;
+
+    private:
+        struct QueuedJob;
+        class Worker;
+
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        std::mutex lock;
+        std::condition_variable work_available;
+        std::condition_variable jobs_finished;
+        uint64_t next_job_id;
+        uint64_t queued_job_count;
+        uint64_t unfinished_job_count;
+        uint64_t stolen_job_count;
+        uint32_t next_worker;
+        bool stopping;
+
+        bool takeJob(uint32_t worker_id, QueuedJob & job);
+        void workerLoop(uint32_t worker_id);
+        void runJob(uint32_t worker_id, QueuedJob & job);
+    };
+};
+
+#endif
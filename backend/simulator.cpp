@@ -1,6 +1,7 @@
 /*
  * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
  */
+#include <algorithm>
 #include <fstream>
 #include <mutex>
 #include <thread>
@@ -22,10 +23,16 @@ namespace core
 
 Simulator::Simulator(lc3::sim & simulator, lc3::utils::IPrinter & printer, lc3::utils::IInputter & inputter,
     uint32_t print_level, bool threaded_input) : state(simulator, logger), logger(printer, print_level),
-    inputter(inputter), threaded_input(threaded_input), collecting_input(false)
+    inputter(inputter), threaded_input(threaded_input),
+    poll_input(inputter.hasInput()), collecting_input(false),
+    stop_requested(false)
 {
     state.mem.resize(1 << 16);
+    state.batch_stops.resize(1 << 16);
+    state.addInterruptSource("keyboard", KBD_INT_VECTOR, KBD_INT_PRIORITY);
+    state.addInterruptSource("timer", TIMER_INT_VECTOR, TIMER_INT_PRIORITY);
     reinitialize();
+    state.updatePagePermissions();
 
     state.pre_instruction_callback_v = false;
     state.post_instruction_callback_v = false;
@@ -35,66 +42,37 @@ Simulator::Simulator(lc3::sim & simulator, lc3::utils::IPrinter & printer, lc3::
 
 void Simulator::loadObj(std::istream & buffer)
 {
-    using namespace lc3::utils;
-
-    uint32_t fill_pc = 0;
-    uint32_t offset = 0;
-    bool first_orig_set = false;
-
-    // Verify header.
-    std::string expected_header = getMagicHeader();
-    char * header = new char[expected_header.size()];
-    if(buffer.read(header, expected_header.size())) {
-        for(uint32_t i = 0; i < expected_header.size(); i += 1) {
-            if(header[i] != expected_header[i]) {
-                logger.printf(PrintType::P_ERROR, true, "invalid header (is this a .obj file?); try re-assembling");
-                throw utils::exception("invalid header (is this a .obj file?); try re-assembling");
-            }
-        }
-    } else {
-        logger.printf(PrintType::P_ERROR, true, "could not read header");
-        throw utils::exception("could not read header");
-    }
-    delete[] header;
-
-    // Verify version number matches current version number.
-    std::string expected_version = getVersionString();
-    char * version = new char[expected_version.size()];
-    if(buffer.read(version, expected_version.size())) {
-        for(uint32_t i = 0; i < expected_version.size(); i += 1) {
-            if(version[i] != expected_version[i]) {
-                logger.printf(PrintType::P_ERROR, true, "mismatched version numbers; try re-assembling");
-                throw utils::exception("mismatched version numbers; try re-assembling");
-            }
-        }
-    } else {
-        logger.printf(PrintType::P_ERROR, true, "could not version number; try re-assembling");
-        throw utils::exception("could not read version number; try re-assembling");
+    try {
+        loadObjImage(ObjImage(buffer));
+    } catch(utils::exception const & e) {
+        logger.printf(utils::PrintType::P_ERROR, true, "%s", e.what());
+        throw;
     }
-    delete[] version;
+}
 
-    while(! buffer.eof()) {
-        MemEntry statement;
-        buffer >> statement;
+void Simulator::loadObjImage(ObjImage const & image)
+{
+    if(image.hasStartPC()) {
+        state.pc = image.getStartPC();
+    }
 
-        if(buffer.eof()) {
-            break;
+    for(ObjImage::Segment const & segment : image.getSegments()) {
+        uint32_t end = std::min<uint32_t>(segment.start + static_cast<uint32_t>(segment.words.size()), 1 << 16);
+        for(uint32_t addr = segment.start; addr < end; addr += 1) {
+            MemEntry & entry = state.mem[addr];
+            entry.setValue(segment.words[addr - segment.start]);
+            entry.setLine(segment.lines.empty() ? "" : segment.lines[addr - segment.start]);
+            if(logger.getPrintLevel() >= static_cast<uint32_t>(utils::PrintType::P_DEBUG)) {
+                logger.printf(utils::PrintType::P_DEBUG, true, "0x%0.4x: %s (0x%0.4x)", addr,
+                    entry.getLine().c_str(), entry.getValue());
+            }
         }
-
-        if(statement.isOrig()) {
-            if(! first_orig_set) {
-                state.pc = statement.getValue();
-                first_orig_set = true;
+        if(end > MMIO_START) {
+            // let the devices see the new register values
+            for(uint32_t addr = std::max<uint32_t>(segment.start, MMIO_START); addr < end; addr += 1) {
+                state.writeMemRaw(addr, segment.words[addr - segment.start]);
             }
-            fill_pc = statement.getValue();
-            offset = 0;
-        } else {
-            logger.printf(lc3::utils::PrintType::P_DEBUG, true, "0x%0.4x: %s (0x%0.4x)", fill_pc + offset,
-                statement.getLine().c_str(), statement.getValue());
-            state.mem[fill_pc + offset] = statement;
-            offset += 1;
         }
-
     }
     enableClock();
 }
@@ -108,25 +86,42 @@ void Simulator::simulate(void)
     try {
         enableClock();
 
+        // A machine that reads from a real inputter can always be waiting for the next keystroke.
+        bool check_loops = state.detect_loops && ! poll_input;
+        state.resetLoopCheck();
+
         collecting_input = true;
         inputter.beginInput();
         if(threaded_input) {
             input_thread = std::thread(&core::Simulator::inputThread, this);
         }
 
-        while(isClockEnabled()) {
+        while(isClockEnabled() && ! stop_requested.load(std::memory_order_relaxed)) {
             executeEvent(std::make_shared<CallbackEvent>(state.pre_instruction_callback_v,
                 state.pre_instruction_callback));
             if(! isClockEnabled()) { break; }    // pre_instruction_callback may pause machine
+            if(state.inst_batch > 1) {
+                executeBatch(check_loops);
+                continue;
+            }
             std::vector<PIEvent> events = executeInstruction();
-            events.push_back(std::make_shared<CallbackEvent>(state.post_instruction_callback_v,
-                state.post_instruction_callback));
             executeEventChain(events);
-            updateDevices();
-            if(! threaded_input) {
+            state.inst_time += state.inst_cost;
+            executeEvent(std::make_shared<CallbackEvent>(state.post_instruction_callback_v,
+                state.post_instruction_callback));
+            if(state.inst_time >= state.scheduler.getNextTime()) {
+                state.scheduler.runDueEvents(state.inst_time);
+            }
+            if(! threaded_input && poll_input) {
                 collectInput();
             }
-            checkAndSetupInterrupts();
+            if(checkAndSetupInterrupts()) {
+                executeEvent(std::make_shared<CallbackEvent>(state.post_instruction_callback_v,
+                    state.post_instruction_callback));
+            }
+            if(check_loops) {
+                state.checkForLoop();
+            }
         }
     } catch(utils::exception & e) {
         exception = e;
@@ -162,11 +157,21 @@ bool Simulator::isClockEnabled(void) const
     return (state.readMemRaw(MCR) & 0x8000) == 0x8000;
 }
 
+// Unlike disableClock, this may be called from another thread while the machine runs. The request is seen once the
+// current batch of instructions is done, and it stands for every later run until the machine is reinitialized.
+void Simulator::requestStop(void)
+{
+    stop_requested = true;
+}
+
+bool Simulator::isStopRequested(void) const
+{
+    return stop_requested;
+}
+
 std::vector<PIEvent> Simulator::executeInstruction(void)
 {
-    if(! state.ignore_privilege && ((state.pc <= SYSTEM_END || state.pc >= MMIO_START)
-        && (state.readMemRaw(PSR) & 0x8000) == 0x8000))
-    {
+    if(! state.canAccess(state.pc, MachineState::MEM_PERM_EXEC)) {
         logger.printf(lc3::utils::PrintType::P_EXTRA, true, "illegal PC 0x%0.4x accessed", state.pc);
         return IInstruction::buildSysCallEnterHelper(state, INTEX_TABLE_START + 0x0, MachineState::SysCallType::EX);
     }
@@ -187,27 +192,81 @@ std::vector<PIEvent> Simulator::executeInstruction(void)
     return events;
 }
 
-void Simulator::updateDevices(void)
+void Simulator::executeBatch(bool check_loops)
 {
-    uint16_t value = state.readMemRaw(DSR);
-    state.writeMemRaw(DSR, value | 0x8000);
+    int64_t countdown = state.inst_batch;
+    uint32_t batch_cost = 0;
+
+    try {
+        do {
+            std::vector<PIEvent> events = executeInstruction();
+            executeEventChain(events);
+            batch_cost += state.inst_cost;
+            countdown -= state.inst_cost;
+            state.inst_time += state.inst_cost;
+            state.inst_cost = 1;
+
+            if(state.inst_time >= state.scheduler.getNextTime()) {
+                state.scheduler.runDueEvents(state.inst_time);
+            }
+            if(! threaded_input && poll_input) {
+                collectInput();
+            }
+            if(checkAndSetupInterrupts()) {
+                // entering the ISR counts as an instruction
+                batch_cost += 1;
+                break;
+            }
+            if(check_loops && state.checkForLoop()) {
+                break;
+            }
+        } while(countdown > 0 && isClockEnabled() && ! state.batch_stops[state.pc]
+            && ! (state.batch_stop_at_halt && state.readMemRaw(state.pc) == 0xf025));
+    } catch(utils::exception &) {
+        // account for the instructions that completed before the exception
+        state.inst_cost = batch_cost;
+        executeEvent(std::make_shared<CallbackEvent>(state.post_instruction_callback_v,
+            state.post_instruction_callback));
+        throw;
+    }
+
+    state.inst_cost = batch_cost;
+    executeEvent(std::make_shared<CallbackEvent>(state.post_instruction_callback_v,
+        state.post_instruction_callback));
 }
 
-void Simulator::checkAndSetupInterrupts(void)
+bool Simulator::checkAndSetupInterrupts(void)
 {
-    uint32_t value = state.readMemRaw(KBSR);
+    uint32_t requests = state.pending_interrupts.load(std::memory_order_relaxed) & state.unmasked_interrupts;
+    if(requests == 0) {
+        return false;
+    }
 
-    if(((value & 0xc000) == 0xc000) && ((state.readMemRaw(PSR) & 0x0700) == 0)) {
-        logger.printf(lc3::utils::PrintType::P_EXTRA, true, "jumping to keyboard ISR");
+    // Service the highest priority request; ties go to the source that was added first.
+    uint32_t source = 0;
+    for(uint32_t i = 0; i < state.interrupt_sources.size(); i += 1) {
+        if(((requests >> i) & 1) == 1
+            && (((requests >> source) & 1) == 0
+                || state.interrupt_sources[i].priority > state.interrupt_sources[source].priority))
+        {
+            source = i;
+        }
+    }
 
-        std::vector<PIEvent> events = IInstruction::buildSysCallEnterHelper(state, INTEX_TABLE_START + 0x80,
-            MachineState::SysCallType::INT, [](uint32_t psr_value) { return (psr_value & 0x78ff) | 0x0400; });
-        // events.push_back(std::make_shared<MemWriteEvent>(KBSR, state.readMemRaw(KBSR) & 0x7fff));
-        events.push_back(std::make_shared<CallbackEvent>(state.post_instruction_callback_v,
-                state.post_instruction_callback));
+    // the ISR entry takes as long as an instruction
+    state.inst_time += 1;
 
-        executeEventChain(events);
-    }
+    MachineState::InterruptSource const & interrupt = state.interrupt_sources[source];
+    logger.printf(lc3::utils::PrintType::P_EXTRA, true, "jumping to %s ISR", interrupt.name.c_str());
+
+    uint32_t priority = interrupt.priority;
+    std::vector<PIEvent> events = IInstruction::buildSysCallEnterHelper(state, INTEX_TABLE_START + interrupt.vector,
+        MachineState::SysCallType::INT, [priority](uint32_t psr_value) {
+            return (psr_value & 0x78ff) | (priority << 8);
+        });
+
+    executeEventChain(events);
+    return true;
 }
 
 void Simulator::executeEventChain(std::vector<PIEvent> & events)
@@ -234,6 +293,14 @@ void Simulator::reinitialize(void)
     }
 
     state.pc = RESET_PC;
+    state.scheduler.clear();
+    state.scripted_input.clear();
+    state.input_generation += 1;
+    state.sys_call_types = std::stack<MachineState::SysCallType>();
+    state.output_count = 0;
+    state.exceeded_max_output_count = false;
+    state.detected_loop = false;
+    stop_requested = false;
 
     for(uint32_t i = 0; i < (1 << 16); i += 1) {
         state.writeMemRaw(i, 0);
@@ -302,6 +369,30 @@ void Simulator::registerWaitForInputCallback(callback_func_t func)
 void lc3::core::Simulator::setIgnorePrivilege(bool ignore)
 {
     state.ignore_privilege = ignore;
+    state.updatePagePermissions();
+}
+
+void Simulator::setPagePermissions(uint32_t start, uint32_t end, bool supervisor, uint32_t perms)
+{
+    state.setPagePermissions(start, end, supervisor, perms);
+    state.updatePagePermissions();
+}
+
+void Simulator::setNativeTraps(bool enable)
+{
+    state.native_traps = enable;
+}
+
+void Simulator::setNativeTrapCost(bool enable)
+{
+    state.native_trap_cost = enable;
+}
+
+void Simulator::recordOSTrapHandlers(void)
+{
+    for(uint32_t i = 0; i < state.os_trap_handlers.size(); i += 1) {
+        state.os_trap_handlers[i] = state.readMemRaw(0x20 + i);
+    }
 }
 
 void Simulator::collectInput(void)
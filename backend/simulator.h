@@ -11,6 +11,7 @@
 #include "inputter.h"
 #include "instruction_decoder.h"
 #include "logger.h"
+#include "obj_image.h"
 #include "printer.h"
 #include "state.h"
 
@@ -28,10 +29,13 @@ namespace core
         ~Simulator(void) = default;
 
         void loadObj(std::istream & buffer);
+        void loadObjImage(ObjImage const & image);
         void simulate(void);
         void enableClock(void);
         void disableClock(void);
         bool isClockEnabled(void) const;
+        void requestStop(void);
+        bool isStopRequested(void) const;
         void reinitialize(void);
 
         void registerPreInstructionCallback(callback_func_t func);
@@ -46,11 +50,18 @@ namespace core
 
         MachineState & getMachineState(void) { return state; }
         MachineState const & getMachineState(void) const { return state; }
+        utils::IInputter & getInputter(void) { return inputter; }
+        bool isThreadedInput(void) const { return threaded_input; }
+        bool isPollingInput(void) const { return poll_input; }
 
         void setPrintLevel(uint32_t print_level) { logger.setPrintLevel(print_level); }
         uint32_t getPrintLevel(void) const { return logger.getPrintLevel(); }
 
         void setIgnorePrivilege(bool ignore);
+        void setPagePermissions(uint32_t start, uint32_t end, bool supervisor, uint32_t perms);
+        void setNativeTraps(bool enable);
+        void setNativeTrapCost(bool enable);
+        void recordOSTrapHandlers(void);
 
     private:
         sim::InstructionDecoder decoder;
@@ -61,13 +72,17 @@ namespace core
         lc3::utils::IInputter & inputter;
 
         bool threaded_input;
+        // An inputter that never has input (see IInputter::hasInput) is not polled after every instruction.
+        bool poll_input;
         std::atomic<bool> collecting_input;
+        // Set from any thread to stop the machine; only read between batches of instructions.
+        std::atomic<bool> stop_requested;
 
         std::vector<PIEvent> executeInstruction(void);
-        void checkAndSetupInterrupts();
+        void executeBatch(bool check_loops);
+        bool checkAndSetupInterrupts(void);
         void executeEventChain(std::vector<PIEvent> & events);
         void executeEvent(PIEvent event);
-        void updateDevices(void);
         void collectInput(void);
         void inputThread(void);
     };
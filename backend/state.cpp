@@ -2,6 +2,7 @@
  * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
  */
 #include <cassert>
+#include <limits>
 #include <mutex>
 
 #include "device_regs.h"
@@ -15,6 +16,24 @@ namespace core
 };
 };
 
+constexpr uint32_t lc3::core::MachineState::KEYBOARD_INTERRUPT;
+constexpr uint32_t lc3::core::MachineState::TIMER_INTERRUPT;
+constexpr uint32_t lc3::core::MachineState::PAGE_BITS;
+constexpr uint32_t lc3::core::MachineState::PAGE_COUNT;
+constexpr uint32_t lc3::core::MachineState::MEM_PERM_READ;
+constexpr uint32_t lc3::core::MachineState::MEM_PERM_WRITE;
+constexpr uint32_t lc3::core::MachineState::MEM_PERM_EXEC;
+constexpr uint32_t lc3::core::MachineState::MEM_PERM_ALL;
+constexpr uint64_t lc3::core::MachineState::LOOP_CHECK_WINDOW;
+
+// splitmix64 finalizer
+static uint64_t mixHash(uint64_t value)
+{
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
 uint32_t lc3::core::MachineState::readMemEvent(uint32_t addr, bool & change_mem, std::shared_ptr<IEvent> & change) const
 {
 #ifdef _ENABLE_DEBUG
@@ -103,9 +122,199 @@ void lc3::core::MachineState::writeMemRaw(uint32_t addr, uint16_t value)
     assert(addr <= 0xFFFF);
 #endif
 
+    if(addr >= MMIO_START) {
+        writeDeviceReg(addr, value);
+        return;
+    }
+
+    if(detect_loops) {
+        updateMemDigest(addr, mem[addr].getValue(), value);
+    }
     mem[addr].setValue(value);
 }
 
+void lc3::core::MachineState::updateMemDigest(uint32_t addr, uint16_t old_value, uint16_t value)
+{
+    // The digest is a sum over every address, so a write only swaps out the term for its address.
+    mem_digest += mixHash((static_cast<uint64_t>(addr) << 16) | value)
+        - mixHash((static_cast<uint64_t>(addr) << 16) | old_value);
+}
+
+void lc3::core::MachineState::resetLoopCheck(void)
+{
+    loop_checkpoints[0] = LoopCheckpoint{0, 1, LOOP_CHECK_WINDOW, 0};
+    loop_checkpoints[1] = LoopCheckpoint{0, 1, std::numeric_limits<uint64_t>::max(), 0};
+    loop_checkpoints_valid = false;
+    loop_check_output_count = output_count;
+}
+
+bool lc3::core::MachineState::checkForLoop(void)
+{
+    // A repeated state only means a loop if nothing from outside the state can change what happens next: input that
+    // is still to come, a running timer, and any output in between all start the search over.
+    if(! scripted_input.empty() || scheduler.getNextTime() != std::numeric_limits<uint64_t>::max()
+        || output_count != loop_check_output_count)
+    {
+        resetLoopCheck();
+        return false;
+    }
+
+    uint64_t hash = mem_digest;
+    for(uint32_t reg : regs) {
+        hash = mixHash(hash + reg);
+    }
+    hash = mixHash(hash + pc);
+    hash = mixHash(hash + sys_call_types.size());
+    hash = mixHash(hash + pending_interrupts.load(std::memory_order_relaxed));
+
+    if(loop_checkpoints_valid && (hash == loop_checkpoints[0].hash || hash == loop_checkpoints[1].hash)) {
+        detected_loop = true;
+        writeMemRaw(MCR, readMemRaw(MCR) & 0x7fff);
+        return true;
+    }
+
+    for(LoopCheckpoint & checkpoint : loop_checkpoints) {
+        checkpoint.count += 1;
+        if(! loop_checkpoints_valid || checkpoint.count == checkpoint.interval) {
+            checkpoint.hash = hash;
+            checkpoint.count = 0;
+            if(checkpoint.interval < checkpoint.max_interval) {
+                checkpoint.interval *= 2;
+            }
+        }
+    }
+    loop_checkpoints_valid = true;
+    return false;
+}
+
+void lc3::core::MachineState::deliverScriptedInput(void)
+{
+    if(scripted_input.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(g_io_lock);
+    uint16_t kbsr = readMemRaw(KBSR);
+    if((kbsr & 0x8000) == 0) {
+        writeMemRaw(KBDR, static_cast<uint8_t>(scripted_input.front()));
+        writeMemRaw(KBSR, kbsr | 0x8000);
+        scripted_input.pop_front();
+    }
+}
+
+void lc3::core::MachineState::writeDeviceReg(uint32_t addr, uint16_t value)
+{
+    if(addr == DSR) {
+        // the display is always ready
+        value |= 0x8000;
+    }
+
+    uint16_t old_value = mem[addr].getValue();
+    if(detect_loops) {
+        updateMemDigest(addr, old_value, value);
+    }
+    mem[addr].setValue(value);
+
+    if(addr == KBSR) {
+        if((value & 0xc000) == 0xc000) {
+            raiseInterrupt(KEYBOARD_INTERRUPT);
+        } else {
+            clearInterrupt(KEYBOARD_INTERRUPT);
+        }
+    } else if(addr == TCR || addr == TIR || addr == TSR) {
+        if(addr != TSR) {
+            updateTimer();
+        }
+        if((readMemRaw(TSR) & 0x8000) == 0x8000 && (readMemRaw(TCR) & 0x4000) == 0x4000) {
+            raiseInterrupt(TIMER_INTERRUPT);
+        } else {
+            clearInterrupt(TIMER_INTERRUPT);
+        }
+    } else if(addr == PSR) {
+        if(((old_value ^ value) & 0x0700) != 0) {
+            updateInterruptMask();
+        }
+        if(((old_value ^ value) & 0x8000) != 0) {
+            updatePagePermissions();
+        }
+    }
+}
+
+void lc3::core::MachineState::setPagePermissions(uint32_t start, uint32_t end, bool supervisor, uint32_t perms)
+{
+    std::array<uint8_t, PAGE_COUNT> & table = supervisor ? supervisor_page_perms : user_page_perms;
+    for(uint32_t page = (start & 0xffff) >> PAGE_BITS; page <= ((end & 0xffff) >> PAGE_BITS); page += 1) {
+        table[page] = static_cast<uint8_t>(perms & MEM_PERM_ALL);
+    }
+}
+
+void lc3::core::MachineState::updatePagePermissions(void)
+{
+    if(ignore_privilege) {
+        page_perms.fill(MEM_PERM_ALL);
+    } else if((readMemRaw(PSR) & 0x8000) == 0x8000) {
+        page_perms = user_page_perms;
+    } else {
+        page_perms = supervisor_page_perms;
+    }
+}
+
+void lc3::core::MachineState::updateTimer(void)
+{
+    timer_generation += 1;
+
+    uint32_t interval = readMemRaw(TIR);
+    if((readMemRaw(TCR) & 0x8000) == 0x8000 && interval != 0) {
+        scheduleTimerExpiry(interval);
+    }
+}
+
+void lc3::core::MachineState::scheduleTimerExpiry(uint32_t interval)
+{
+    uint64_t generation = timer_generation;
+    scheduler.schedule(inst_time + interval, [this, generation, interval]() {
+        if(generation != timer_generation) {
+            return;
+        }
+
+        // The timer keeps running; the ISR acknowledges an expiry by clearing TSR.
+        writeMemRaw(TSR, readMemRaw(TSR) | 0x8000);
+        scheduleTimerExpiry(interval);
+    });
+}
+
+uint32_t lc3::core::MachineState::addInterruptSource(std::string const & name, uint32_t vector, uint32_t priority)
+{
+#ifdef _ENABLE_DEBUG
+    assert(interrupt_sources.size() < 32);
+#endif
+
+    interrupt_sources.emplace_back(name, vector, priority);
+    updateInterruptMask();
+    return static_cast<uint32_t>(interrupt_sources.size() - 1);
+}
+
+void lc3::core::MachineState::raiseInterrupt(uint32_t source)
+{
+    pending_interrupts.fetch_or(1u << source, std::memory_order_relaxed);
+}
+
+void lc3::core::MachineState::clearInterrupt(uint32_t source)
+{
+    pending_interrupts.fetch_and(~(1u << source), std::memory_order_relaxed);
+}
+
+void lc3::core::MachineState::updateInterruptMask(void)
+{
+    uint32_t priority = (readMemRaw(PSR) >> 8) & 0x7;
+    unmasked_interrupts = 0;
+    for(uint32_t i = 0; i < interrupt_sources.size(); i += 1) {
+        if(interrupt_sources[i].priority > priority) {
+            unmasked_interrupts |= 1u << i;
+        }
+    }
+}
+
 void lc3::core::MemWriteEvent::updateState(MachineState & state) const
 {
 #ifdef _ENABLE_DEBUG
@@ -113,15 +322,24 @@ void lc3::core::MemWriteEvent::updateState(MachineState & state) const
 #endif
 
     if(addr == DDR) {
-        char char_value = (char) (value & 0xFF);
-        if(char_value == 10 || char_value == 13) {
-            state.logger.newline(utils::PrintType::P_NONE);
+        if(state.max_output_count != 0 && state.output_count >= state.max_output_count) {
+            state.exceeded_max_output_count = true;
+            state.writeMemRaw(MCR, state.readMemRaw(MCR) & 0x7fff);
         } else {
-            state.logger.print(std::string(1, char_value));
+            char char_value = (char) (value & 0xFF);
+            if(char_value == 10 || char_value == 13) {
+                state.logger.newline(utils::PrintType::P_NONE);
+            } else {
+                state.logger.print(std::string(1, char_value));
+            }
+            state.output_count += 1;
         }
     } else if(addr == KBSR) {
-        std::lock_guard<std::mutex> guard(g_io_lock);
-        state.writeMemSafe(addr, value & 0x4000);
+        {
+            std::lock_guard<std::mutex> guard(g_io_lock);
+            state.writeMemSafe(addr, value & 0x4000);
+        }
+        state.deliverScriptedInput();
         return;
     }
 
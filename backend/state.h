@@ -5,6 +5,8 @@
 #define STATE_H
 
 #include <array>
+#include <atomic>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <stack>
@@ -13,6 +15,7 @@
 #include "device_regs.h"
 #include "logger.h"
 #include "mem.h"
+#include "scheduler.h"
 
 namespace lc3
 {
@@ -38,12 +41,34 @@ namespace core
             , USP
         };
 
+        struct InterruptSource
+        {
+            InterruptSource(std::string const & name, uint32_t vector, uint32_t priority) :
+                name(name), vector(vector), priority(priority) {}
+
+            std::string name;
+            uint32_t vector, priority;
+        };
+
         MachineState(sim & simulator, lc3::utils::Logger & logger) : pc(0), logger(logger),
             pre_instruction_callback_v(false),post_instruction_callback_v(false),
             interrupt_enter_callback_v(false), interrupt_exit_callback_v(false),
             exception_enter_callback_v(false), exception_exit_callback_v(false),
             sub_enter_callback_v(false), sub_exit_callback_v(false),
-            wait_for_input_callback_v(false), simulator(simulator), ignore_privilege(false) {}
+            wait_for_input_callback_v(false), simulator(simulator), ignore_privilege(false), native_traps(false),
+            native_trap_cost(false), inst_cost(1), inst_batch(1), batch_stop_at_halt(false), inst_time(0),
+            output_count(0), max_output_count(0), exceeded_max_output_count(false), input_generation(0),
+            detect_loops(false), detected_loop(false), mem_digest(0), pending_interrupts(0), unmasked_interrupts(0),
+            timer_generation(0)
+        {
+            os_trap_handlers.fill(0x10000);
+
+            // By default user mode may only touch user memory (x3000 to xFDFF), which is exactly pages 24 to 126.
+            user_page_perms.fill(0);
+            setPagePermissions(SYSTEM_END + 1, MMIO_START - 1, false, MEM_PERM_ALL);
+            supervisor_page_perms.fill(MEM_PERM_ALL);
+            page_perms = user_page_perms;
+        }
 
         std::vector<MemEntry> mem;
         std::array<uint32_t, 8> regs;
@@ -60,6 +85,16 @@ namespace core
         void writeMemSafe(uint32_t addr, uint16_t value);
         void writeMemRaw(uint32_t addr, uint16_t value);
 
+        uint32_t addInterruptSource(std::string const & name, uint32_t vector, uint32_t priority);
+        void raiseInterrupt(uint32_t source);
+        void clearInterrupt(uint32_t source);
+        void updateInterruptMask(void);
+        void updateTimer(void);
+
+        bool canAccess(uint32_t addr, uint32_t perms) const { return (page_perms[addr >> PAGE_BITS] & perms) == perms; }
+        void setPagePermissions(uint32_t start, uint32_t end, bool supervisor, uint32_t perms);
+        void updatePagePermissions(void);
+
         bool pre_instruction_callback_v;
         bool post_instruction_callback_v;
         bool interrupt_enter_callback_v;
@@ -81,6 +116,97 @@ namespace core
 
         sim & simulator;
         bool ignore_privilege;
+
+        // When set, TRAP x20-x25 are serviced in C++ as long as the trap vector still points at the routine that was
+        // installed by the OS (os_trap_handlers, indexed from x20).
+        bool native_traps;
+        bool native_trap_cost;
+        std::array<uint32_t, 6> os_trap_handlers;
+
+        // Number of instructions the most recently executed instruction counts as (a natively serviced TRAP may
+        // count as the routine it replaced).
+        uint32_t inst_cost;
+
+        // Up to inst_batch instructions are executed back to back before the pre/post instruction callbacks run
+        // again, in which case inst_cost holds the count for the whole batch. A batch also ends on an interrupt, when
+        // the clock stops, when the PC reaches one of batch_stops, or at a HALT if batch_stop_at_halt is set.
+        uint32_t inst_batch;
+        bool batch_stop_at_halt;
+        std::vector<bool> batch_stops;
+
+        // Instructions executed by the machine (including interrupt entries), which is the time base for the
+        // scheduler.
+        uint64_t inst_time;
+        EventScheduler scheduler;
+
+        // Characters written to the display. Once max_output_count of them have been written (0 means no ceiling),
+        // any further character is dropped and stops the clock, so a program printing in a loop cannot grow its
+        // output without bound.
+        uint64_t output_count;
+        uint64_t max_output_count;
+        bool exceeded_max_output_count;
+
+        // Keystrokes scheduled with sim::scheduleInput that are due but have not been read yet. The next one is put in
+        // KBDR as soon as the program reads the previous one, so scripted input costs nothing while none is pending.
+        // Input scheduled before input_generation was last bumped is dropped.
+        std::deque<char> scripted_input;
+        uint64_t input_generation;
+        void deliverScriptedInput(void);
+
+        // Loop detection (see sim::setLoopDetection). While it is on, mem_digest follows every write to memory, so
+        // that the whole machine hashes in constant time; only its changes matter, not its value. After every
+        // instruction, the hash of the machine is compared against two checkpoints that move forward at doubling
+        // intervals (Brent's algorithm). The first stops doubling at LOOP_CHECK_WINDOW instructions, so a loop of up
+        // to that many instructions is caught within about twice as many instructions of starting, however long the
+        // program ran before. The second keeps doubling, so that longer loops are caught eventually.
+        static constexpr uint64_t LOOP_CHECK_WINDOW = 4096;
+        bool detect_loops;
+        bool detected_loop;
+        uint64_t mem_digest;
+        void resetLoopCheck(void);
+        bool checkForLoop(void);
+
+        // Interrupt controller. Devices raise and clear their source's bit in pending_interrupts, and
+        // unmasked_interrupts holds the sources whose priority is above the PSR priority, so that an interrupt is due
+        // whenever the two intersect. The keyboard and timer are always the first two sources added.
+        static constexpr uint32_t KEYBOARD_INTERRUPT = 0;
+        static constexpr uint32_t TIMER_INTERRUPT = 1;
+        std::vector<InterruptSource> interrupt_sources;
+        std::atomic<uint32_t> pending_interrupts;
+        uint32_t unmasked_interrupts;
+
+        // Memory protection, at the granularity of 512-word pages. Each page has separate permissions (MEM_PERM_*)
+        // for user and supervisor mode, and page_perms holds the ones that apply to the current privilege mode (or
+        // grants everything when ignore_privilege is set). It is only recomputed when one of those changes.
+        static constexpr uint32_t PAGE_BITS = 9;
+        static constexpr uint32_t PAGE_COUNT = 1 << (16 - PAGE_BITS);
+        static constexpr uint32_t MEM_PERM_READ = 0x1;
+        static constexpr uint32_t MEM_PERM_WRITE = 0x2;
+        static constexpr uint32_t MEM_PERM_EXEC = 0x4;
+        static constexpr uint32_t MEM_PERM_ALL = MEM_PERM_READ | MEM_PERM_WRITE | MEM_PERM_EXEC;
+        std::array<uint8_t, PAGE_COUNT> user_page_perms;
+        std::array<uint8_t, PAGE_COUNT> supervisor_page_perms;
+        std::array<uint8_t, PAGE_COUNT> page_perms;
+
+    private:
+        // Bumped whenever the timer is reprogrammed so that expiries scheduled before then are ignored.
+        uint64_t timer_generation;
+
+        struct LoopCheckpoint
+        {
+            uint64_t hash;
+            uint64_t interval;
+            uint64_t max_interval;
+            uint64_t count;
+        };
+        std::array<LoopCheckpoint, 2> loop_checkpoints;
+        bool loop_checkpoints_valid = false;
+        uint64_t loop_check_output_count = 0;
+
+        void updateMemDigest(uint32_t addr, uint16_t old_value, uint16_t value);
+
+        void writeDeviceReg(uint32_t addr, uint16_t value);
+        void scheduleTimerExpiry(uint32_t interval);
     };
 
     enum class EventType {
@@ -92,6 +218,7 @@ namespace core
         , EVENT_CALLBACK
         , PUSH_SYS_CALL_TYPE
         , POP_SYS_CALL_TYPE
+        , EVENT_INST_COST
     };
 
     class IEvent
@@ -205,6 +332,16 @@ namespace core
         }
         virtual std::string getOutputString(MachineState const & state) const override { (void)state; return ""; }
     };
+
+    class InstCostEvent : public IEvent
+    {
+    public:
+        InstCostEvent(uint32_t cost) : IEvent(EventType::EVENT_INST_COST), cost(cost) {}
+        virtual void updateState(MachineState & state) const override { state.inst_cost = cost; }
+        virtual std::string getOutputString(MachineState const & state) const override { (void)state; return ""; }
+    private:
+        uint32_t cost;
+    };
 };
 };
 
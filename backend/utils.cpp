@@ -3,6 +3,9 @@
  */
 #include <algorithm>
 #include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <random>
 #include <stdexcept>
 #include <string>
 
@@ -71,3 +74,110 @@ std::string lc3::utils::toLower(std::string const & str)
     std::transform(ret.begin(), ret.end(), ret.begin(), ::tolower);
     return ret;
 }
+
+uint64_t lc3::utils::fnv1aHash(std::string const & data)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(char c : data) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// SHA-256 (FIPS 180-4), for keys that must not collide even when the data is chosen to make them. Returns the digest
+// as 64 lowercase hex digits.
+std::string lc3::utils::sha256Hash(std::string const & data)
+{
+    static uint32_t const round_constants[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    uint32_t hash[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    // The message is padded with a 1 bit, zeros, and its length in bits, to a multiple of 64 bytes.
+    std::string message = data;
+    uint64_t bit_count = static_cast<uint64_t>(data.size()) * 8;
+    message += static_cast<char>(0x80);
+    while(message.size() % 64 != 56) {
+        message += static_cast<char>(0);
+    }
+    for(int shift = 56; shift >= 0; shift -= 8) {
+        message += static_cast<char>((bit_count >> shift) & 0xff);
+    }
+
+    auto rotr = [](uint32_t value, uint32_t count) { return (value >> count) | (value << (32 - count)); };
+    for(std::size_t block = 0; block < message.size(); block += 64) {
+        uint32_t words[64];
+        for(uint32_t i = 0; i < 16; i += 1) {
+            words[i] = 0;
+            for(uint32_t j = 0; j < 4; j += 1) {
+                words[i] = (words[i] << 8) | static_cast<uint8_t>(message[block + i * 4 + j]);
+            }
+        }
+        for(uint32_t i = 16; i < 64; i += 1) {
+            uint32_t s0 = rotr(words[i - 15], 7) ^ rotr(words[i - 15], 18) ^ (words[i - 15] >> 3);
+            uint32_t s1 = rotr(words[i - 2], 17) ^ rotr(words[i - 2], 19) ^ (words[i - 2] >> 10);
+            words[i] = words[i - 16] + s0 + words[i - 7] + s1;
+        }
+
+        uint32_t a = hash[0], b = hash[1], c = hash[2], d = hash[3];
+        uint32_t e = hash[4], f = hash[5], g = hash[6], h = hash[7];
+        for(uint32_t i = 0; i < 64; i += 1) {
+            uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            uint32_t choice = (e & f) ^ (~e & g);
+            uint32_t temp1 = h + s1 + choice + round_constants[i] + words[i];
+            uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t temp2 = s0 + majority;
+            h = g;
+            g = f;
+            f = e;
+            e = d + temp1;
+            d = c;
+            c = b;
+            b = a;
+            a = temp1 + temp2;
+        }
+        hash[0] += a; hash[1] += b; hash[2] += c; hash[3] += d;
+        hash[4] += e; hash[5] += f; hash[6] += g; hash[7] += h;
+    }
+
+    std::string digest;
+    for(uint32_t value : hash) {
+        digest += ssprintf("%08x", value);
+    }
+    return digest;
+}
+
+// Writes to a temporary file first and then renames it into place, so that other processes never see a partial file.
+bool lc3::utils::writeFileAtomic(std::string const & filename, std::string const & contents)
+{
+    std::random_device dev;
+    std::string temp_filename = filename + ".tmp" + std::to_string(dev());
+    {
+        std::ofstream temp_file(temp_filename, std::ios_base::binary);
+        if(! temp_file) {
+            return false;
+        }
+        temp_file << contents;
+        if(! temp_file) {
+            temp_file.close();
+            std::remove(temp_filename.c_str());
+            return false;
+        }
+    }
+    if(std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        std::remove(temp_filename.c_str());
+        return false;
+    }
+    return true;
+}
@@ -22,6 +22,9 @@ namespace utils
     uint32_t computePSRCC(uint32_t value, uint32_t psr);
     uint32_t computeBasePlusSOffset(uint32_t base, uint32_t signed_off, uint32_t width);
     std::string toLower(std::string const & str);
+    uint64_t fnv1aHash(std::string const & data);
+    std::string sha256Hash(std::string const & data);
+    bool writeFileAtomic(std::string const & filename, std::string const & contents);
 
     template<typename ... Args>
     std::string ssprintf(std::string const & format, Args ... args)
@@ -0,0 +1,395 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "interface.h"
+#include "sim_pool.h"
+#include "stream_printer.h"
+#include "watchdog.h"
+
+// Runs programs without any interaction: the input is given up front, the program output goes to a stream, and a
+// JSON summary of the run is written once the program stops.
+
+struct CLIArgs
+{
+    uint32_t print_level = 1;
+    bool ignore_privilege = false;
+    bool liberal_asm = false;
+    bool native_traps = false;
+    uint64_t max_insts = 0;
+    double timeout = 0;
+    uint64_t max_output = 0;
+    bool detect_loops = false;
+    // With --each, the number of programs to run at a time; 0 runs the files as a single program.
+    uint32_t each_jobs = 0;
+    std::string input_filename;
+    std::string input_script_filename;
+    std::string output_filename;
+    std::string summary_filename;
+};
+
+bool endsWith(std::string const & search, std::string const & suffix)
+{
+    if(suffix.size() > search.size()) { return false; }
+    return std::equal(suffix.rbegin(), suffix.rend(), search.rbegin());
+}
+
+// Each line of an input script is an instruction count followed by the text to type once the program has executed
+// that many instructions, e.g. "500 q\n". The text may use the escapes \n, \t, \\, and \xHH.
+bool loadInputScript(std::string const & filename, lc3::sim & simulator)
+{
+    std::ifstream file(filename);
+    if(! file) {
+        return false;
+    }
+
+    std::string line;
+    while(std::getline(file, line)) {
+        if(line.empty()) { continue; }
+
+        std::stringstream line_tokens(line);
+        uint64_t inst_count;
+        line_tokens >> inst_count;
+        if(line_tokens.fail()) {
+            return false;
+        }
+        if(line_tokens.peek() == ' ') {
+            line_tokens.get();
+        }
+        std::string raw(std::istreambuf_iterator<char>(line_tokens), {});
+
+        std::string text;
+        for(std::size_t i = 0; i < raw.size(); i += 1) {
+            if(raw[i] != '\\' || i + 1 == raw.size()) {
+                text += raw[i];
+                continue;
+            }
+            i += 1;
+            switch(raw[i]) {
+                case 'n': text += '\n'; break;
+                case 't': text += '\t'; break;
+                case 'x':
+                    if(i + 2 < raw.size() && std::isxdigit(raw[i + 1]) && std::isxdigit(raw[i + 2])) {
+                        text += static_cast<char>(std::stoi(raw.substr(i + 1, 2), nullptr, 16));
+                        i += 2;
+                    } else {
+                        text += 'x';
+                    }
+                    break;
+                default: text += raw[i]; break;
+            }
+        }
+        simulator.scheduleInput(inst_count, text);
+    }
+    return true;
+}
+
+// How a run that was started with runUntilHalt ended.
+std::string getExitReason(lc3::sim const & simulator, bool success)
+{
+    if(! success) {
+        return "error";
+    } else if(simulator.isCancelled()) {
+        return "timeout";
+    } else if(simulator.didExceedMaxOutputCount()) {
+        return "output_limit";
+    } else if(simulator.didDetectLoop()) {
+        return "loop";
+    } else if(simulator.didStopAtInstLimit()) {
+        return "inst_limit";
+    }
+    return "halt";
+}
+
+// The JSON summary of a run, on one line. The registers are left out if there is no machine to read them from, and
+// the program output is only included if it is given.
+std::string getSummary(std::vector<std::string> const & filenames, std::string const & exit_reason,
+    uint64_t inst_count, double run_time, lc3::sim const * simulator, std::string const * output)
+{
+    std::ostringstream summary;
+    summary << "{\"files\": [";
+    for(std::size_t i = 0; i < filenames.size(); i += 1) {
+        summary << (i == 0 ? "" : ", ") << jsonString(filenames[i]);
+    }
+    summary << "], \"exit_reason\": " << jsonString(exit_reason)
+            << ", \"instructions\": " << inst_count
+            << ", \"wall_time\": " << run_time
+            << ", \"mips\": " << (run_time > 0 ? inst_count / run_time / 1e6 : 0);
+    if(simulator != nullptr) {
+        summary << ", \"registers\": {";
+        for(uint16_t i = 0; i < 8; i += 1) {
+            summary << "\"R" << i << "\": " << simulator->getReg(i) << ", ";
+        }
+        summary << "\"PC\": " << simulator->getPC() << ", \"PSR\": " << simulator->getPSR() << ", \"CC\": \""
+                << simulator->getCC() << "\"}";
+    }
+    if(output != nullptr) {
+        summary << ", \"output\": " << jsonString(*output);
+    }
+    summary << "}\n";
+    return summary.str();
+}
+
+bool writeSummary(CLIArgs const & args, std::string const & summary)
+{
+    if(args.summary_filename.empty()) {
+        std::cerr << summary;
+        return true;
+    }
+    std::ofstream summary_file(args.summary_filename);
+    summary_file << summary;
+    if(! summary_file) {
+        std::cerr << "could not write " << args.summary_filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Runs each file as its own program on a pool of machines, args.each_jobs at a time, and writes a summary line for
+// each, in the order the files were given, with the program output in the summary.
+int runEach(CLIArgs const & args, std::vector<std::string> const & filenames, std::string const & input,
+    lc3::as & assembler, lc3::conv & converter)
+{
+    std::vector<std::string> summaries(filenames.size());
+    bool any_error = false;
+    bool any_limit = false;
+    {
+        // a pool of 0 workers would get one per core
+        lc3::sim_pool pool(std::max(std::min(args.each_jobs, static_cast<uint32_t>(filenames.size())), 1u));
+        std::mutex lock;
+        for(std::size_t i = 0; i < filenames.size(); i += 1) {
+            std::string const & filename = filenames[i];
+            lc3::optional<std::string> obj_filename;
+            if(endsWith(filename, ".obj")) {
+                obj_filename = filename;
+            } else if(endsWith(filename, ".bin")) {
+                obj_filename = converter.convertBin(filename);
+            } else {
+                obj_filename = assembler.assemble(filename);
+            }
+
+            if(! obj_filename) {
+                summaries[i] = getSummary({filename}, "load_failed", 0, 0, nullptr, nullptr);
+                std::lock_guard<std::mutex> guard(lock);
+                any_error = true;
+                continue;
+            }
+
+            lc3::sim_pool::Job job;
+            job.obj_filenames.push_back(*obj_filename);
+            job.input = input;
+            job.inst_limit = args.max_insts;
+            job.until_halt = true;
+            job.max_output_count = args.max_output;
+            job.detect_loops = args.detect_loops;
+            job.ignore_privilege = args.ignore_privilege;
+            job.native_traps = args.native_traps;
+            job.on_complete = [&, i](lc3::sim & simulator, lc3::sim_pool::JobResult const & result) {
+                std::string exit_reason = result.loaded ? getExitReason(simulator, result.success) : "load_failed";
+                summaries[i] = getSummary({filenames[i]}, exit_reason, result.inst_count,
+                    std::chrono::duration<double>(result.run_time).count(), &simulator, &result.output);
+
+                std::lock_guard<std::mutex> guard(lock);
+                any_error = any_error || exit_reason == "load_failed" || exit_reason == "error";
+                any_limit = any_limit || exit_reason != "halt";
+            };
+            pool.submit(job);
+        }
+        pool.wait();
+    }
+
+    std::string all_summaries;
+    for(std::string const & summary : summaries) {
+        all_summaries += summary;
+    }
+    if(! writeSummary(args, all_summaries)) {
+        return 1;
+    }
+    return any_error ? 1 : (any_limit ? 2 : 0);
+}
+
+int main(int argc, char * argv[])
+{
+    CLIArgs args;
+    std::vector<std::pair<std::string, std::string>> parsed_args = parseCLIArgs(argc, argv);
+    for(auto const & arg : parsed_args) {
+        if(std::get<0>(arg) == "print-level") {
+            args.print_level = std::stoi(std::get<1>(arg));
+        } else if(std::get<0>(arg) == "ignore-privilege") {
+            args.ignore_privilege = true;
+        } else if(std::get<0>(arg) == "liberal-asm") {
+            args.liberal_asm = true;
+        } else if(std::get<0>(arg) == "native-traps") {
+            args.native_traps = true;
+        } else if(std::get<0>(arg) == "max-insts") {
+            args.max_insts = std::stoull(std::get<1>(arg));
+        } else if(std::get<0>(arg) == "timeout") {
+            args.timeout = std::stod(std::get<1>(arg));
+        } else if(std::get<0>(arg) == "max-output") {
+            args.max_output = std::stoull(std::get<1>(arg));
+        } else if(std::get<0>(arg) == "detect-loops") {
+            args.detect_loops = true;
+        } else if(std::get<0>(arg) == "each") {
+            if(std::get<1>(arg) == "") {
+                args.each_jobs = std::max(std::thread::hardware_concurrency(), 1u);
+            } else {
+                int each_jobs = std::stoi(std::get<1>(arg));
+                if(each_jobs < 1) {
+                    std::cerr << "--each needs at least 1 program at a time\n";
+                    return 1;
+                }
+                args.each_jobs = each_jobs;
+            }
+        } else if(std::get<0>(arg) == "input") {
+            args.input_filename = std::get<1>(arg);
+        } else if(std::get<0>(arg) == "input-script") {
+            args.input_script_filename = std::get<1>(arg);
+        } else if(std::get<0>(arg) == "output") {
+            args.output_filename = std::get<1>(arg);
+        } else if(std::get<0>(arg) == "summary") {
+            args.summary_filename = std::get<1>(arg);
+        } else if(std::get<0>(arg) == "h" || std::get<0>(arg) == "help") {
+            std::cout << "usage: " << argv[0] << " [OPTIONS] FILE [FILE ...]\n";
+            std::cout << "\n";
+            std::cout << "  -h,--help              Print this message\n";
+            std::cout << "  --print-level=N        Simulator output verbosity [0-9] (default: 1)\n";
+            std::cout << "  --ignore-privilege     Ignore access violations\n";
+            std::cout << "  --liberal-asm          Enable liberal assembly syntax\n";
+            std::cout << "  --native-traps         Service OS TRAPs natively\n";
+            std::cout << "  --max-insts=N          Stop after N instructions\n";
+            std::cout << "  --timeout=SECONDS      Stop after SECONDS of wall-clock time\n";
+            std::cout << "  --max-output=N         Stop once the program prints more than N characters\n";
+            std::cout << "  --detect-loops         Stop once the program is stuck in an infinite loop\n";
+            std::cout << "  --each[=N]             Run each FILE as its own program, N at a time (default: one per\n";
+            std::cout << "                         core), and write a summary line for each\n";
+            std::cout << "  --input=FILE           Type the contents of FILE (- for stdin) on the keyboard\n";
+            std::cout << "  --input-script=FILE    Type input at the instruction counts given in FILE\n";
+            std::cout << "  --output=FILE          Write the program output to FILE instead of stdout\n";
+            std::cout << "  --summary=FILE         Write the JSON summary to FILE instead of stderr\n";
+            return 0;
+        }
+    }
+
+    std::vector<std::string> filenames;
+    for(int i = 1; i < argc; i += 1) {
+        std::string filename(argv[i]);
+        if(filename[0] != '-') {
+            filenames.push_back(filename);
+        }
+    }
+    if(filenames.empty()) {
+        std::cerr << "no files to run\n";
+        return 1;
+    }
+
+    if(args.each_jobs != 0 && (args.timeout > 0 || ! args.input_script_filename.empty() ||
+        ! args.output_filename.empty()))
+    {
+        std::cerr << "--timeout, --input-script, and --output can not be used with --each\n";
+        return 1;
+    }
+
+    std::ofstream output_file;
+    if(! args.output_filename.empty()) {
+        output_file.open(args.output_filename, std::ios_base::binary);
+        if(! output_file) {
+            std::cerr << "could not open " << args.output_filename << "\n";
+            return 1;
+        }
+    }
+    std::ostream & output = args.output_filename.empty() ? std::cout : output_file;
+
+    // Assembler messages go to stderr so that they are not mixed into the program output.
+    lc3::StreamPrinter message_printer(std::cerr);
+    lc3::as assembler(message_printer, args.print_level, false, args.liberal_asm);
+    lc3::conv converter(message_printer, args.print_level, false);
+
+    std::string input;
+    if(! args.input_filename.empty() && ! readInputFile(args.input_filename, input)) {
+        std::cerr << "could not read " << args.input_filename << "\n";
+        return 1;
+    }
+
+    if(args.each_jobs != 0) {
+        return runEach(args, filenames, input, assembler, converter);
+    }
+
+    lc3::StreamPrinter printer(output);
+    lc3::utils::NullInputter inputter;
+    lc3::sim simulator(printer, inputter, false, args.print_level, false);
+
+    if(args.ignore_privilege) {
+        simulator.setIgnorePrivilege(true);
+    }
+    if(args.native_traps) {
+        simulator.setNativeTraps(true);
+    }
+    if(args.max_output != 0) {
+        simulator.setMaxOutputCount(args.max_output);
+    }
+    if(args.detect_loops) {
+        simulator.setLoopDetection(true);
+    }
+
+    bool loaded = true;
+    for(std::string const & filename : filenames) {
+        lc3::optional<std::string> obj_filename;
+        if(endsWith(filename, ".obj")) {
+            obj_filename = filename;
+        } else if(endsWith(filename, ".bin")) {
+            obj_filename = converter.convertBin(filename);
+        } else {
+            obj_filename = assembler.assemble(filename);
+        }
+        if(! obj_filename || ! simulator.loadObjFile(*obj_filename)) {
+            std::cerr << "could not load " << filename << "\n";
+            loaded = false;
+            break;
+        }
+    }
+
+    if(loaded && ! input.empty()) {
+        simulator.scheduleInput(0, input);
+    }
+    if(loaded && ! args.input_script_filename.empty() && ! loadInputScript(args.input_script_filename, simulator)) {
+        std::cerr << "could not read input script " << args.input_script_filename << "\n";
+        return 1;
+    }
+
+    // A timeout cancels the run from another thread, so the program runs in one piece whether or not it has one.
+    std::string exit_reason = "load_failed";
+    std::chrono::duration<double> run_time(0);
+    if(loaded) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        lc3::Watchdog watchdog(simulator, args.timeout > 0 ? start + lc3::secondsToDuration(args.timeout) :
+            std::chrono::steady_clock::time_point::max());
+        simulator.setRunInstLimit(args.max_insts);
+        bool success = simulator.runUntilHalt();
+        watchdog.disarm();
+        run_time = std::chrono::steady_clock::now() - start;
+        exit_reason = getExitReason(simulator, success);
+    }
+    output.flush();
+
+    if(! writeSummary(args, getSummary(filenames, exit_reason, simulator.getInstExecCount(), run_time.count(),
+        &simulator, nullptr)))
+    {
+        return 1;
+    }
+
+    if(exit_reason == "halt") {
+        return 0;
+    }
+    return exit_reason == "load_failed" || exit_reason == "error" ? 1 : 2;
+}
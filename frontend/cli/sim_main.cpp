@@ -5,6 +5,7 @@
 #ifdef _ENABLE_DEBUG
     #include <chrono>
 #endif
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -13,12 +14,18 @@
 #include "console_printer.h"
 #include "console_inputter.h"
 #include "interface.h"
+#include "stream_printer.h"
 
 std::string previous_command = "";
 uint32_t init_pc = RESET_PC;
+// In batch mode, commands come from a script or a pipe rather than a person: there is no prompt, output is not
+// flushed after every line, and the exit status reports whether any command failed.
+bool batch_mode = false;
+uint32_t error_count = 0;
 
 void help(void);
-bool prompt(lc3::sim & simulator);
+bool prompt(lc3::sim & simulator, std::istream & commands);
+void commandError(std::string const & message);
 bool promptMain(lc3::sim & simulator, std::stringstream & command_tokens);
 void promptBreak(lc3::sim & simulator, std::stringstream & command_tokens);
 void list(lc3::sim const & simulator, int32_t context);
@@ -30,6 +37,9 @@ struct CLIArgs
 {
     uint32_t print_level = DEFAULT_PRINT_LEVEL;
     bool ignore_privilege = false;
+    bool batch = false;
+    std::string script_filename;
+    std::string input_filename;
 };
 
 int main(int argc, char * argv[])
@@ -41,21 +51,58 @@ int main(int argc, char * argv[])
             args.print_level = std::stoi(std::get<1>(arg));
         } else if(std::get<0>(arg) == "ignore-privilege") {
             args.ignore_privilege = true;
+        } else if(std::get<0>(arg) == "batch") {
+            args.batch = true;
+        } else if(std::get<0>(arg) == "script") {
+            args.script_filename = std::get<1>(arg);
+            args.batch = true;
+        } else if(std::get<0>(arg) == "input") {
+            args.input_filename = std::get<1>(arg);
         } else if(std::get<0>(arg) == "h" || std::get<0>(arg) == "help") {
             std::cout << "usage: " << argv[0] << " [OPTIONS]\n";
             std::cout << "\n";
             std::cout << "  -h,--help              Print this message\n";
             std::cout << "  --print-level=N        Output verbosity [0-9]\n";
             std::cout << "  --ignore-privilege     Ignore access violations\n";
+            std::cout << "  --batch                Read commands from stdin without prompting\n";
+            std::cout << "  --script=FILE          Read commands from FILE (implies --batch)\n";
+            std::cout << "  --input=FILE           With --batch, type the contents of FILE on the keyboard\n";
             return 0;
         }
     }
 
-    help();
+    batch_mode = args.batch;
 
-    lc3::ConsolePrinter printer;
-    lc3::ConsoleInputter inputter;
-    lc3::sim simulator(printer, inputter, true, args.print_level, false);
+    std::ifstream script_file;
+    if(! args.script_filename.empty()) {
+        script_file.open(args.script_filename);
+        if(! script_file) {
+            std::cerr << "could not open " << args.script_filename << "\n";
+            return 1;
+        }
+    }
+    std::istream & commands = args.script_filename.empty() ? std::cin : script_file;
+
+    std::string input;
+    if(! args.input_filename.empty() && ! readInputFile(args.input_filename, input)) {
+        std::cerr << "could not read " << args.input_filename << "\n";
+        return 1;
+    }
+
+    if(! batch_mode) {
+        help();
+    }
+
+    // In batch mode the program input is given up front, so the terminal is left alone.
+    lc3::ConsolePrinter console_printer;
+    lc3::StreamPrinter stream_printer(std::cout);
+    lc3::ConsoleInputter console_inputter;
+    lc3::utils::NullInputter null_inputter;
+    lc3::utils::IPrinter & printer = batch_mode ? static_cast<lc3::utils::IPrinter &>(stream_printer)
+        : static_cast<lc3::utils::IPrinter &>(console_printer);
+    lc3::utils::IInputter & inputter = batch_mode ? static_cast<lc3::utils::IInputter &>(null_inputter)
+        : static_cast<lc3::utils::IInputter &>(console_inputter);
+    lc3::sim simulator(printer, inputter, ! batch_mode, args.print_level, false);
 
     simulator.registerBreakpointCallback(breakpointCallback);
     if(args.ignore_privilege) {
@@ -64,16 +111,21 @@ int main(int argc, char * argv[])
 
     for(int i = 1; i < argc; i += 1) {
         std::string arg(argv[i]);
-        if(arg[0] != '-') {
-            simulator.loadObjFile(std::string(argv[i]));
+        if(arg[0] != '-' && ! simulator.loadObjFile(std::string(argv[i]))) {
+            error_count += 1;
         }
     }
 
     init_pc = simulator.getPC();
 
-    while(prompt(simulator)) {}
+    if(batch_mode && ! input.empty()) {
+        simulator.scheduleInput(0, input);
+    }
 
-    return 0;
+    while(prompt(simulator, commands)) {}
+
+    std::cout << std::flush;
+    return batch_mode && error_count > 0 ? 1 : 0;
 }
 
 void help(void)
@@ -99,6 +151,12 @@ void help(void)
               ;
 }
 
+void commandError(std::string const & message)
+{
+    std::cout << message << "\n";
+    error_count += 1;
+}
+
 void breakHelp(void)
 {
     std::cout << "break clear <id>  - clears the given breakpoint\n"
@@ -108,13 +166,22 @@ void breakHelp(void)
               ;
 }
 
-bool prompt(lc3::sim & simulator)
+bool prompt(lc3::sim & simulator, std::istream & commands)
 {
-    std::cout << "Executed " << simulator.getInstExecCount() << " instructions\n";
-    std::cout << "> ";
+    if(! batch_mode) {
+        std::cout << "Executed " << simulator.getInstExecCount() << " instructions\n";
+        std::cout << "> ";
+    }
     std::string command_line;
-    std::getline(std::cin, command_line);
-    if(command_line == "") {
+    if(! std::getline(commands, command_line)) {
+        return false;
+    }
+    if(batch_mode) {
+        // a script does not repeat commands, and may have blank lines and comments
+        if(command_line.find_first_not_of(" \t\r") == std::string::npos || command_line[0] == '#') {
+            return true;
+        }
+    } else if(command_line == "") {
         command_line = previous_command;
     }
 
@@ -146,16 +213,18 @@ bool promptMain(lc3::sim & simulator, std::stringstream & command_tokens)
         std::string filename;
         command_tokens >> filename;
         if(command_tokens.fail()) {
-            std::cout << "must supply filename argument to load\n";
+            commandError("must supply filename argument to load");
             return true;
         }
 
-        simulator.loadObjFile(filename);
+        if(! simulator.loadObjFile(filename)) {
+            error_count += 1;
+        }
     } else if(command == "mem") {
         std::string start_s, end_s;
         command_tokens >> start_s;
         if(command_tokens.fail()) {
-            std::cout << "must supply start address\n";
+            commandError("must supply start address");
             return true;
         }
         command_tokens >> end_s;
@@ -169,7 +238,7 @@ bool promptMain(lc3::sim & simulator, std::stringstream & command_tokens)
             end = std::stoi(end_s, 0, 0);
         } catch(std::exception const & e) {
             (void) e;
-            std::cout << "invalid address\n";
+            commandError("invalid address");
             return true;
         }
 
@@ -183,7 +252,7 @@ bool promptMain(lc3::sim & simulator, std::stringstream & command_tokens)
         uint32_t print_level;
         command_tokens >> print_level;
         if(command_tokens.fail()) {
-            std::cout << "must supply print level\n";
+            commandError("must supply print level");
             return true;
         }
         simulator.setPrintLevel(print_level);
@@ -223,7 +292,9 @@ bool promptMain(lc3::sim & simulator, std::stringstream & command_tokens)
         } else {
             simulator.setRunInstLimit(0);
         }
-        simulator.run();
+        if(! simulator.run()) {
+            error_count += 1;
+        }
 #ifdef _ENABLE_DEBUG
         auto end_time = std::chrono::steady_clock::now();
         uint64_t end_count = simulator.getInstExecCount();
@@ -234,7 +305,7 @@ bool promptMain(lc3::sim & simulator, std::stringstream & command_tokens)
         std::string loc_s, val_s;
         command_tokens >> loc_s >> val_s;
         if(command_tokens.fail()) {
-            std::cout << "must supply location and value\n";
+            commandError("must supply location and value");
             return true;
         }
 
@@ -243,14 +314,14 @@ bool promptMain(lc3::sim & simulator, std::stringstream & command_tokens)
             val = std::stoi(val_s, 0, 0);
         } catch(std::exception const & e) {
             (void) e;
-            std::cout << "invalid value\n";
+            commandError("invalid value");
             return true;
         }
 
         std::transform(loc_s.begin(), loc_s.end(), loc_s.begin(), ::tolower);
         if(loc_s[0] == 'r') {
             if(loc_s.size() != 2 || loc_s[1] > '7') {
-                std::cout << "invalid register\n";
+                commandError("invalid register");
                 return true;
             }
             uint32_t id = loc_s[1] - '0';
@@ -267,7 +338,7 @@ bool promptMain(lc3::sim & simulator, std::stringstream & command_tokens)
                 addr = std::stoi(loc_s, 0, 0);
             } catch(std::exception const & e) {
                 (void) e;
-                std::cout << "invalid address\n";
+                commandError("invalid address");
                 return true;
             }
             simulator.setMem(addr, val);
@@ -276,25 +347,28 @@ bool promptMain(lc3::sim & simulator, std::stringstream & command_tokens)
         std::string sub_command;
         command_tokens >> sub_command;
         if(command_tokens.fail()) {
-            std::cout << "must specify type of step\n";
+            commandError("must specify type of step");
             return true;
         }
 
+        bool success;
         if(sub_command == "in") {
-            simulator.stepIn();
-            list(simulator, 2);
+            success = simulator.stepIn();
         } else if(sub_command == "out") {
-            simulator.stepOut();
-            list(simulator, 2);
+            success = simulator.stepOut();
         } else if(sub_command == "over") {
-            simulator.stepOver();
-            list(simulator, 2);
+            success = simulator.stepOver();
         } else {
-            std::cout << "invalid step operation\n";
+            commandError("invalid step operation");
+            return true;
+        }
+        if(! success) {
+            error_count += 1;
         }
+        list(simulator, 2);
         return true;
     } else {
-        std::cout << "unknown command\n";
+        commandError("unknown command");
     }
 
     return true;
@@ -305,7 +379,7 @@ void promptBreak(lc3::sim & simulator, std::stringstream & command_tokens)
     std::string command;
     command_tokens >> command;
     if(command_tokens.fail()) {
-        std::cout << "must provide action\n";
+        commandError("must provide action");
         return;
     }
 
@@ -313,13 +387,13 @@ void promptBreak(lc3::sim & simulator, std::stringstream & command_tokens)
         uint32_t id;
         command_tokens >> id;
         if(command_tokens.fail()) {
-            std::cout << "must supply id\n";
+            commandError("must supply id");
             return;
         }
 
         bool removed = simulator.removeBreakpointByID(id);
         if(! removed) {
-            std::cout << "invalid id\n";
+            commandError("invalid id");
             return;
         }
     } else if(command == "help") {
@@ -332,7 +406,7 @@ void promptBreak(lc3::sim & simulator, std::stringstream & command_tokens)
         std::string loc_s;
         command_tokens >> loc_s;
         if(command_tokens.fail()) {
-            std::cout << "must supply location\n";
+            commandError("must supply location");
             return;
         }
 
@@ -341,7 +415,7 @@ void promptBreak(lc3::sim & simulator, std::stringstream & command_tokens)
             loc = std::stoi(loc_s, 0, 0);
         } catch(std::exception const & e) {
             (void) e;
-            std::cout << "invalid value\n";
+            commandError("invalid value");
             return;
         }
 
@@ -349,7 +423,7 @@ void promptBreak(lc3::sim & simulator, std::stringstream & command_tokens)
         std::cout << bp << "\n";
 
     } else  {
-        std::cout << "unknown command\n";
+        commandError("unknown command");
     }
 }
 
@@ -1,7 +1,11 @@
 /*
  * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
  */
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
 
 #include "common.h"
 
@@ -30,3 +34,43 @@ std::vector<std::pair<std::string, std::string>> parseCLIArgs(int argc, char * a
     return parsed_args;
 }
 
+bool readInputFile(std::string const & filename, std::string & contents)
+{
+    std::stringstream buffer;
+    if(filename == "-") {
+        buffer << std::cin.rdbuf();
+    } else {
+        std::ifstream file(filename, std::ios_base::binary);
+        if(! file) {
+            return false;
+        }
+        buffer << file.rdbuf();
+    }
+    contents = buffer.str();
+    return true;
+}
+
+std::string jsonString(std::string const & str)
+{
+    std::string ret = "\"";
+    for(char c : str) {
+        switch(c) {
+            case '"' : ret += "\\\""; break;
+            case '\\': ret += "\\\\"; break;
+            case '\n': ret += "\\n"; break;
+            case '\r': ret += "\\r"; break;
+            case '\t': ret += "\\t"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20) {
+                    char escape[7];
+                    std::snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned char>(c));
+                    ret += escape;
+                } else {
+                    ret += c;
+                }
+                break;
+        }
+    }
+    ret += "\"";
+    return ret;
+}
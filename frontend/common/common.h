@@ -8,5 +8,9 @@
 #include <vector>
 
 std::vector<std::pair<std::string, std::string>> parseCLIArgs(int argc, char * argv[]);
+// Reads all of filename, or of stdin if filename is "-".
+bool readInputFile(std::string const & filename, std::string & contents);
+// Quotes and escapes str as a JSON string.
+std::string jsonString(std::string const & str);
 
 #endif
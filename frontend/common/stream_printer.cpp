@@ -0,0 +1,19 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include "stream_printer.h"
+
+void lc3::StreamPrinter::setColor(lc3::utils::PrintColor color)
+{
+    (void) color;
+}
+
+void lc3::StreamPrinter::print(std::string const & string)
+{
+    out << string;
+}
+
+void lc3::StreamPrinter::newline(void)
+{
+    out << "\n";
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#ifndef STREAM_PRINTER_H
+#define STREAM_PRINTER_H
+
+#include <ostream>
+
+#include "printer.h"
+
+namespace lc3
+{
+    // Writes to a stream without colors or flushing, so that output is as fast as the stream allows. Meant for
+    // output that goes to a file or a pipe rather than a terminal.
+    class StreamPrinter : public utils::IPrinter
+    {
+    public:
+        StreamPrinter(std::ostream & out) : out(out) {}
+
+        virtual void setColor(utils::PrintColor color) override;
+        virtual void print(std::string const & string) override;
+        virtual void newline(void) override;
+
+    private:
+        std::ostream & out;
+    };
+};
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include "watchdog.h"
+
+lc3::Watchdog::Watchdog(lc3::sim & simulator, std::chrono::steady_clock::time_point deadline) : disarmed(false),
+    fired(false)
+{
+    if(deadline == std::chrono::steady_clock::time_point::max()) {
+        return;
+    }
+    thread = std::thread([this, &simulator, deadline]() {
+        std::unique_lock<std::mutex> guard(lock);
+        if(! wakeup.wait_until(guard, deadline, [this]() { return disarmed; })) {
+            fired = true;
+            simulator.cancel();
+        }
+    });
+}
+
+void lc3::Watchdog::disarm(void)
+{
+    if(! thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        disarmed = true;
+    }
+    wakeup.notify_one();
+    thread.join();
+}
+
+std::chrono::steady_clock::duration lc3::secondsToDuration(double seconds)
+{
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+}
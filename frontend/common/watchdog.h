@@ -0,0 +1,39 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "interface.h"
+
+namespace lc3
+{
+    // Cancels a machine from its own thread once a deadline passes, unless it is disarmed first. Without a deadline
+    // (time_point::max()), no thread is started.
+    class Watchdog
+    {
+    public:
+        Watchdog(sim & simulator, std::chrono::steady_clock::time_point deadline);
+        ~Watchdog(void) { disarm(); }
+
+        void disarm(void);
+        bool didFire(void) const { return fired; }
+
+    private:
+        std::mutex lock;
+        std::condition_variable wakeup;
+        bool disarmed;
+        std::atomic<bool> fired;
+        std::thread thread;
+    };
+
+    std::chrono::steady_clock::duration secondsToDuration(double seconds);
+};
+
+#endif
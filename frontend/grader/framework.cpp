@@ -1,12 +1,36 @@
 /*
  * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
  */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32))
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/time.h>
+    #include <sys/un.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
 
 #include "common.h"
 #include "console_printer.h"
 #include "console_inputter.h"
 #include "framework.h"
+#include "lockstep.h"
+#include "watchdog.h"
 
 struct CLIArgs
 {
@@ -17,16 +41,94 @@ struct CLIArgs
     uint32_t sim_print_level_override = false;
     bool ignore_privilege = false;
     bool liberal_asm = false;
+    bool native_traps = false;
+    bool native_trap_cost = false;
+    uint32_t jobs = 1;
+    // Machines per lockstep group of randomized test cases; 0 runs every test case on its own (see --lockstep).
+    uint32_t lockstep_lanes = 0;
+    bool isolate = false;
+    double timeout = 0;
+    double submission_timeout = 0;
+    uint64_t max_insts = 0;
+    uint64_t max_output = 0;
+    bool detect_loops = false;
+    uint64_t output_buffer = 0;
+    bool spill_output = false;
+    std::string asm_cache_dir;
+    std::string memo_dir;
+    // SHA-256 of the grader executable, which holds the framework and the test cases of a lab that is compiled in, so
+    // that results memoized by another build are not reused.
+    std::string program_hash;
+    bool seed_given = false;
+    uint64_t seed = 0;
+    std::string reference_dir;
+    double budget_factor = 4;
+    bool diff_reference = false;
+    // Set for the runs of the reference solution itself, which record what the submission is compared against.
+    bool record_reference = false;
+    std::string report_filename;
+};
+
+// Test cases are told apart by name and by whether they randomize the machine, as a lab may register both versions of
+// a test case under the same name.
+using TestKey = std::pair<std::string, bool>;
+
+// What a test case did on the reference solution of its lab.
+struct ReferenceTrace
+{
+    uint64_t inst_count = 0;
+    // Everything the reference printed.
+    std::string output;
+    // Contents of the DIFF_MEMORY regions once the test case finished, in the order they were registered.
+    std::vector<uint16_t> memory;
+};
+using ReferenceTraces = std::map<TestKey, ReferenceTrace>;
+
+struct Submission
+{
+    std::vector<std::shared_ptr<lc3::core::ObjImage const>> obj_images;
+    // SHA-256 of the contents of the object files; only computed for --memo-dir.
+    std::string hash;
+    // Seed from which every randomized machine is derived; reported so that a run can be reproduced with --seed.
+    uint64_t seed = 0;
+    // Instructions each test case may execute (see --reference-dir). Test cases that are not listed only have the
+    // limits they set themselves.
+    std::map<TestKey, uint64_t> inst_budgets;
+    // Traces to check each test case against as it runs (see --diff-reference).
+    std::shared_ptr<ReferenceTraces const> reference_traces;
+    // Test cases still running at this point are cancelled (see --submission-timeout).
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
 };
 
-void setup(void);
-void shutdown(void);
-void testBringup(lc3::sim & sim);
-void testTeardown(lc3::sim & sim);
+struct TestResult
+{
+    TestReport report;
+    uint32_t points_earned = 0;
+    bool load_failed = false;
+    // Only known when the test case actually ran (i.e. not for memoized results) with args.record_reference set.
+    ReferenceTrace trace;
+    // How the test case ended (e.g. completed, inst_limit, or loop), for --report.
+    std::string exit_reason;
+    uint64_t inst_count = 0;
+    // Seconds the test case itself took, not counting setting up the machine. Memoized results take no time.
+    double wall_time = 0;
+    double cpu_time = 0;
+    bool memoized = false;
+};
+
+// With --isolate, a child that has not finished this many seconds after its deadline is killed, as the test case
+// itself (rather than the machine) must be stuck.
+static constexpr double IsolateKillGrace = 1;
+
+// A reference solution gets this many instructions of headroom on top of the budget factor, so that test cases that
+// barely run are not held to a handful of instructions.
+static constexpr uint64_t MinBudgetSlack = 1000;
 
-std::vector<TestCase> tests;
-uint32_t verify_count;
-uint32_t verify_valid;
+// With --daemon, a client has this many seconds to send its whole request, and as long again to take the response, so
+// that a client that stalls does not hold up the ones behind it.
+static constexpr double DaemonClientTimeout = 10;
+
+thread_local TestReport * test_report = nullptr;
 
 bool endsWith(std::string const & search, std::string const & suffix)
 {
@@ -34,48 +136,1408 @@ bool endsWith(std::string const & search, std::string const & suffix)
     return std::equal(suffix.rbegin(), suffix.rend(), search.rbegin());
 }
 
+OutputMatcher::OutputMatcher(std::string const & pattern, bool forbidden) :
+    pattern(pattern), failure(pattern.size(), 0), forbidden(forbidden)
+{
+    // failure[i] is the length of the longest proper prefix of pattern[0..i] that is also a suffix of it
+    uint32_t length = 0;
+    for(uint32_t i = 1; i < pattern.size(); i += 1) {
+        while(length > 0 && pattern[i] != pattern[length]) {
+            length = failure[length - 1];
+        }
+        if(pattern[i] == pattern[length]) {
+            length += 1;
+        }
+        failure[i] = length;
+    }
+    reset();
+}
+
+bool OutputMatcher::feed(char c)
+{
+    if(matched) { return false; }
+
+    while(state > 0 && c != pattern[state]) {
+        state = failure[state - 1];
+    }
+    if(c == pattern[state]) {
+        state += 1;
+    }
+    matched = state == pattern.size();
+    return matched;
+}
+
+BufferedPrinter::~BufferedPrinter(void)
+{
+    if(spill_file != nullptr) {
+        std::fclose(spill_file);
+    }
+}
+
 void BufferedPrinter::print(std::string const & string)
 {
-    std::copy(string.begin(), string.end(), std::back_inserter(display_buffer));
+    if(capacity == 0) {
+        std::copy(string.begin(), string.end(), std::back_inserter(display_buffer));
+        output_size += string.size();
+    } else {
+        for(char c : string) {
+            record(c);
+        }
+    }
+    if(! matchers.empty()) {
+        for(char c : string) {
+            match(c);
+        }
+    }
+    if(keep_transcript || reference != nullptr) {
+        for(char c : string) {
+            trace(c);
+        }
+    }
     if(print_output) {
-        std::cout << string;
+        output << string;
     }
 }
 
 void BufferedPrinter::newline(void)
 {
-    display_buffer.push_back('\n');
+    record('\n');
+    if(! matchers.empty()) {
+        match('\n');
+    }
+    if(keep_transcript || reference != nullptr) {
+        trace('\n');
+    }
     if(print_output) {
-        std::cout << "\n";
+        output << "\n";
+    }
+}
+
+void BufferedPrinter::record(char c)
+{
+    output_size += 1;
+    if(capacity == 0 || display_buffer.size() < capacity) {
+        display_buffer.push_back(c);
+    } else if(spill) {
+        if(spill_file == nullptr) {
+            spill_file = std::tmpfile();
+        }
+        if(spill_file != nullptr) {
+            std::fputc(c, spill_file);
+        }
+    }
+}
+
+void BufferedPrinter::setCapacity(uint64_t capacity, bool spill)
+{
+    this->capacity = capacity;
+    this->spill = spill;
+}
+
+bool BufferedPrinter::scanOutput(std::function<bool(char)> const & visit) const
+{
+    for(char c : display_buffer) {
+        if(! visit(c)) { return false; }
+    }
+    if(spill_file == nullptr) {
+        return true;
+    }
+
+    bool complete = true;
+    char chunk[4096];
+    std::rewind(spill_file);
+    while(complete) {
+        std::size_t count = std::fread(chunk, 1, sizeof(chunk), spill_file);
+        if(count == 0) { break; }
+        for(std::size_t i = 0; i < count && complete; i += 1) {
+            complete = visit(chunk[i]);
+        }
+    }
+    // more output may follow
+    std::fseek(spill_file, 0, SEEK_END);
+    return complete;
+}
+
+void BufferedPrinter::clear(void)
+{
+    display_buffer.clear();
+    output_size = 0;
+    if(spill_file != nullptr) {
+        std::fclose(spill_file);
+        spill_file = nullptr;
+    }
+    unmatched_expected_count = 0;
+    for(OutputMatcher & matcher : matchers) {
+        matcher.reset();
+        if(! matcher.isForbidden() && ! matcher.isMatched()) {
+            unmatched_expected_count += 1;
+        }
+    }
+}
+
+// A machine that is paused on its output must print as it runs, which a machine in lockstep does not.
+void BufferedPrinter::leaveLockstep(void)
+{
+    if(simulator != nullptr) {
+        simulator->setLockstepGroup(nullptr);
+    }
+}
+
+void BufferedPrinter::expectOutput(std::string const & check)
+{
+    leaveLockstep();
+    matchers.emplace_back(check, false);
+    if(! matchers.back().isMatched()) {
+        unmatched_expected_count += 1;
+    }
+}
+
+void BufferedPrinter::forbidOutput(std::string const & check)
+{
+    leaveLockstep();
+    matchers.emplace_back(check, true);
+}
+
+bool BufferedPrinter::hadOutput(std::string const & check) const
+{
+    for(OutputMatcher const & matcher : matchers) {
+        if(matcher.getPattern() == check) {
+            return matcher.isMatched();
+        }
+    }
+
+    OutputMatcher matcher(check);
+    scanOutput([&matcher](char c) { return ! matcher.feed(c); });
+    return matcher.isMatched();
+}
+
+void BufferedPrinter::match(char c)
+{
+    // Only pause on the character that completes a match, so that a later run is not paused again straight away.
+    bool pause = false;
+    for(OutputMatcher & matcher : matchers) {
+        if(matcher.feed(c)) {
+            if(matcher.isForbidden()) {
+                pause = true;
+            } else {
+                unmatched_expected_count -= 1;
+                pause = pause || unmatched_expected_count == 0;
+            }
+        }
+    }
+    if(pause && simulator != nullptr) {
+        simulator->pause();
+    }
+}
+
+void BufferedPrinter::trace(char c)
+{
+    if(keep_transcript) {
+        transcript.push_back(c);
+    }
+    if(reference == nullptr || diverged) {
+        return;
+    }
+
+    if(reference_pos < reference->size() && (*reference)[reference_pos] == c) {
+        reference_pos += 1;
+        return;
+    }
+
+    diverged = true;
+    divergent_char = c;
+    if(simulator != nullptr) {
+        // The rest of the test case can only confirm that the output is wrong, so the machine is paused and
+        // cancelled, which keeps later runs from starting. Its instruction ceiling is left alone, so the test case
+        // does not look like it ran out of instructions.
+        divergent_inst_count = simulator->getMachineState().inst_time;
+        simulator->pause();
+        simulator->cancel();
     }
 }
 
 void StringInputter::setStringAfter(std::string const & source, uint32_t inst_count)
 {
-    this->inst_delay = inst_count;
-    this->source = source;
-    this->pos = 0;
+    simulator.clearInput();
+    addStringAfter(source, inst_count);
+}
+
+void StringInputter::addStringAfter(std::string const & source, uint32_t inst_count)
+{
+    // The input has always become ready one instruction after inst_count, and graders are tuned to that.
+    if(! source.empty()) {
+        simulator.scheduleInput(static_cast<uint64_t>(inst_count) + 1, source);
+    }
+}
+
+uint64_t getInstBudget(TestCase const & test, Submission const & submission)
+{
+    auto budget = submission.inst_budgets.find(TestKey(test.name, test.randomize));
+    return budget == submission.inst_budgets.end() ? 0 : budget->second;
+}
+
+ReferenceTrace const * getReferenceTrace(TestCase const & test, Submission const & submission)
+{
+    if(submission.reference_traces == nullptr) {
+        return nullptr;
+    }
+    auto trace = submission.reference_traces->find(TestKey(test.name, test.randomize));
+    return trace == submission.reference_traces->end() ? nullptr : &trace->second;
+}
+
+// CPU time of the calling thread in seconds, so that test cases running in parallel (see --jobs) are timed apart.
+double getThreadCPUTime(void)
+{
+#if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32))
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+#else
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Writes everything about a result other than its report: a line with the points, whether the submission failed to
+// load, the instruction count, the exit reason, the times, and the number of verifications, then each verification as
+// a line with its result and the size of its message, followed by the message.
+void writeResultHeader(std::ostream & out, TestResult const & result)
+{
+    out << result.points_earned << " " << result.load_failed << " " << result.inst_count << " "
+        << (result.exit_reason.empty() ? "none" : result.exit_reason) << " " << result.wall_time << " "
+        << result.cpu_time << " " << result.report.verifications.size() << "\n";
+    for(std::pair<std::string, bool> const & verification : result.report.verifications) {
+        out << verification.second << " " << verification.first.size() << "\n" << verification.first;
+    }
 }
 
-bool StringInputter::getChar(char & c)
+bool readResultHeader(std::istream & in, TestResult & result)
 {
-    if(inst_delay > 0) {
-        inst_delay -= 1;
+    std::size_t verification_count;
+    if(! (in >> result.points_earned >> result.load_failed >> result.inst_count >> result.exit_reason
+        >> result.wall_time >> result.cpu_time >> verification_count) || in.get() != '\n')
+    {
         return false;
     }
+    result.report.verifications.clear();
+    for(std::size_t i = 0; i < verification_count; i += 1) {
+        bool passed;
+        std::size_t size;
+        if(! (in >> passed >> size) || in.get() != '\n') {
+            return false;
+        }
+        std::string message(size, '\0');
+        if(! in.read(&message[0], size)) {
+            return false;
+        }
+        result.report.verifications.emplace_back(message, passed);
+    }
+    return true;
+}
 
-    if(pos == source.size()) {
+// Output with newlines escaped, for the report.
+std::string escapeOutput(std::string const & text)
+{
+    std::string escaped;
+    for(char c : text) {
+        if(c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// File that holds the memoized result of a test case on a submission, or an empty string if the result should not
+// be memoized; key is set to what the file must have been written for. A test case always does the same thing to the
+// same submission and the same random machine, so its result depends only on the build of the grader and the lab, the
+// test case, the object files, the seed, and the options that change how it runs. Randomized test cases are only
+// memoized when the seed is fixed with --seed.
+std::string getMemoFilename(Lab const & lab, TestCase const & test, Submission const & submission,
+    CLIArgs const & args, std::string & memo_key)
+{
+    if(args.memo_dir.empty() || (test.randomize && ! args.seed_given)) {
+        return "";
+    }
+
+    std::ostringstream key;
+    key << args.program_hash << " " << lab.version << "\n" << lab.name << "\n" << test.name << "\n" << test.points
+        << "\n" << submission.hash << "\n"
+        << args.print_output << " " << args.sim_print_level_override << " " << args.sim_print_level << " "
+        << args.ignore_privilege << " " << args.native_traps << " " << args.native_trap_cost << " "
+        << args.max_insts << " " << args.max_output << " " << args.output_buffer << " " << args.spill_output << " "
+        << getInstBudget(test, submission) << " " << args.detect_loops;
+    ReferenceTrace const * trace = getReferenceTrace(test, submission);
+    if(trace != nullptr) {
+        std::ostringstream memory;
+        for(uint16_t value : trace->memory) {
+            memory << value << " ";
+        }
+        key << " " << lc3::utils::sha256Hash(trace->output) << " " << lc3::utils::sha256Hash(memory.str());
+    }
+    if(test.randomize) {
+        key << " " << submission.seed;
+    }
+    memo_key = key.str();
+    return args.memo_dir + "/" + lc3::utils::sha256Hash(memo_key) + ".memo";
+}
+
+// Memo files start with the key they were written for, which must match in full.
+void writeMemoHeader(std::ostream & out, std::string const & header, std::string const & memo_key)
+{
+    out << header << "\n" << memo_key.size() << "\n" << memo_key << "\n";
+}
+
+bool readMemoHeader(std::istream & in, std::string const & header, std::string const & memo_key)
+{
+    std::string file_header;
+    std::size_t key_size = 0;
+    if(! std::getline(in, file_header) || file_header != header || ! (in >> key_size) || in.get() != '\n'
+        || key_size != memo_key.size())
+    {
         return false;
     }
+    std::string file_key(key_size, '\0');
+    return (key_size == 0 || in.read(&file_key[0], key_size)) && file_key == memo_key && in.get() == '\n';
+}
 
-    c = source[pos];
-    pos += 1;
+bool loadMemoizedResult(std::string const & memo_filename, std::string const & memo_key, TestResult & result)
+{
+    std::ifstream memo_file(memo_filename, std::ios_base::binary);
+    if(! memo_file || ! readMemoHeader(memo_file, "lc3 grade memo 3", memo_key)) {
+        return false;
+    }
+    if(! readResultHeader(memo_file, result)) {
+        return false;
+    }
+    result.report.output << memo_file.rdbuf();
+    result.wall_time = 0;
+    result.cpu_time = 0;
+    result.memoized = true;
     return true;
 }
 
-int main(int argc, char * argv[])
+// Runs a test case. If before_test is given, it is called once the machine is set up and the submission is loaded,
+// right before the test case itself runs; if it returns false, the test case is left to another process. If lockstep
+// is given, the test case is one of its members, and its machine runs with the others whenever it can.
+void runTest(Lab const & lab, TestCase const & test, Submission const & submission, CLIArgs const & args,
+    TestResult & result, std::function<bool(void)> const & before_test = nullptr,
+    lc3::lockstep_group * lockstep = nullptr)
+{
+    std::string memo_key;
+    std::string memo_filename = getMemoFilename(lab, test, submission, args, memo_key);
+    if(! memo_filename.empty() && loadMemoizedResult(memo_filename, memo_key, result)) {
+        if(lockstep != nullptr) {
+            lockstep->leave();
+        }
+        return;
+    }
+
+    test_report = &result.report;
+    std::ostream & output = result.report.output;
+
+    BufferedPrinter sim_printer(args.print_output, output);
+    lc3::utils::NullInputter null_inputter;
+    lc3::sim simulator(sim_printer, null_inputter, false,
+        args.sim_print_level_override ? args.sim_print_level : 1, true);
+    sim_printer.setSimulator(&simulator);
+    StringInputter sim_inputter(simulator);
+    ReferenceTrace const * trace = getReferenceTrace(test, submission);
+    if(lockstep != nullptr) {
+        // A machine in lockstep only prints once its run is over, too late to stop at the first difference from the
+        // reference. The machine leaves the group when it is destroyed, however the test case ends.
+        if(trace != nullptr && ! args.record_reference) {
+            lockstep->leave();
+        } else {
+            simulator.setLockstepGroup(lockstep);
+        }
+    }
+
+    lab.test_bringup(simulator);
+
+    output << "Test: " << test.name;
+    if(test.randomize) {
+        // Each randomized test case gets its own machine, but all of them follow from the seed of the run.
+        simulator.randomize(lc3::utils::fnv1aHash(std::to_string(submission.seed) + "\n" + test.name));
+        output << " (Randomized Machine, seed " << submission.seed << ")";
+    }
+    output << "\n";
+    for(std::shared_ptr<lc3::core::ObjImage const> const & obj_image : submission.obj_images) {
+        if(obj_image) {
+            simulator.loadObjImage(*obj_image);
+        } else {
+            output << "could not init simulator\n";
+            result.load_failed = true;
+            result.exit_reason = "load_failed";
+            test_report = nullptr;
+            return;
+        }
+    }
+
+    if(args.ignore_privilege) {
+        simulator.setIgnorePrivilege(true);
+    }
+
+    if(args.native_traps) {
+        simulator.setNativeTraps(true);
+        simulator.setNativeTrapCost(args.native_trap_cost);
+    }
+
+    // The budget from the reference solution only ever tightens --max-insts.
+    uint64_t inst_budget = getInstBudget(test, submission);
+    bool use_budget = inst_budget != 0 && (args.max_insts == 0 || inst_budget < args.max_insts);
+    if(use_budget) {
+        simulator.setMaxInstCount(inst_budget);
+    } else if(args.max_insts != 0) {
+        simulator.setMaxInstCount(args.max_insts);
+    }
+
+    if(args.max_output != 0) {
+        simulator.setMaxOutputCount(args.max_output);
+    }
+    if(args.detect_loops) {
+        simulator.setLoopDetection(true);
+    }
+    sim_printer.setCapacity(args.output_buffer, args.spill_output);
+    if(args.record_reference) {
+        sim_printer.keepTranscript(true);
+    } else if(trace != nullptr) {
+        sim_printer.setReferenceTranscript(&trace->output);
+    }
+
+    if(before_test && ! before_test()) {
+        test_report = nullptr;
+        return;
+    }
+
+    // Timing starts only now, as with --isolate the test case runs in a new process with its own CPU clock.
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+    double start_cpu_time = getThreadCPUTime();
+    // The machine is cancelled at the earlier of the test case's and the submission's deadlines, wherever it is.
+    std::chrono::steady_clock::time_point deadline = submission.deadline;
+    if(args.timeout > 0) {
+        deadline = std::min(deadline, start_time + lc3::secondsToDuration(args.timeout));
+    }
+    bool submission_deadline = deadline == submission.deadline;
+    lc3::Watchdog watchdog(simulator, deadline);
+
+    auto stop_timing = [&]() {
+        watchdog.disarm();
+        result.inst_count = simulator.getInstExecCount();
+        result.wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        result.cpu_time = getThreadCPUTime() - start_cpu_time;
+    };
+
+    try {
+        test.test_func(simulator, sim_inputter);
+    } catch(lc3::utils::exception const & e) {
+        output << "Test case ran into exception: " << e.what() << "\n";
+        result.exit_reason = "exception";
+        stop_timing();
+        test_report = nullptr;
+        return;
+    }
+
+    lab.test_teardown(simulator);
+    stop_timing();
+
+    std::vector<uint16_t> memory;
+    for(std::pair<uint16_t, uint16_t> const & region : result.report.diff_memory) {
+        for(uint32_t addr = region.first; addr <= region.second; addr += 1) {
+            memory.push_back(simulator.getMem(static_cast<uint16_t>(addr)));
+        }
+    }
+
+    if(args.record_reference) {
+        result.trace.inst_count = simulator.getInstExecCount();
+        result.trace.output = sim_printer.getTranscript();
+        result.trace.memory = std::move(memory);
+    } else if(trace != nullptr) {
+        // Show the reference output leading up to the first difference, which the submission printed as well.
+        uint64_t pos = sim_printer.getReferencePos();
+        uint64_t context_start = pos > 40 ? pos - 40 : 0;
+        std::string context = escapeOutput(trace->output.substr(context_start, pos - context_start));
+        if(sim_printer.didDiverge()) {
+            output << "Output differs from the reference solution at character " << (pos + 1) << " (after "
+                   << sim_printer.getDivergentInstCount() << " instructions): after '" << context << "', expected ";
+            if(pos < trace->output.size()) {
+                output << "'" << escapeOutput(std::string(1, trace->output[pos])) << "'";
+            } else {
+                output << "no more output";
+            }
+            output << " but got '" << escapeOutput(std::string(1, sim_printer.getDivergentChar())) << "'\n";
+        } else if(pos < trace->output.size()) {
+            output << "Output stopped after '" << context << "', " << pos << " of the "
+                   << trace->output.size() << " characters the reference solution printed\n";
+        }
+
+        if(memory.size() == trace->memory.size()) {
+            auto mismatch = std::mismatch(memory.begin(), memory.end(), trace->memory.begin());
+            uint64_t i = mismatch.first - memory.begin();
+            for(std::pair<uint16_t, uint16_t> const & region : result.report.diff_memory) {
+                uint64_t size = region.second >= region.first ? region.second - region.first + 1 : 0;
+                if(i < size) {
+                    output << lc3::utils::ssprintf("Memory differs from the reference solution at 0x%0.4X: expected "
+                        "0x%0.4X but got 0x%0.4X\n", region.first + static_cast<uint32_t>(i), *mismatch.second,
+                        *mismatch.first);
+                    break;
+                }
+                i -= size;
+            }
+        }
+    }
+
+    if(watchdog.didFire()) {
+        result.exit_reason = "timeout";
+    } else if(sim_printer.didDiverge()) {
+        result.exit_reason = "diverged";
+    } else if(simulator.didDetectLoop()) {
+        result.exit_reason = "loop";
+    } else if(simulator.didExceedMaxOutputCount()) {
+        result.exit_reason = "output_limit";
+    } else if(simulator.didExceedMaxInstCount()) {
+        result.exit_reason = use_budget ? "budget" : "inst_limit";
+    } else {
+        result.exit_reason = "completed";
+    }
+
+    if(simulator.didDetectLoop()) {
+        output << "Test case stopped in an infinite loop at PC "
+               << lc3::utils::ssprintf("0x%0.4X", simulator.getPC()) << "\n";
+    } else if(use_budget && simulator.didExceedMaxInstCount()) {
+        output << "Test case ran out of its budget of " << inst_budget << " instructions\n";
+    }
+
+    float percent_points_earned = ((float) result.report.verify_valid) / result.report.verify_count;
+    // As with --isolate, a test case that runs out of time gets no points, so that the grade does not depend on how
+    // far the machine got.
+    if(watchdog.didFire()) {
+        if(submission_deadline) {
+            output << "Test case stopped when the submission ran out of its " << args.submission_timeout
+                   << " seconds\n";
+        } else {
+            output << "Test case timed out after " << args.timeout << " seconds\n";
+        }
+        percent_points_earned = 0;
+    }
+    result.points_earned = (uint32_t) ( percent_points_earned * test.points);
+    output << "Test points earned: " << result.points_earned << "/" << test.points << " ("
+           << (percent_points_earned * 100) << "%)\n";
+    output << "==========\n";
+
+    // How far a test case gets before it runs out of time depends on the load of the machine.
+    if(! memo_filename.empty() && ! watchdog.didFire()) {
+        std::ostringstream memo;
+        writeMemoHeader(memo, "lc3 grade memo 3", memo_key);
+        writeResultHeader(memo, result);
+        memo << result.report.output.str();
+        lc3::utils::writeFileAtomic(memo_filename, memo.str());
+    }
+
+    test_report = nullptr;
+}
+
+#if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32))
+// Runs each test case in its own child process, up to args.jobs at a time. The parent sets up the machine and loads
+// the submission before forking, so each child starts from that state and only runs the test case itself. A child
+// that crashes, or that is still running IsolateKillGrace seconds after its deadline, only loses its own test case.
+void runTestsIsolated(Lab const & lab, Submission const & submission, CLIArgs const & args,
+    std::vector<TestResult> & results)
+{
+    struct Child
+    {
+        uint32_t test_id;
+        pid_t pid;
+        int fd;
+        std::string data;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    std::vector<TestCase> const & tests = *lab.tests;
+    std::vector<Child> children;
+    uint32_t next_test = 0;
+    uint32_t max_children = std::max(std::min(args.jobs, static_cast<uint32_t>(tests.size())), 1u);
+
+    auto finish_child = [&](Child & child, bool timed_out) {
+        int status = 0;
+        if(timed_out) {
+            kill(child.pid, SIGKILL);
+        }
+        waitpid(child.pid, &status, 0);
+        close(child.fd);
+
+        TestResult & result = results[child.test_id];
+        std::istringstream data(child.data);
+        if(! timed_out && WIFEXITED(status) && WEXITSTATUS(status) == 0 && readResultHeader(data, result)) {
+            result.report.output.str(std::string(std::istreambuf_iterator<char>(data), {}));
+            return;
+        }
+
+        result.wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - child.start).count();
+        if(timed_out) {
+            result.exit_reason = "timeout";
+            result.report.output << "Test case timed out and did not stop on its own\n";
+        } else {
+            result.exit_reason = "crashed";
+            result.report.output << "Test case crashed";
+            if(WIFSIGNALED(status)) {
+                result.report.output << " (signal " << WTERMSIG(status) << ")";
+            }
+            result.report.output << "\n";
+        }
+        result.points_earned = 0;
+        result.report.output << "Test points earned: 0/" << tests[child.test_id].points << " (0%)\n";
+        result.report.output << "==========\n";
+    };
+
+    while(next_test < tests.size() || ! children.empty()) {
+        while(next_test < tests.size() && children.size() < max_children) {
+            uint32_t test_id = next_test;
+            next_test += 1;
+
+            Child child;
+            child.test_id = test_id;
+            child.pid = -1;
+            child.fd = -1;
+            runTest(lab, tests[test_id], submission, args, results[test_id], [&child, &children]() {
+                int fds[2];
+                if(pipe(fds) < 0) {
+                    return true;
+                }
+                std::cout << std::flush;
+                child.pid = fork();
+                if(child.pid < 0) {
+                    close(fds[0]);
+                    close(fds[1]);
+                    return true;
+                }
+                if(child.pid == 0) {
+                    // The read ends of the siblings' pipes belong to the parent; the child would otherwise hold
+                    // them open for as long as it runs.
+                    for(Child const & sibling : children) {
+                        close(sibling.fd);
+                    }
+                    close(fds[0]);
+                    child.fd = fds[1];
+                    return true;
+                }
+                close(fds[1]);
+                child.fd = fds[0];
+                return false;
+            });
+
+            if(child.pid == 0) {
+                TestResult & result = results[test_id];
+                std::ostringstream data;
+                writeResultHeader(data, result);
+                data << result.report.output.str();
+                std::string const & bytes = data.str();
+                std::size_t pos = 0;
+                while(pos < bytes.size()) {
+                    ssize_t count = write(child.fd, bytes.data() + pos, bytes.size() - pos);
+                    if(count < 0 && errno == EINTR) { continue; }
+                    if(count <= 0) { break; }
+                    pos += count;
+                }
+                _exit(0);
+            }
+
+            // Test cases that failed to load, or that could not be forked, already ran in this process.
+            if(child.pid > 0) {
+                // The child cancels the test case itself at its deadline; killing it is the last resort.
+                child.start = std::chrono::steady_clock::now();
+                child.deadline = submission.deadline;
+                if(args.timeout > 0) {
+                    child.deadline = std::min(child.deadline, child.start + lc3::secondsToDuration(args.timeout));
+                }
+                if(child.deadline != std::chrono::steady_clock::time_point::max()) {
+                    child.deadline += lc3::secondsToDuration(IsolateKillGrace);
+                }
+                children.push_back(std::move(child));
+            }
+        }
+
+        if(children.empty()) {
+            continue;
+        }
+
+        int poll_timeout = -1;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::vector<pollfd> poll_fds;
+        for(Child const & child : children) {
+            poll_fds.push_back(pollfd{child.fd, POLLIN, 0});
+            if(child.deadline != std::chrono::steady_clock::time_point::max()) {
+                int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(child.deadline - now).count();
+                left = std::max<int64_t>(left, 0);
+                if(poll_timeout < 0 || left < poll_timeout) {
+                    poll_timeout = static_cast<int>(left);
+                }
+            }
+        }
+        if(poll(poll_fds.data(), poll_fds.size(), poll_timeout) < 0 && errno != EINTR) {
+            break;
+        }
+
+        now = std::chrono::steady_clock::now();
+        std::vector<Child> running;
+        for(uint32_t i = 0; i < children.size(); i += 1) {
+            Child & child = children[i];
+            bool done = false;
+            if(poll_fds[i].revents != 0) {
+                char chunk[4096];
+                ssize_t count = read(child.fd, chunk, sizeof(chunk));
+                if(count > 0) {
+                    child.data.append(chunk, count);
+                } else if(count == 0 || errno != EINTR) {
+                    finish_child(child, false);
+                    done = true;
+                }
+            }
+            if(! done && now >= child.deadline) {
+                finish_child(child, true);
+                done = true;
+            }
+            if(! done) {
+                running.push_back(std::move(child));
+            }
+        }
+        children = std::move(running);
+    }
+}
+#else
+void runTestsIsolated(Lab const & lab, Submission const & submission, CLIArgs const & args,
+    std::vector<TestResult> & results)
+{
+    for(uint32_t i = 0; i < lab.tests->size(); i += 1) {
+        runTest(lab, (*lab.tests)[i], submission, args, results[i]);
+    }
+}
+#endif
+
+// Assembles (or converts) each submitted file. Returns false if any of them failed.
+bool assembleSubmission(std::vector<std::string> const & filenames, CLIArgs const & args,
+    lc3::utils::IPrinter & asm_printer, std::vector<std::string> & obj_filenames)
+{
+    lc3::as assembler(asm_printer, args.asm_print_level_override ? args.asm_print_level : 0, false, args.liberal_asm);
+    assembler.setCacheDir(args.asm_cache_dir);
+    lc3::conv converter(asm_printer, args.asm_print_level_override ? args.asm_print_level : 0, false);
+
+    bool valid_program = true;
+    for(std::string const & filename : filenames) {
+        lc3::optional<std::string> result;
+        if(! endsWith(filename, ".obj")) {
+            if(endsWith(filename, ".bin")) {
+                result = converter.convertBin(filename);
+            } else {
+                result = assembler.assemble(filename);
+            }
+        } else {
+            result = filename;
+        }
+
+        if(result) {
+            obj_filenames.push_back(*result);
+        } else {
+            valid_program = false;
+        }
+    }
+    return valid_program;
+}
+
+// The reference solution of a lab and what its test cases did on it.
+struct LabReference
+{
+    bool loaded = false;
+    std::string filename;
+    std::shared_ptr<lc3::core::ObjImage const> obj_image;
+    // Contents of the object file, which the saved traces are keyed by.
+    std::string obj_contents;
+    ReferenceTraces fixed_traces;
+    // Traces of the randomized test cases on the machines from --seed, which every submission uses.
+    bool random_traces_valid = false;
+    ReferenceTraces random_traces;
+};
+
+// Runs the test cases of a lab that randomize the machine, or those that do not, on its reference solution, with
+// machines randomized from seed just as a submission's are, and adds their traces to traces. With --memo-dir, the
+// traces are saved next to the memoized results and read back instead of running the reference again. Randomized
+// traces are only saved for a seed from --seed, as no other seed is used twice. Test cases that the reference does
+// not pass are left out.
+void recordReferenceTraces(Lab const & lab, CLIArgs const & args, LabReference const & lab_reference, bool randomized,
+    uint64_t seed, ReferenceTraces & traces)
+{
+    Submission reference;
+    reference.obj_images.push_back(lab_reference.obj_image);
+    reference.seed = seed;
+
+    // Each trace is a line with whether the test case is randomized, the instruction count, the size of the output,
+    // the number of memory words, and the name of the test case, then the output and a line of memory words.
+    std::string memo_filename;
+    std::string memo_key;
+    if(! args.memo_dir.empty() && (! randomized || args.seed_given)) {
+        std::ostringstream key;
+        key << "reference\n" << args.program_hash << " " << lab.version << "\n" << lab.name << "\n"
+            << lab_reference.obj_contents << "\n" << args.ignore_privilege << " " << args.native_traps << " "
+            << args.native_trap_cost << " " << randomized;
+        if(randomized) {
+            key << " " << seed;
+        }
+        memo_key = key.str();
+        memo_filename = args.memo_dir + "/" + lc3::utils::sha256Hash(memo_key) + ".reference";
+
+        std::ifstream memo_file(memo_filename, std::ios_base::binary);
+        if(memo_file && readMemoHeader(memo_file, "lc3 grade reference 3", memo_key)) {
+            bool randomize;
+            ReferenceTrace trace;
+            std::size_t output_size, memory_size;
+            std::string test_name;
+            while(memo_file >> randomize >> trace.inst_count >> output_size >> memory_size >> test_name
+                && memo_file.get() == '\n')
+            {
+                trace.output.resize(output_size);
+                memo_file.read(&trace.output[0], output_size);
+                trace.memory.resize(memory_size);
+                for(uint16_t & value : trace.memory) {
+                    memo_file >> value;
+                }
+                traces[TestKey(test_name, randomize)] = trace;
+            }
+            return;
+        }
+    }
+
+    // Test cases of the reference are run plainly: nothing memoized, nothing printed, and nothing to compare against.
+    CLIArgs reference_args = args;
+    reference_args.print_output = false;
+    reference_args.memo_dir = "";
+    reference_args.record_reference = true;
+    std::ostringstream memo;
+    writeMemoHeader(memo, "lc3 grade reference 3", memo_key);
+    for(TestCase const & test : *lab.tests) {
+        if(test.randomize != randomized) {
+            continue;
+        }
+        TestResult result;
+        runTest(lab, test, reference, reference_args, result);
+        if(result.load_failed || result.points_earned != test.points) {
+            std::cerr << "reference solution " << lab_reference.filename << " does not pass " << test.name;
+            if(randomized) {
+                std::cerr << " (seed " << seed << ")";
+            }
+            std::cerr << "; it is not compared against\n";
+            continue;
+        }
+        ReferenceTrace const & trace = result.trace;
+        memo << test.randomize << " " << trace.inst_count << " " << trace.output.size() << " " << trace.memory.size()
+             << " " << test.name << "\n" << trace.output;
+        for(uint16_t value : trace.memory) {
+            memo << " " << value;
+        }
+        memo << "\n";
+        traces[TestKey(test.name, test.randomize)] = trace;
+    }
+    if(! memo_filename.empty()) {
+        lc3::utils::writeFileAtomic(memo_filename, memo.str());
+    }
+}
+
+// Finds the reference solution of a lab in args.reference_dir, which holds one file per lab named after it (e.g.
+// binsearch.asm), and returns what every test case does on it for a submission graded with seed. The reference is
+// assembled, and the test cases that do not randomize the machine are run on it, once for the life of the process.
+// Randomized test cases run on the same machines as the submission's, so they are run again for each seed unless
+// --seed fixes it.
+std::shared_ptr<ReferenceTraces const> getReferenceTraces(Lab const & lab, CLIArgs const & args, uint64_t seed)
+{
+    static std::mutex lock;
+    static std::map<std::string, LabReference> lab_references;
+
+    std::lock_guard<std::mutex> guard(lock);
+    LabReference & lab_reference = lab_references[lab.name];
+    if(! lab_reference.loaded) {
+        lab_reference.loaded = true;
+        for(char const * extension : {".obj", ".asm", ".bin"}) {
+            std::string filename = args.reference_dir + "/" + lab.name + extension;
+            if(std::ifstream(filename)) {
+                lab_reference.filename = filename;
+                break;
+            }
+        }
+        if(lab_reference.filename.empty()) {
+            std::cerr << "no reference solution for " << lab.name << " in " << args.reference_dir << "\n";
+        } else {
+            std::ostringstream asm_output;
+            BufferedPrinter asm_printer(false, asm_output);
+            std::vector<std::string> obj_filenames;
+            if(assembleSubmission({lab_reference.filename}, args, asm_printer, obj_filenames)) {
+                lab_reference.obj_image = lc3::core::ObjImage::fromFile(obj_filenames[0]);
+                std::ifstream obj_file(obj_filenames[0], std::ios_base::binary);
+                std::ostringstream obj_contents;
+                obj_contents << obj_file.rdbuf();
+                lab_reference.obj_contents = obj_contents.str();
+            }
+            if(! lab_reference.obj_image) {
+                std::cerr << "could not assemble reference solution " << lab_reference.filename << "\n";
+            } else {
+                recordReferenceTraces(lab, args, lab_reference, false, 0, lab_reference.fixed_traces);
+            }
+        }
+    }
+
+    std::shared_ptr<ReferenceTraces> traces = std::make_shared<ReferenceTraces>(lab_reference.fixed_traces);
+    if(! lab_reference.obj_image) {
+        return traces;
+    }
+    if(args.seed_given) {
+        if(! lab_reference.random_traces_valid) {
+            recordReferenceTraces(lab, args, lab_reference, true, seed, lab_reference.random_traces);
+            lab_reference.random_traces_valid = true;
+        }
+        traces->insert(lab_reference.random_traces.begin(), lab_reference.random_traces.end());
+    } else {
+        recordReferenceTraces(lab, args, lab_reference, true, seed, *traces);
+    }
+    return traces;
+}
+
+// Writes the line of the --report file for a test case.
+void writeTestRecord(std::ostream & out, Lab const & lab, TestCase const & test, Submission const & submission,
+    TestResult const & result)
+{
+    out << "{\"type\": \"test\", \"lab\": " << jsonString(lab.name) << ", \"test\": " << jsonString(test.name)
+        << ", \"randomized\": " << (test.randomize ? "true" : "false");
+    if(test.randomize) {
+        out << ", \"seed\": " << submission.seed;
+    }
+    out << ", \"points_earned\": " << result.points_earned << ", \"points\": " << test.points
+        << ", \"verifications\": [";
+    for(std::size_t i = 0; i < result.report.verifications.size(); i += 1) {
+        std::pair<std::string, bool> const & verification = result.report.verifications[i];
+        out << (i == 0 ? "" : ", ") << "{\"message\": " << jsonString(verification.first) << ", \"passed\": "
+            << (verification.second ? "true" : "false") << "}";
+    }
+    out << "], \"exit_reason\": " << jsonString(result.exit_reason) << ", \"instructions\": " << result.inst_count
+        << ", \"wall_time\": " << result.wall_time << ", \"cpu_time\": " << result.cpu_time << ", \"memoized\": "
+        << (result.memoized ? "true" : "false") << "}\n";
+}
+
+// Runs the test cases of a lab on an assembled submission, writing the report to out and, if json_report is given, a
+// line for each test case and a summary line to it. Returns the exit code of the grader: 0 if the program was graded,
+// 1 if there was nothing to grade, and 2 if it could not be loaded.
+int gradeSubmission(Lab const & lab, std::vector<std::string> const & obj_filenames, bool valid_program,
+    CLIArgs const & args, std::ostream & out, std::ostream * json_report, uint32_t & total_points_earned,
+    uint32_t & total_possible_points)
+{
+    if(obj_filenames.size() == 0) {
+        return 1;
+    }
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+    // Each object file is parsed once and then copied into the machine of every test case.
+    Submission submission;
+    std::string obj_contents;
+    for(std::string const & obj_filename : obj_filenames) {
+        submission.obj_images.push_back(lc3::core::ObjImage::fromFile(obj_filename));
+        if(! args.memo_dir.empty()) {
+            std::ifstream obj_file(obj_filename, std::ios_base::binary);
+            std::stringstream obj_buffer;
+            obj_buffer << obj_file.rdbuf();
+            obj_contents += std::to_string(obj_buffer.str().size()) + "\n" + obj_buffer.str();
+        }
+    }
+    if(! args.memo_dir.empty()) {
+        submission.hash = lc3::utils::sha256Hash(obj_contents);
+    }
+    if(args.submission_timeout > 0) {
+        submission.deadline = start_time + lc3::secondsToDuration(args.submission_timeout);
+    }
+    if(args.seed_given) {
+        submission.seed = args.seed;
+    } else {
+        std::random_device dev;
+        submission.seed = dev();
+    }
+    if(! args.reference_dir.empty()) {
+        // The reference runs on the same random machines as the submission.
+        std::shared_ptr<ReferenceTraces const> traces = getReferenceTraces(lab, args, submission.seed);
+        if(args.budget_factor > 0) {
+            for(auto const & trace : *traces) {
+                uint64_t inst_count = trace.second.inst_count;
+                uint64_t budget = static_cast<uint64_t>(std::ceil(inst_count * args.budget_factor));
+                submission.inst_budgets[trace.first] = std::max(budget, inst_count + MinBudgetSlack);
+            }
+        }
+        if(args.diff_reference) {
+            submission.reference_traces = traces;
+        }
+    }
+
+    std::vector<TestCase> const & tests = *lab.tests;
+    total_points_earned = 0;
+    total_possible_points = 0;
+
+    uint32_t test_count = 0;
+    uint32_t memoized_count = 0;
+    uint64_t total_inst_count = 0;
+    double total_cpu_time = 0;
+    auto report_summary = [&](int status) {
+        if(json_report == nullptr) {
+            return status;
+        }
+        double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        *json_report << "{\"type\": \"summary\", \"lab\": " << jsonString(lab.name) << ", \"status\": " << status
+                     << ", \"points_earned\": " << total_points_earned << ", \"points\": " << total_possible_points
+                     << ", \"tests\": " << test_count << ", \"memoized\": " << memoized_count
+                     << ", \"instructions\": " << total_inst_count << ", \"wall_time\": " << wall_time
+                     << ", \"cpu_time\": " << total_cpu_time
+                     << ", \"mips\": " << (wall_time > 0 ? total_inst_count / wall_time / 1e6 : 0)
+                     << ", \"tests_per_second\": " << (wall_time > 0 ? test_count / wall_time : 0) << "}\n";
+        return status;
+    };
+
+    if(valid_program) {
+        std::vector<TestResult> results(tests.size());
+        auto report_test = [&](uint32_t i) {
+            out << results[i].report.output.str() << std::flush;
+            total_possible_points += tests[i].points;
+            total_points_earned += results[i].points_earned;
+            test_count += 1;
+            memoized_count += results[i].memoized;
+            total_inst_count += results[i].inst_count;
+            total_cpu_time += results[i].cpu_time;
+            if(json_report != nullptr) {
+                writeTestRecord(*json_report, lab, tests[i], submission, results[i]);
+            }
+            return ! results[i].load_failed;
+        };
+
+        if(args.isolate) {
+            runTestsIsolated(lab, submission, args, results);
+            for(uint32_t i = 0; i < tests.size(); i += 1) {
+                if(! report_test(i)) {
+                    return report_summary(2);
+                }
+            }
+        } else if(args.lockstep_lanes > 0) {
+            // Randomized test cases run the same program on machines that only differ in their contents, so each one
+            // runs on a thread of its own with its machine in a lockstep group, and their runs go through the group
+            // together. The other test cases run one after another in the meantime.
+            std::vector<uint32_t> random_ids;
+            for(uint32_t i = 0; i < tests.size(); i += 1) {
+                if(tests[i].randomize) {
+                    random_ids.push_back(i);
+                }
+            }
+            lc3::lockstep_group group(static_cast<uint32_t>(random_ids.size()), args.lockstep_lanes);
+            std::vector<std::thread> members;
+            for(uint32_t test_id : random_ids) {
+                members.emplace_back([&, test_id]() {
+                    runTest(lab, tests[test_id], submission, args, results[test_id], nullptr, &group);
+                });
+            }
+            for(uint32_t i = 0; i < tests.size(); i += 1) {
+                if(! tests[i].randomize) {
+                    runTest(lab, tests[i], submission, args, results[i]);
+                }
+            }
+            for(std::thread & member : members) {
+                member.join();
+            }
+
+            for(uint32_t i = 0; i < tests.size(); i += 1) {
+                if(! report_test(i)) {
+                    return report_summary(2);
+                }
+            }
+        } else if(args.jobs <= 1) {
+            for(uint32_t i = 0; i < tests.size(); i += 1) {
+                runTest(lab, tests[i], submission, args, results[i]);
+                if(! report_test(i)) {
+                    return report_summary(2);
+                }
+            }
+        } else {
+            // Each worker takes the next test case that has not been started; reports are printed in registration
+            // order once every test case has run.
+            std::atomic<uint32_t> next_test(0);
+            std::vector<std::thread> workers;
+            uint32_t worker_count = std::min(args.jobs, static_cast<uint32_t>(tests.size()));
+            for(uint32_t i = 0; i < worker_count; i += 1) {
+                workers.emplace_back([&]() {
+                    for(uint32_t test_id = next_test++; test_id < tests.size(); test_id = next_test++) {
+                        runTest(lab, tests[test_id], submission, args, results[test_id]);
+                    }
+                });
+            }
+            for(std::thread & worker : workers) {
+                worker.join();
+            }
+
+            for(uint32_t i = 0; i < tests.size(); i += 1) {
+                if(! report_test(i)) {
+                    return report_summary(2);
+                }
+            }
+        }
+    }
+
+    out << "==========\n";
+    float percent_points_earned;
+    if(total_possible_points == 0) {
+        percent_points_earned = 0;
+    } else {
+        percent_points_earned = ((float) total_points_earned) / total_possible_points;
+    }
+    out << "Total points earned: " << total_points_earned << "/" << total_possible_points << " ("
+        << (percent_points_earned * 100) << "%)\n";
+
+    return report_summary(0);
+}
+
+#if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32))
+// Reads a request from a socket, failing once the deadline has passed however the client spaces out its data.
+class SocketReader
+{
+public:
+    SocketReader(int fd, std::chrono::steady_clock::time_point deadline) : fd(fd), deadline(deadline) {}
+
+    bool readLine(std::string & line)
+    {
+        std::size_t newline_pos;
+        while((newline_pos = buffer.find('\n')) == std::string::npos) {
+            if(! fill()) {
+                return false;
+            }
+        }
+        line = buffer.substr(0, newline_pos);
+        buffer.erase(0, newline_pos + 1);
+        return true;
+    }
+
+    bool readBytes(std::size_t count, std::string & bytes)
+    {
+        while(buffer.size() < count) {
+            if(! fill()) {
+                return false;
+            }
+        }
+        bytes = buffer.substr(0, count);
+        buffer.erase(0, count);
+        return true;
+    }
+
+private:
+    int fd;
+    std::chrono::steady_clock::time_point deadline;
+    std::string buffer;
+
+    bool fill(void)
+    {
+        char chunk[4096];
+        ssize_t count;
+        do {
+            std::chrono::microseconds remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline
+                - std::chrono::steady_clock::now());
+            if(remaining.count() <= 0) {
+                return false;
+            }
+            timeval timeout;
+            timeout.tv_sec = static_cast<time_t>(remaining.count() / 1000000);
+            timeout.tv_usec = static_cast<suseconds_t>(remaining.count() % 1000000);
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            count = read(fd, chunk, sizeof(chunk));
+        } while(count < 0 && errno == EINTR);
+        if(count <= 0) {
+            return false;
+        }
+        buffer.append(chunk, count);
+        return true;
+    }
+};
+
+static void writeAll(int fd, std::string const & data)
+{
+    std::size_t pos = 0;
+    while(pos < data.size()) {
+        ssize_t count = write(fd, data.data() + pos, data.size() - pos);
+        if(count < 0) {
+            if(errno == EINTR) { continue; }
+            return;
+        }
+        pos += count;
+    }
+}
+
+// Reads one request from the client, grades it, and sends back a single JSON object with the report and the --report
+// lines of the submission. Returns false if the client asked the daemon to stop.
+static bool handleRequest(int client, std::vector<Lab> const & labs, CLIArgs const & args)
+{
+    SocketReader reader(client, std::chrono::steady_clock::now() + lc3::secondsToDuration(DaemonClientTimeout));
+    std::ostringstream out;
+    BufferedPrinter asm_printer(true, out);
+
+    Lab const * lab = &labs[0];
+    std::vector<std::string> filenames;
+    std::vector<std::string> temp_filenames;
+    std::string temp_dir;
+    std::string error;
+    bool keep_running = true;
+    bool grade = false;
+
+    std::string line;
+    while(error.empty() && ! grade) {
+        if(! reader.readLine(line)) {
+            error = "incomplete request";
+            break;
+        }
+        std::istringstream line_stream(line);
+        std::string command;
+        line_stream >> command;
+        if(command == "lab") {
+            std::string name;
+            line_stream >> name;
+            auto match = std::find_if(labs.begin(), labs.end(), [&name](Lab const & l) { return l.name == name; });
+            if(match == labs.end()) {
+                error = "unknown lab " + name;
+            } else {
+                lab = &(*match);
+            }
+        } else if(command == "file") {
+            std::string filename;
+            std::getline(line_stream >> std::ws, filename);
+            filenames.push_back(filename);
+        } else if(command == "source") {
+            std::string name;
+            std::size_t length = 0;
+            line_stream >> name >> length;
+            std::string source;
+            if(name.empty() || name.find('/') != std::string::npos) {
+                error = "invalid source name";
+            } else if(! reader.readBytes(length, source)) {
+                error = "incomplete source";
+            } else {
+                if(temp_dir.empty()) {
+                    char dir_template[] = "/tmp/lc3grade.XXXXXX";
+                    if(mkdtemp(dir_template) == nullptr) {
+                        error = "could not create temporary directory";
+                        break;
+                    }
+                    temp_dir = dir_template;
+                }
+                std::string filename = temp_dir + "/" + name;
+                std::ofstream source_file(filename, std::ios_base::binary);
+                source_file << source;
+                temp_filenames.push_back(filename);
+                filenames.push_back(filename);
+            }
+        } else if(command == "grade") {
+            grade = true;
+        } else if(command == "quit") {
+            keep_running = false;
+            break;
+        } else if(! command.empty()) {
+            error = "unknown command " + command;
+        }
+    }
+
+    std::ostringstream response;
+    if(error.empty() && grade) {
+        std::vector<std::string> obj_filenames;
+        bool valid_program = assembleSubmission(filenames, args, asm_printer, obj_filenames);
+        uint32_t points_earned = 0, possible_points = 0;
+        std::ostringstream records;
+        int status = gradeSubmission(*lab, obj_filenames, valid_program, args, out, &records, points_earned,
+            possible_points);
+
+        response << "{\"type\": \"result\", \"lab\": " << jsonString(lab->name) << ", \"status\": " << status
+                 << ", \"points_earned\": " << points_earned << ", \"points\": " << possible_points
+                 << ", \"report\": " << jsonString(out.str()) << ", \"records\": [";
+        std::istringstream record_lines(records.str());
+        std::string record;
+        for(bool first = true; std::getline(record_lines, record); first = false) {
+            response << (first ? "" : ", ") << record;
+        }
+        response << "]}\n";
+    } else if(! error.empty()) {
+        response << "{\"type\": \"error\", \"message\": " << jsonString(error) << "}\n";
+    }
+    timeval timeout;
+    timeout.tv_sec = static_cast<time_t>(DaemonClientTimeout);
+    timeout.tv_usec = 0;
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    writeAll(client, response.str());
+
+    for(std::string const & filename : temp_filenames) {
+        std::remove(filename.c_str());
+        std::string obj_filename = filename.substr(0, filename.find_last_of('.')) + ".obj";
+        std::remove(obj_filename.c_str());
+    }
+    if(! temp_dir.empty()) {
+        rmdir(temp_dir.c_str());
+    }
+
+    return keep_running;
+}
+
+// Serves grading requests on a Unix domain socket until a client sends quit. The test cases are set up once, and every
+// simulator in the process shares the same assembled OS, so each request only pays for assembling the submission and
+// running the tests.
+static int runDaemon(std::string const & socket_path, std::vector<Lab> const & labs, CLIArgs const & args)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "socket path is too long\n";
+        return 1;
+    }
+    std::strcpy(addr.sun_path, socket_path.c_str());
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server < 0) {
+        std::cerr << "could not create socket\n";
+        return 1;
+    }
+    unlink(socket_path.c_str());
+    if(bind(server, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(server, 16) < 0) {
+        std::cerr << "could not listen on " << socket_path << "\n";
+        close(server);
+        return 1;
+    }
+
+    // A client that disconnects early must not take the daemon down with it.
+    signal(SIGPIPE, SIG_IGN);
+
+    bool keep_running = true;
+    while(keep_running) {
+        int client = accept(server, nullptr, nullptr);
+        if(client < 0) {
+            if(errno == EINTR) { continue; }
+            break;
+        }
+        keep_running = handleRequest(client, labs, args);
+        close(client);
+    }
+
+    close(server);
+    unlink(socket_path.c_str());
+    return 0;
+}
+#else
+static int runDaemon(std::string const & socket_path, std::vector<Lab> const & labs, CLIArgs const & args)
+{
+    (void) socket_path;
+    (void) labs;
+    (void) args;
+    std::cerr << "daemon mode is not supported on this platform\n";
+    return 1;
+}
+#endif
+
+int graderMain(int argc, char * argv[], std::vector<Lab> const & labs, std::string const & extra_usage)
 {
     CLIArgs args;
+    std::string daemon_socket;
     std::vector<std::pair<std::string, std::string>> parsed_args = parseCLIArgs(argc, argv);
     for(auto const & arg : parsed_args) {
         if(std::get<0>(arg) == "print-output") {
@@ -87,121 +1549,174 @@ int main(int argc, char * argv[])
             args.sim_print_level = std::stoi(std::get<1>(arg));
             args.sim_print_level_override = true;
             args.print_output = true;
+        } else if(std::get<0>(arg) == "asm-cache-dir") {
+            args.asm_cache_dir = std::get<1>(arg);
         } else if(std::get<0>(arg) == "ignore-privilege") {
             args.ignore_privilege = true;
         } else if(std::get<0>(arg) == "liberal-asm") {
             args.liberal_asm = true;
+        } else if(std::get<0>(arg) == "native-traps") {
+            args.native_traps = true;
+            args.native_trap_cost = std::get<1>(arg) == "cost";
+        } else if(std::get<0>(arg) == "jobs") {
+            if(std::get<1>(arg) == "") {
+                args.jobs = std::max(std::thread::hardware_concurrency(), 1u);
+            } else {
+                int jobs = std::stoi(std::get<1>(arg));
+                if(jobs < 1) {
+                    std::cerr << "--jobs needs at least 1 test case at a time\n";
+                    return 1;
+                }
+                args.jobs = jobs;
+            }
+        } else if(std::get<0>(arg) == "lockstep") {
+            if(std::get<1>(arg) == "") {
+                args.lockstep_lanes = 16;
+            } else {
+                int lanes = std::stoi(std::get<1>(arg));
+                if(lanes < 1) {
+                    std::cerr << "--lockstep needs at least 1 machine at a time\n";
+                    return 1;
+                }
+                args.lockstep_lanes = lanes;
+            }
+        } else if(std::get<0>(arg) == "isolate") {
+            args.isolate = true;
+        } else if(std::get<0>(arg) == "timeout") {
+            args.timeout = std::stod(std::get<1>(arg));
+        } else if(std::get<0>(arg) == "submission-timeout") {
+            args.submission_timeout = std::stod(std::get<1>(arg));
+        } else if(std::get<0>(arg) == "max-insts") {
+            args.max_insts = std::stoull(std::get<1>(arg));
+        } else if(std::get<0>(arg) == "max-output") {
+            args.max_output = std::stoull(std::get<1>(arg));
+        } else if(std::get<0>(arg) == "detect-loops") {
+            args.detect_loops = true;
+        } else if(std::get<0>(arg) == "output-buffer") {
+            args.output_buffer = std::stoull(std::get<1>(arg));
+        } else if(std::get<0>(arg) == "spill-output") {
+            args.spill_output = true;
+        } else if(std::get<0>(arg) == "memo-dir") {
+            args.memo_dir = std::get<1>(arg);
+        } else if(std::get<0>(arg) == "seed") {
+            args.seed = std::stoull(std::get<1>(arg));
+            args.seed_given = true;
+        } else if(std::get<0>(arg) == "reference-dir") {
+            args.reference_dir = std::get<1>(arg);
+        } else if(std::get<0>(arg) == "budget-factor") {
+            args.budget_factor = std::stod(std::get<1>(arg));
+        } else if(std::get<0>(arg) == "diff-reference") {
+            args.diff_reference = true;
+        } else if(std::get<0>(arg) == "report") {
+            args.report_filename = std::get<1>(arg);
+        } else if(std::get<0>(arg) == "daemon") {
+            daemon_socket = std::get<1>(arg);
         } else if(std::get<0>(arg) == "h" || std::get<0>(arg) == "help") {
             std::cout << "usage: " << argv[0] << " [OPTIONS]\n";
             std::cout << "\n";
             std::cout << "  -h,--help              Print this message\n";
+            std::cout << extra_usage;
             std::cout << "  --print-output         Print program output\n";
             std::cout << "  --asm-print-level=N    Assembler output verbosity [0-9]\n";
             std::cout << "  --sim-print-level=N    Simulator output verbosity [0-9]\n";
+            std::cout << "  --asm-cache-dir=DIR    Reuse objects assembled before from the cache in DIR\n";
             std::cout << "  --ignore-privilege     Ignore access violations\n";
             std::cout << "  --liberal-asm          Enable liberal assembly syntax\n";
+            std::cout << "  --native-traps[=cost]  Service OS TRAPs natively (optionally counting the routine's\n";
+            std::cout << "                         instructions)\n";
+            std::cout << "  --jobs[=N]             Run N test cases at a time (default: one per core)\n";
+            std::cout << "  --lockstep[=N]         Run the machines of randomized test cases together, N at a time\n";
+            std::cout << "                         (default: 16)\n";
+            std::cout << "  --isolate              Run each test case in its own process (--jobs at a time)\n";
+            std::cout << "  --timeout=SECONDS      Stop a test case after SECONDS of wall-clock time\n";
+            std::cout << "  --submission-timeout=SECONDS\n";
+            std::cout << "                         Stop the test cases of a submission once grading it has taken\n";
+            std::cout << "                         SECONDS of wall-clock time\n";
+            std::cout << "  --max-insts=N          Stop a test case after it executes N instructions\n";
+            std::cout << "  --max-output=N         Stop a test case after it prints N characters\n";
+            std::cout << "  --detect-loops         Stop a test case once the program is stuck in an infinite loop\n";
+            std::cout << "  --output-buffer=N      Keep at most N characters of a test case's output in memory\n";
+            std::cout << "  --spill-output         With --output-buffer, write the rest of the output to a temporary\n";
+            std::cout << "                         file instead of dropping it\n";
+            std::cout << "  --memo-dir=DIR         Reuse results of test cases that do not randomize the machine\n";
+            std::cout << "  --seed=N               Randomize machines from seed N (default: a new seed every run)\n";
+            std::cout << "  --reference-dir=DIR    Limit the instructions of each test case to a multiple of what the\n";
+            std::cout << "                         lab's reference solution in DIR (e.g. DIR/binsearch.asm) takes\n";
+            std::cout << "  --budget-factor=X      With --reference-dir, the multiple of the reference (default: 4, or 0\n";
+            std::cout << "                         for no budget)\n";
+            std::cout << "  --diff-reference       With --reference-dir, stop a test case as soon as its output differs\n";
+            std::cout << "                         from the reference solution's\n";
+            std::cout << "  --report=FILE          Also write the results of each test case to FILE as JSON lines\n";
+            std::cout << "  --daemon=SOCKET        Serve grading requests on a Unix domain socket\n";
             return 0;
         }
     }
 
-    lc3::ConsolePrinter asm_printer;
-    lc3::as assembler(asm_printer, args.asm_print_level_override ? args.asm_print_level : 0, false, args.liberal_asm);
-    lc3::conv converter(asm_printer, args.asm_print_level_override ? args.asm_print_level : 0, false);
+    if(labs.size() == 0) {
+        std::cerr << "no labs to grade\n";
+        return 1;
+    }
 
-    std::vector<std::string> obj_filenames;
-    bool valid_program = true;
+    if(! args.memo_dir.empty()) {
+        std::string program;
+        if(readInputFile("/proc/self/exe", program) || readInputFile(argv[0], program)) {
+            args.program_hash = lc3::utils::sha256Hash(program);
+        } else {
+            std::cerr << "could not read the grader executable; results are not memoized\n";
+            args.memo_dir = "";
+        }
+    }
+
+    if(! daemon_socket.empty()) {
+        for(Lab const & lab : labs) {
+            lab.setup();
+        }
+        int status = runDaemon(daemon_socket, labs, args);
+        for(Lab const & lab : labs) {
+            lab.shutdown();
+        }
+        return status;
+    }
+
+    std::vector<std::string> filenames;
     for(int i = 1; i < argc; i += 1) {
         std::string filename(argv[i]);
         if(filename[0] != '-') {
-            lc3::optional<std::string> result;
-            if(! endsWith(filename, ".obj")) {
-                if(endsWith(filename, ".bin")) {
-                    result = converter.convertBin(filename);
-                } else {
-                    result = assembler.assemble(filename);
-                }
-            } else {
-                result = filename;
-            }
-
-            if(result) {
-                obj_filenames.push_back(*result);
-            } else {
-                valid_program = false;
-            }
+            filenames.push_back(filename);
         }
     }
 
-    if(obj_filenames.size() == 0) {
-        return 1;
+    // Lines of the report are not flushed one at a time; the file is complete once the grader exits.
+    std::ofstream report_file;
+    if(! args.report_filename.empty()) {
+        report_file.open(args.report_filename);
+        if(! report_file) {
+            std::cerr << "could not open " << args.report_filename << "\n";
+            return 1;
+        }
     }
 
-    setup();
-
-    uint32_t total_points_earned = 0;
-    uint32_t total_possible_points = 0;
-
-    if(valid_program) {
-        for(TestCase const & test : tests) {
-            BufferedPrinter sim_printer(args.print_output);
-            StringInputter sim_inputter;
-            lc3::sim simulator(sim_printer, sim_inputter, false,
-                args.sim_print_level_override ? args.sim_print_level : 1, true);
-
-            testBringup(simulator);
-
-            verify_count = 0;
-            verify_valid = 0;
-
-            total_possible_points += test.points;
-
-            std::cout << "Test: " << test.name;
-            if(test.randomize) {
-                simulator.randomize();
-                std::cout << " (Randomized Machine)";
-            }
-            std::cout << std::endl;
-            for(std::string const & obj_filename : obj_filenames) {
-                if(! simulator.loadObjFile(obj_filename)) {
-                    std::cout << "could not init simulator\n";
-                    return 2;
-                }
-            }
-
-            if(args.ignore_privilege) {
-                simulator.setIgnorePrivilege(true);
-            }
-
-            try {
-                test.test_func(simulator, sim_inputter);
-            } catch(lc3::utils::exception const & e) {
-                std::cout << "Test case ran into exception: " << e.what() << "\n";
-                continue;
-            }
-
-            testTeardown(simulator);
+    lc3::ConsolePrinter asm_printer;
+    std::vector<std::string> obj_filenames;
+    bool valid_program = assembleSubmission(filenames, args, asm_printer, obj_filenames);
 
-            float percent_points_earned = ((float) verify_valid) / verify_count;
-            uint32_t points_earned = (uint32_t) ( percent_points_earned * test.points);
-            std::cout << "Test points earned: " << points_earned << "/" << test.points << " ("
-                      << (percent_points_earned * 100) << "%)\n";
-            std::cout << "==========\n";
+    for(Lab const & lab : labs) {
+        lab.setup();
 
-            total_points_earned += points_earned;
+        if(labs.size() > 1) {
+            std::cout << "Lab: " << lab.name << "\n";
         }
-    }
+        uint32_t total_points_earned = 0;
+        uint32_t total_possible_points = 0;
+        int status = gradeSubmission(lab, obj_filenames, valid_program, args, std::cout,
+            report_file.is_open() ? &report_file : nullptr, total_points_earned, total_possible_points);
+        lab.shutdown();
 
-    std::cout << "==========\n";
-    float percent_points_earned;
-    if(total_possible_points == 0) {
-        percent_points_earned = 0;
-    } else {
-        percent_points_earned = ((float) total_points_earned) / total_possible_points;
+        // the submission is the same for every lab, so one that could not be graded here can not be graded by any
+        if(status != 0) {
+            return status;
+        }
     }
-    std::cout << "Total points earned: " << total_points_earned << "/" << total_possible_points << " ("
-              << (percent_points_earned * 100) << "%)\n";
-
-    shutdown();
 
     return 0;
 }
@@ -210,36 +1725,41 @@ bool outputCompare(lc3::utils::IPrinter const & printer, std::string check, bool
 {
     BufferedPrinter const & buffered_printer = static_cast<BufferedPrinter const &>(printer);
 
-    std::cout << "is '" << check << "' " << (substr ? "substring of" : "==") << " '";
-    for(uint32_t i = 0; i < buffered_printer.display_buffer.size(); i += 1) {
-        if(buffered_printer.display_buffer[i] == '\n') {
-            std::cout << "\\n";
+    // Only echo the start of the output, so that a program that prints in a loop does not flood the report.
+    uint64_t echo_size = std::max<uint64_t>(check.size() * 2, 1024);
+    std::ostream & output = test_report->output;
+    output << "is '" << check << "' " << (substr ? "substring of" : "==") << " '";
+    uint64_t echo_pos = 0;
+    buffered_printer.scanOutput([&output, &echo_pos, echo_size](char c) {
+        if(echo_pos == echo_size) { return false; }
+        if(c == '\n') {
+            output << "\\n";
         } else {
-            std::cout << buffered_printer.display_buffer[i];
+            output << c;
         }
+        echo_pos += 1;
+        return true;
+    });
+    echo_size = echo_pos;
+    output << "'";
+    if(echo_size < buffered_printer.getOutputSize()) {
+        output << " (" << (buffered_printer.getOutputSize() - echo_size) << " more characters)";
     }
-    std::cout << "'\n";
+    output << "\n";
 
     if(substr) {
-        uint64_t buffer_pos = 0;
-        while(buffer_pos + check.size() < buffered_printer.display_buffer.size()) {
-            uint64_t check_pos;
-            for(check_pos = 0; check_pos < check.size(); check_pos += 1) {
-                if(check[check_pos] != buffered_printer.display_buffer[buffer_pos + check_pos]) {
-                    break;
-                }
-            }
-            if(check_pos == check.size()) { return true; }
-            buffer_pos += 1;
-        }
-        return false;
+        return buffered_printer.hadOutput(check);
     } else {
-        if(buffered_printer.display_buffer.size() != check.size()) { return false; }
+        if(buffered_printer.getOutputSize() != check.size()) { return false; }
 
-        for(uint32_t i = 0; i < check.size(); i += 1) {
-            if(buffered_printer.display_buffer[i] != check[i]) { return false; }
-        }
-        return true;
+        // output that was dropped past the capacity can not be compared
+        uint64_t pos = 0;
+        buffered_printer.scanOutput([&check, &pos](char c) {
+            if(c != check[pos]) { return false; }
+            pos += 1;
+            return true;
+        });
+        return pos == check.size();
     }
     return false;
 }
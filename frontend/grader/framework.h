@@ -2,11 +2,13 @@
  * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
  */
 #include <cstdint>
+#include <cstdio>
 #include <iostream>
 #include <functional>
 #include <map>
 #include <string>
 #include <sstream>
+#include <utility>
 #include <vector>
 
 #include "inputter.h"
@@ -15,42 +17,132 @@
 
 struct TestCase;
 
+// Verification results and report of a single test case. The VERIFY macros update the report of the test case
+// running on the current thread, so that test cases can run in parallel (see --jobs).
+struct TestReport
+{
+    uint32_t verify_count = 0;
+    uint32_t verify_valid = 0;
+    std::ostringstream output;
+    // Message and result of each verification, in order (see --report).
+    std::vector<std::pair<std::string, bool>> verifications;
+    // Memory regions (first and last address) registered with DIFF_MEMORY.
+    std::vector<std::pair<uint16_t, uint16_t>> diff_memory;
+};
+
 extern std::vector<TestCase> tests;
-extern uint32_t verify_count;
-extern uint32_t verify_valid;
+extern thread_local TestReport * test_report;
+
+// Looks for a string in output one character at a time, as it is printed (Knuth-Morris-Pratt), so that the output
+// never has to be rescanned.
+class OutputMatcher
+{
+public:
+    OutputMatcher(std::string const & pattern, bool forbidden = false);
+
+    // Returns true on the character that completes the first occurrence of the pattern.
+    bool feed(char c);
+    void reset(void) { state = 0; matched = pattern.empty(); }
+
+    std::string const & getPattern(void) const { return pattern; }
+    bool isForbidden(void) const { return forbidden; }
+    bool isMatched(void) const { return matched; }
+
+private:
+    std::string pattern;
+    std::vector<uint32_t> failure;
+    bool forbidden;
+    uint32_t state;
+    bool matched;
+};
 
 class BufferedPrinter : public lc3::utils::IPrinter
 {
 public:
-    BufferedPrinter(bool print_output) : print_output(print_output) {}
+    BufferedPrinter(bool print_output, std::ostream & output) : print_output(print_output), output(output) {}
+    BufferedPrinter(BufferedPrinter const &) = delete;
+    BufferedPrinter & operator=(BufferedPrinter const &) = delete;
+    ~BufferedPrinter(void);
 
+    // The start of the output since the last clear(), up to the capacity.
     std::vector<char> display_buffer;
 
     virtual void setColor(lc3::utils::PrintColor color) override { (void) color; }
     virtual void print(std::string const & string) override;
     virtual void newline(void) override;
-    void clear(void) { display_buffer.clear(); }
+    void clear(void);
+
+    // Keeps at most capacity characters of output in display_buffer (0 means no limit). Output past the capacity is
+    // written to a temporary file if spill is set, and is otherwise dropped.
+    void setCapacity(uint64_t capacity, bool spill);
+    // Number of characters printed since the last clear(), including any that were spilled or dropped.
+    uint64_t getOutputSize(void) const { return output_size; }
+    // Calls visit on each character of the output that was kept, in order, until it returns false.
+    bool scanOutput(std::function<bool(char)> const & visit) const;
+
+    // Strings registered up front are matched as the output is printed. Once every expected string has been printed,
+    // or as soon as a forbidden one is, the machine is paused so that the test case does not simulate any further
+    // than it needs to. clear() restarts the matching but keeps the registered strings.
+    void setSimulator(lc3::sim * simulator) { this->simulator = simulator; }
+    void expectOutput(std::string const & check);
+    void forbidOutput(std::string const & check);
+    // Whether check was printed since the last clear(). Registered strings are answered without rescanning the output.
+    bool hadOutput(std::string const & check) const;
+
+    // Everything printed, whatever was cleared since, is kept in the transcript if keep_transcript is set. Given the
+    // transcript of the reference solution instead, each character is checked against it as it is printed, and at the
+    // first one that differs the machine is paused and cancelled (see lc3::sim::cancel), so it does not run again.
+    void keepTranscript(bool keep_transcript) { this->keep_transcript = keep_transcript; }
+    std::string const & getTranscript(void) const { return transcript; }
+    void setReferenceTranscript(std::string const * reference) { this->reference = reference; }
+    // Number of characters printed that matched the reference, which is the position of the first difference.
+    uint64_t getReferencePos(void) const { return reference_pos; }
+    bool didDiverge(void) const { return diverged; }
+    char getDivergentChar(void) const { return divergent_char; }
+    uint64_t getDivergentInstCount(void) const { return divergent_inst_count; }
 
 private:
     bool print_output;
+    std::ostream & output;
+
+    uint64_t capacity = 0;
+    bool spill = false;
+    std::FILE * spill_file = nullptr;
+    uint64_t output_size = 0;
+
+    lc3::sim * simulator = nullptr;
+    std::vector<OutputMatcher> matchers;
+    uint32_t unmatched_expected_count = 0;
+
+    bool keep_transcript = false;
+    std::string transcript;
+    std::string const * reference = nullptr;
+    uint64_t reference_pos = 0;
+    bool diverged = false;
+    char divergent_char = 0;
+    uint64_t divergent_inst_count = 0;
+
+    void leaveLockstep(void);
+    void record(char c);
+    void match(char c);
+    void trace(char c);
 };
 
-class StringInputter : public lc3::utils::IInputter
+// Keyboard input of a test case. The input is scheduled on the machine (see lc3::sim::scheduleInput), so the machine
+// only looks at it when a character is due rather than after every instruction.
+class StringInputter
 {
 public:
-    StringInputter(void) { setString(""); }
-    StringInputter(std::string const & source) { setString(source); }
+    StringInputter(lc3::sim & simulator) : simulator(simulator) {}
 
+    // Replaces any input that has not been read yet.
     void setString(std::string const & source) { setStringAfter(source, 0); }
     void setStringAfter(std::string const & source, uint32_t inst_count);
-    void beginInput(void) {}
-    bool getChar(char & c);
-    void endInput(void) {}
+    // Types source once the machine has executed inst_count more instructions, after any input that is already due.
+    void addStringAfter(std::string const & source, uint32_t inst_count);
 
 private:
-    std::string source;
-    uint32_t pos;
-    uint32_t inst_delay;
+    lc3::sim & simulator;
 };
 
 struct TestCase
@@ -70,6 +162,25 @@ struct TestCase
     }
 };
 
+// A lab grader: the test cases it registers and the functions that every lab source defines. A lab is either linked
+// directly into its own executable or built as a plugin that the lc3grade runner loads through LAB_ENTRY_POINT.
+struct Lab
+{
+    std::string name;
+    // Identifies this build of the lab, for labs that are not compiled into the grader executable (e.g. the SHA-256 of
+    // a plugin), so that results memoized by another build are not reused (see --memo-dir).
+    std::string version;
+    std::vector<TestCase> * tests = nullptr;
+    void (*setup)(void) = nullptr;
+    void (*shutdown)(void) = nullptr;
+    void (*test_bringup)(lc3::sim &) = nullptr;
+    void (*test_teardown)(lc3::sim &) = nullptr;
+};
+
+#define LAB_ENTRY_POINT "lc3RegisterLab"
+using lab_entry_func_t = void (*)(Lab &);
+
+int graderMain(int argc, char * argv[], std::vector<Lab> const & labs, std::string const & extra_usage = "");
 bool outputCompare(lc3::utils::IPrinter const & printer, std::string check, bool substr);
 
 #define REGISTER_TEST(name, function, points)                        \
@@ -79,40 +190,52 @@ bool outputCompare(lc3::utils::IPrinter const & printer, std::string check, bool
     tests.emplace_back( #name , ( function ), ( points ), true);     \
     do {} while(false)
 #define VERIFY_NAMED(message, check)                                 \
-    verify_count += 1;                                               \
-    std::cout << "  " << ( message ) << " => ";                      \
+    test_report->verify_count += 1;                                  \
+    test_report->verifications.emplace_back(( message ), false);     \
+    test_report->output << "  " << ( message ) << " => ";            \
     if(( check ) == true) {                                          \
-        verify_valid += 1;                                           \
-        std::cout << "yes\n";                                        \
+        test_report->verify_valid += 1;                              \
+        test_report->verifications.back().second = true;             \
+        test_report->output << "yes\n";                              \
     } else {                                                         \
-        std::cout << "no\n";                                         \
+        test_report->output << "no\n";                               \
     }                                                                \
     do {} while(false)
 #define VERIFY(check)                                                \
     VERIFY_NAMED(#check, check)
 #define VERIFY_OUTPUT_NAMED(message, check)                          \
-    verify_count += 1;                                               \
-    std::cout << " " << ( message ) << " => ";                       \
+    test_report->verify_count += 1;                                  \
+    test_report->verifications.emplace_back(( message ), false);     \
+    test_report->output << " " << ( message ) << " => ";             \
     if(outputCompare(sim.getPrinter(), check, false)) {              \
-        verify_valid += 1;                                           \
-        std::cout << "yes\n";                                        \
+        test_report->verify_valid += 1;                              \
+        test_report->verifications.back().second = true;             \
+        test_report->output << "yes\n";                              \
     } else {                                                         \
-        std::cout << "no\n";                                         \
+        test_report->output << "no\n";                               \
     }                                                                \
     static_cast<BufferedPrinter &>(sim.getPrinter()).clear();        \
     do {} while(false)
 #define VERIFY_OUTPUT(check)                                         \
     VERIFY_OUTPUT_NAMED(#check, check)
 #define VERIFY_OUTPUT_HAD_NAMED(message, check)                      \
-    verify_count += 1;                                               \
-    std::cout << " " << ( message ) << " => ";                       \
+    test_report->verify_count += 1;                                  \
+    test_report->verifications.emplace_back(( message ), false);     \
+    test_report->output << " " << ( message ) << " => ";             \
     if(outputCompare(sim.getPrinter(), check, true)) {               \
-        verify_valid += 1;                                           \
-        std::cout << "yes\n";                                        \
+        test_report->verify_valid += 1;                              \
+        test_report->verifications.back().second = true;             \
+        test_report->output << "yes\n";                              \
     } else {                                                         \
-        std::cout << "no\n";                                         \
+        test_report->output << "no\n";                               \
     }                                                                \
     static_cast<BufferedPrinter &>(sim.getPrinter()).clear();        \
     do {} while(false)
 #define VERIFY_OUTPUT_HAD(check)                                     \
     VERIFY_OUTPUT_HAD_NAMED(#check, check)
+#define EXPECT_OUTPUT_HAD(check)                                     \
+    static_cast<BufferedPrinter &>(sim.getPrinter()).expectOutput(check)
+#define FORBID_OUTPUT(check)                                         \
+    static_cast<BufferedPrinter &>(sim.getPrinter()).forbidOutput(check)
+#define DIFF_MEMORY(start, end)                                      \
+    test_report->diff_memory.emplace_back(( start ), ( end ))
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include "framework.h"
+
+void setup(void);
+void shutdown(void);
+void testBringup(lc3::sim & sim);
+void testTeardown(lc3::sim & sim);
+
+std::vector<TestCase> tests;
+
+int main(int argc, char * argv[])
+{
+    Lab lab;
+    std::string name(argv[0]);
+    lab.name = name.substr(name.find_last_of("/\\") + 1);
+    lab.tests = &tests;
+    lab.setup = setup;
+    lab.shutdown = shutdown;
+    lab.test_bringup = testBringup;
+    lab.test_teardown = testTeardown;
+
+    return graderMain(argc, argv, {lab});
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include "framework.h"
+
+// Plugins are built with hidden visibility, so these (and everything the lab source defines) stay private to the
+// plugin and several labs can be loaded into one runner. Only the entry point is exported.
+void setup(void);
+void shutdown(void);
+void testBringup(lc3::sim & sim);
+void testTeardown(lc3::sim & sim);
+
+std::vector<TestCase> tests;
+
+extern "C" __attribute__((visibility("default"))) void lc3RegisterLab(Lab & lab)
+{
+    lab.tests = &tests;
+    lab.setup = setup;
+    lab.shutdown = shutdown;
+    lab.test_bringup = testBringup;
+    lab.test_teardown = testTeardown;
+}
@@ -5,7 +5,6 @@
 
 void UpperCaseTest(lc3::sim & sim, StringInputter & inputter)
 {
-    // This is a hack that will need to be replaced by adding an inputter.setStringAfter(str, inst_count) function
     inputter.setStringAfter("a", 50);
     bool success = sim.run();
     VERIFY_OUTPUT_HAD_NAMED("a", "a is not a capital letter of the English alphabet");
@@ -14,7 +13,6 @@ void UpperCaseTest(lc3::sim & sim, StringInputter & inputter)
 
 void LowerCaseTest(lc3::sim & sim, StringInputter & inputter)
 {
-    // This is a hack that will need to be replaced by adding an inputter.setStringAfter(str, inst_count) function
     inputter.setStringAfter("A", 50);
     bool success = sim.run();
     VERIFY_OUTPUT_HAD_NAMED("A", "The lower case of A is a");
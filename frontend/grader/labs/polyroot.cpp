@@ -3,7 +3,7 @@
  */
 #include "../framework.h"
 
-uint32_t sub_count;
+thread_local uint32_t sub_count;
 
 void LinearTest(lc3::sim & sim, StringInputter & inputter)
 {
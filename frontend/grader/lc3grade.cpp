@@ -0,0 +1,50 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <dlfcn.h>
+
+#include "common.h"
+#include "framework.h"
+
+// Lab name from the plugin path, e.g. build/lib/binsearch.so -> binsearch.
+static std::string labName(std::string const & path)
+{
+    std::size_t start = path.find_last_of('/');
+    start = (start == std::string::npos) ? 0 : start + 1;
+    std::size_t end = path.find('.', start);
+    return path.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+int main(int argc, char * argv[])
+{
+    std::vector<Lab> labs;
+    for(auto const & arg : parseCLIArgs(argc, argv)) {
+        if(std::get<0>(arg) != "lab") {
+            continue;
+        }
+
+        std::string const & path = std::get<1>(arg);
+        // Plugins are never unloaded; they live as long as the runner.
+        void * handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if(handle == nullptr) {
+            std::cerr << "could not load lab " << path << ": " << dlerror() << "\n";
+            return 1;
+        }
+        lab_entry_func_t register_lab = reinterpret_cast<lab_entry_func_t>(dlsym(handle, LAB_ENTRY_POINT));
+        if(register_lab == nullptr) {
+            std::cerr << path << " is not a lab\n";
+            return 1;
+        }
+
+        Lab lab;
+        lab.name = labName(path);
+        std::string plugin;
+        if(readInputFile(path, plugin)) {
+            lab.version = lc3::utils::sha256Hash(plugin);
+        }
+        register_lab(lab);
+        labs.push_back(lab);
+    }
+
+    return graderMain(argc, argv, labs, "  --lab=PATH             Load a lab plugin (may be given more than once)\n");
+}
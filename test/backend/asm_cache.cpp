@@ -0,0 +1,101 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "check.h"
+#include "interface.h"
+#include "stream_printer.h"
+
+static std::string const cache_dir = "asm_cache";
+
+static std::string readFile(std::string const & filename)
+{
+    std::ifstream file(filename, std::ios_base::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+static std::vector<std::string> listEntries(void)
+{
+    std::vector<std::string> entries;
+    DIR * dir = opendir(cache_dir.c_str());
+    if(dir == nullptr) {
+        return entries;
+    }
+    for(dirent * entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+        std::string name(entry->d_name);
+        if(name.size() > 5 && name.substr(name.size() - 5) == ".asmc") {
+            entries.push_back(cache_dir + "/" + name);
+        }
+    }
+    closedir(dir);
+    return entries;
+}
+
+// Assembles filename through the cache and returns the object file, or an empty string if it did not assemble.
+static std::string assemble(std::string const & filename)
+{
+    lc3::StreamPrinter printer(std::cerr);
+    lc3::as assembler(printer, 0, false, false);
+    assembler.setCacheDir(cache_dir);
+    lc3::optional<std::string> obj_filename = assembler.assemble(filename);
+    return obj_filename ? readFile(*obj_filename) : "";
+}
+
+int main(void)
+{
+    mkdir(cache_dir.c_str(), 0755);
+    for(std::string const & entry : listEntries()) {
+        std::remove(entry.c_str());
+    }
+
+    writeFile("a.asm", ".ORIG x3000\nLD R0, CHAR\nOUT\nHALT\nCHAR .FILL x41\n.END\n");
+    writeFile("b.asm", ".ORIG x3000\nLD R0, CHAR\nOUT\nHALT\nCHAR .FILL x42\n.END\n");
+
+    std::string a_obj = assemble("a.asm");
+    CHECK(! a_obj.empty());
+    std::vector<std::string> entries = listEntries();
+    CHECK(entries.size() == 1);
+    if(entries.size() != 1) {
+        return checkResult();
+    }
+    std::string a_entry = entries[0];
+    // entries are named after a SHA-256, not a 64-bit hash
+    CHECK(a_entry.size() == cache_dir.size() + 1 + 64 + 5);
+
+    std::string b_obj = assemble("b.asm");
+    CHECK(! b_obj.empty() && b_obj != a_obj);
+    CHECK(listEntries().size() == 2);
+
+    // A cache hit gives the same object file.
+    CHECK(assemble("a.asm") == a_obj);
+
+    // An entry for another source under the name of this one, as a hash collision would leave, must not be replayed.
+    std::string b_entry;
+    for(std::string const & entry : listEntries()) {
+        if(entry != a_entry) {
+            b_entry = entry;
+        }
+    }
+    std::string b_entry_contents = readFile(b_entry);
+    writeFile(a_entry, b_entry_contents);
+    CHECK(assemble("a.asm") == a_obj);
+    CHECK(readFile(a_entry) != b_entry_contents);
+
+    // Neither must a damaged entry.
+    std::string a_entry_contents = readFile(a_entry);
+    writeFile(a_entry, a_entry_contents.substr(0, a_entry_contents.size() / 2));
+    CHECK(assemble("a.asm") == a_obj);
+
+    return checkResult();
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "interface.h"
+#include "stream_printer.h"
+
+// Counts down from 5000 (15006 instructions up to the HALT, which spans several batches), then ends as the mode at
+// x3100 picks: 0 halts, 1 executes an illegal opcode, and 2 calls OUT with the supervisor stack pointer in device
+// memory, which is a triple fault. A key press interrupt, once enabled by the flag at x3101, counts the keys in R4
+// and keeps the last one.
+static char const * count_asm =
+    ".ORIG x3000\n"
+    "LDI R0, IE_PTR\n"
+    "BRz START\n"
+    "LEA R0, ISR\n"
+    "STI R0, KB_VECTOR\n"
+    "LD R0, KB_IE\n"
+    "STI R0, KBSR\n"
+    "START LD R1, COUNT\n"
+    "LOOP ADD R2, R2, #1\n"
+    "ADD R1, R1, #-1\n"
+    "BRp LOOP\n"
+    "ST R2, RESULT\n"
+    "LDI R0, MODE_PTR\n"
+    "BRz FIN\n"
+    "ADD R0, R0, #-1\n"
+    "BRz ILLEGAL\n"
+    "LD R0, BAD_STACK\n"
+    "STI R0, SAVED_SSP\n"
+    "OUT\n"
+    "FIN HALT\n"
+    "ILLEGAL .FILL xD000\n"
+    "ISR LDI R3, KBDR\n"
+    "ST R3, KEY\n"
+    "ADD R4, R4, #1\n"
+    "RTI\n"
+    "MODE_PTR .FILL x3100\n"
+    "IE_PTR .FILL x3101\n"
+    "KB_VECTOR .FILL x0180\n"
+    "KBSR .FILL xFE00\n"
+    "KBDR .FILL xFE02\n"
+    "KB_IE .FILL x4000\n"
+    "SAVED_SSP .FILL xFFFA\n"
+    "BAD_STACK .FILL xFF00\n"
+    "COUNT .FILL #5000\n"
+    "RESULT .BLKW #1\n"
+    "KEY .BLKW #1\n"
+    ".END\n";
+
+static constexpr uint16_t LOOP_ADDR = 0x3007;
+static constexpr uint16_t HALT_ADDR = 0x3012;
+static constexpr uint64_t INST_COUNT_TO_HALT = 15006;
+
+// Hands out each key once the machine has polled for input the given number of times since the last one.
+class DelayedInputter : public lc3::utils::IInputter
+{
+public:
+    DelayedInputter(std::string const & text, uint64_t delay) : text(text), delay(delay) {}
+
+    virtual void beginInput(void) override {}
+    virtual bool getChar(char & c) override
+    {
+        if(pos == text.size()) { return false; }
+        polls += 1;
+        if(polls < delay) { return false; }
+        polls = 0;
+        c = text[pos];
+        pos += 1;
+        return true;
+    }
+    virtual void endInput(void) override {}
+
+private:
+    std::string text;
+    uint64_t delay;
+    std::size_t pos = 0;
+    uint64_t polls = 0;
+};
+
+struct Machine
+{
+    // A post-instruction callback keeps the simulator from batching, so that it runs one instruction at a time.
+    Machine(bool batched, std::string const & input, uint64_t delay) :
+        printer(output), inputter(input, delay), simulator(printer, inputter, false, 1, false)
+    {
+        if(! batched) {
+            simulator.registerPostInstructionCallback([](lc3::core::MachineState &) {});
+        }
+        simulator.setIgnorePrivilege(true);
+    }
+
+    std::ostringstream output;
+    lc3::StreamPrinter printer;
+    DelayedInputter inputter;
+    lc3::sim simulator;
+};
+
+// Everything about a machine that a batched run must leave exactly as a run one instruction at a time would.
+struct Snapshot
+{
+    bool result;
+    std::string output;
+    std::vector<uint16_t> regs;
+    uint16_t pc;
+    std::vector<uint16_t> memory;
+    uint64_t inst_count;
+    bool exceeded_inst_limit;
+    bool stopped_at_inst_limit;
+
+    Snapshot(Machine & machine, bool result) : result(result), output(machine.output.str())
+    {
+        lc3::sim & simulator = machine.simulator;
+        for(uint16_t i = 0; i < 8; i += 1) {
+            regs.push_back(simulator.getReg(i));
+        }
+        pc = simulator.getPC();
+        for(uint32_t addr = 0; addr < (1 << 16); addr += 1) {
+            memory.push_back(simulator.getMem(static_cast<uint16_t>(addr)));
+        }
+        inst_count = simulator.getInstExecCount();
+        exceeded_inst_limit = simulator.didExceedInstLimit();
+        stopped_at_inst_limit = simulator.didStopAtInstLimit();
+    }
+};
+
+static bool operator==(Snapshot const & a, Snapshot const & b)
+{
+    return a.result == b.result && a.output == b.output && a.regs == b.regs && a.pc == b.pc && a.memory == b.memory
+        && a.inst_count == b.inst_count && a.exceeded_inst_limit == b.exceeded_inst_limit
+        && a.stopped_at_inst_limit == b.stopped_at_inst_limit;
+}
+
+using Runner = std::function<bool(lc3::sim &)>;
+
+// Loads the program into a batched machine and one that runs an instruction at a time, makes the same sequence of
+// calls on both, and checks that they agree after each call. Returns the snapshots of the batched machine.
+static std::vector<Snapshot> compareRuns(std::string const & obj_filename, uint16_t mode, bool enable_interrupt,
+    std::string const & input, uint64_t delay, std::function<void(lc3::sim &)> const & setup,
+    std::vector<Runner> const & runners)
+{
+    Machine batched(true, input, delay);
+    Machine stepped(false, input, delay);
+    std::vector<Snapshot> snapshots;
+    for(Machine * machine : {&batched, &stepped}) {
+        CHECK(machine->simulator.loadObjFile(obj_filename));
+        machine->simulator.setMem(0x3100, mode);
+        machine->simulator.setMem(0x3101, enable_interrupt ? 1 : 0);
+        if(setup) {
+            setup(machine->simulator);
+        }
+    }
+
+    for(Runner const & runner : runners) {
+        bool batched_result = runner(batched.simulator);
+        bool stepped_result = runner(stepped.simulator);
+        Snapshot batched_snapshot(batched, batched_result);
+        Snapshot stepped_snapshot(stepped, stepped_result);
+        if(! (batched_snapshot == stepped_snapshot)) {
+            std::cerr << "batched run stopped at PC " << batched_snapshot.pc << " after "
+                      << batched_snapshot.inst_count << " instructions, run one at a time at PC "
+                      << stepped_snapshot.pc << " after " << stepped_snapshot.inst_count << "\n";
+            CHECK(false);
+        }
+        snapshots.push_back(batched_snapshot);
+    }
+    return snapshots;
+}
+
+static Runner runWithLimit(uint64_t inst_limit)
+{
+    return [inst_limit](lc3::sim & simulator) {
+        simulator.setRunInstLimit(inst_limit);
+        return simulator.run();
+    };
+}
+
+static void testInstLimit(std::string const & obj_filename)
+{
+    // on either side of a whole batch, and of the HALT
+    for(uint64_t inst_limit : {1, 4095, 4096, 4097, 8192, 8193, 15005, 15006, 15007}) {
+        std::vector<Snapshot> snapshots = compareRuns(obj_filename, 0, false, "", 0, nullptr,
+            {runWithLimit(inst_limit), runWithLimit(inst_limit), runWithLimit(0)});
+        CHECK(snapshots[0].inst_count == inst_limit);
+        // even the last limit stops the machine partway through the HALT routine
+        CHECK(snapshots[0].stopped_at_inst_limit);
+        CHECK(snapshots[2].output.find("Halting") != std::string::npos);
+    }
+}
+
+static void testBreakpoint(std::string const & obj_filename)
+{
+    auto setup = [](lc3::sim & simulator) { simulator.setBreakpoint(LOOP_ADDR); };
+    std::vector<Snapshot> snapshots = compareRuns(obj_filename, 0, false, "", 0, setup,
+        {runWithLimit(0), runWithLimit(0), runWithLimit(0)});
+    CHECK(snapshots[0].pc == LOOP_ADDR && snapshots[0].inst_count == 3);
+    CHECK(snapshots[2].pc == LOOP_ADDR && snapshots[2].inst_count == 9);
+
+    // a breakpoint past the end of a batch that a limit cuts short
+    auto late_setup = [](lc3::sim & simulator) { simulator.setBreakpoint(HALT_ADDR); };
+    snapshots = compareRuns(obj_filename, 0, false, "", 0, late_setup, {runWithLimit(5000), runWithLimit(0)});
+    CHECK(snapshots[1].pc == HALT_ADDR && snapshots[1].inst_count == INST_COUNT_TO_HALT);
+}
+
+static void testRunUntilHalt(std::string const & obj_filename)
+{
+    Runner until_halt = [](lc3::sim & simulator) { return simulator.runUntilHalt(); };
+    std::vector<Snapshot> snapshots = compareRuns(obj_filename, 0, false, "", 0, nullptr, {until_halt});
+    CHECK(snapshots[0].pc == HALT_ADDR && snapshots[0].memory[HALT_ADDR] == 0xf025);
+    CHECK(snapshots[0].inst_count == INST_COUNT_TO_HALT);
+    CHECK(snapshots[0].output.find("Halting") == std::string::npos);
+
+    // reaching the HALT on the last allowed instruction is not stopping at the limit
+    Runner limited_until_halt = [](lc3::sim & simulator) {
+        simulator.setRunInstLimit(INST_COUNT_TO_HALT);
+        return simulator.runUntilHalt();
+    };
+    snapshots = compareRuns(obj_filename, 0, false, "", 0, nullptr, {limited_until_halt});
+    CHECK(snapshots[0].pc == HALT_ADDR && ! snapshots[0].stopped_at_inst_limit);
+}
+
+static void testInterrupt(std::string const & obj_filename)
+{
+    // keys that arrive in the middle of a batch
+    std::vector<Snapshot> snapshots = compareRuns(obj_filename, 0, true, "ab", 3000, nullptr, {runWithLimit(0)});
+    CHECK(snapshots[0].regs[4] == 2 && snapshots[0].memory[0x3022] == 'b');
+
+    // a limit that runs out right at, or right after, the interrupt
+    for(uint64_t inst_limit : {3004, 3005, 3006, 3007}) {
+        compareRuns(obj_filename, 0, true, "ab", 3000, nullptr,
+            {runWithLimit(inst_limit), runWithLimit(inst_limit), runWithLimit(0)});
+    }
+}
+
+static void testException(std::string const & obj_filename)
+{
+    // an illegal opcode is handled by the OS, which halts the machine
+    std::vector<Snapshot> snapshots = compareRuns(obj_filename, 1, false, "", 0, nullptr, {runWithLimit(0)});
+    CHECK(snapshots[0].output.find("Illegal opcode") != std::string::npos);
+    CHECK(snapshots[0].output.find("Halting") != std::string::npos);
+
+    // a triple fault ends the run partway through a batch
+    snapshots = compareRuns(obj_filename, 2, false, "", 0, nullptr, {runWithLimit(0)});
+    CHECK(! snapshots[0].result);
+    CHECK(snapshots[0].inst_count > INST_COUNT_TO_HALT);
+}
+
+int main(void)
+{
+    lc3::StreamPrinter printer(std::cerr);
+    lc3::as assembler(printer, 0, false, false);
+    lc3::optional<std::string> obj_filename;
+    if(writeFile("count.asm", count_asm)) {
+        obj_filename = assembler.assemble("count.asm");
+    }
+    if(! obj_filename) {
+        std::cerr << "could not assemble count.asm\n";
+        return 1;
+    }
+
+    testInstLimit(*obj_filename);
+    testBreakpoint(*obj_filename);
+    testRunUntilHalt(*obj_filename);
+    testInterrupt(*obj_filename);
+    testException(*obj_filename);
+
+    return checkResult();
+}
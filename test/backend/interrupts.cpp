@@ -0,0 +1,292 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "device_regs.h"
+#include "interface.h"
+#include "stream_printer.h"
+
+// Installs a keyboard and a timer ISR, each of which appends a record to the log at x3110 (the key, or 'T') and keeps
+// the PSR it ran with. It then raises the PSR priority to the value at x3100 (already shifted into PSR[10:8]),
+// enables keyboard interrupts, and, if x3101 is set, enables timer interrupts and marks the timer as expired. After
+// waiting a while it keeps the length of the log at x3108, drops the priority back to 0, and waits again before
+// halting. Both ISRs leave every register but R5, the end of the log, as they found it.
+static char const * interrupts_asm =
+    ".ORIG x3000\n"
+    "LEA R0, KB_ISR\n"
+    "STI R0, KB_VECTOR\n"
+    "LEA R0, TIMER_ISR\n"
+    "STI R0, TIMER_VECTOR\n"
+    "LD R5, LOG\n"
+    "LDI R1, PRIORITY_PTR\n"
+    "LD R0, USER_MODE\n"
+    "ADD R0, R0, R1\n"
+    "STI R0, PSR_PTR\n"
+    "LD R0, IE\n"
+    "STI R0, KBSR_PTR\n"
+    "LDI R0, TIMER_FLAG_PTR\n"
+    "BRz WAIT\n"
+    "LD R0, IE\n"
+    "STI R0, TCR_PTR\n"
+    "LD R0, EXPIRED\n"
+    "STI R0, TSR_PTR\n"
+    "WAIT LD R1, DELAY\n"
+    "WAIT_LOOP ADD R1, R1, #-1\n"
+    "BRp WAIT_LOOP\n"
+    "LD R0, LOG\n"
+    "NOT R0, R0\n"
+    "ADD R0, R0, #1\n"
+    "ADD R0, R5, R0\n"
+    "STI R0, MASKED_COUNT_PTR\n"
+    "LD R0, USER_MODE\n"
+    "STI R0, PSR_PTR\n"
+    "LD R1, DELAY\n"
+    "DRAIN_LOOP ADD R1, R1, #-1\n"
+    "BRp DRAIN_LOOP\n"
+    "HALT\n"
+    "KB_ISR ST R0, KB_SAVED_R0\n"
+    "LDI R0, PSR_PTR\n"
+    "STI R0, KB_PSR_PTR\n"
+    "LDI R0, KBDR_PTR\n"
+    "STR R0, R5, #0\n"
+    "ADD R5, R5, #1\n"
+    "LD R0, KB_SAVED_R0\n"
+    "RTI\n"
+    "TIMER_ISR ST R0, TIMER_SAVED_R0\n"
+    "LDI R0, PSR_PTR\n"
+    "STI R0, TIMER_PSR_PTR\n"
+    "AND R0, R0, #0\n"
+    "STI R0, TSR_PTR\n"
+    "LD R0, TIMER_MARK\n"
+    "STR R0, R5, #0\n"
+    "ADD R5, R5, #1\n"
+    "LD R0, TIMER_SAVED_R0\n"
+    "RTI\n"
+    "KB_VECTOR .FILL x0180\n"
+    "TIMER_VECTOR .FILL x0181\n"
+    "PSR_PTR .FILL xFFFC\n"
+    "KBSR_PTR .FILL xFE00\n"
+    "KBDR_PTR .FILL xFE02\n"
+    "TCR_PTR .FILL xFE08\n"
+    "TSR_PTR .FILL xFE0C\n"
+    "PRIORITY_PTR .FILL x3100\n"
+    "TIMER_FLAG_PTR .FILL x3101\n"
+    "MASKED_COUNT_PTR .FILL x3108\n"
+    "KB_PSR_PTR .FILL x3109\n"
+    "TIMER_PSR_PTR .FILL x310A\n"
+    "LOG .FILL x3110\n"
+    "USER_MODE .FILL x8000\n"
+    "IE .FILL x4000\n"
+    "EXPIRED .FILL x8000\n"
+    "DELAY .FILL #100\n"
+    "TIMER_MARK .FILL x54\n"
+    "KB_SAVED_R0 .BLKW #1\n"
+    "TIMER_SAVED_R0 .BLKW #1\n"
+    ".END\n";
+
+// Starts the timer with the interval at x3100 and its interrupt enabled, then counts down from 1000 before halting.
+// The ISR counts the expiries in R4 and acknowledges each one by clearing TSR.
+static char const * timer_asm =
+    ".ORIG x3000\n"
+    "LEA R0, TIMER_ISR\n"
+    "STI R0, TIMER_VECTOR\n"
+    "LDI R0, INTERVAL_PTR\n"
+    "STI R0, TIR_PTR\n"
+    "LD R0, ENABLE\n"
+    "STI R0, TCR_PTR\n"
+    "LD R1, COUNT\n"
+    "LOOP ADD R1, R1, #-1\n"
+    "BRp LOOP\n"
+    "HALT\n"
+    "TIMER_ISR ST R0, SAVED_R0\n"
+    "AND R0, R0, #0\n"
+    "STI R0, TSR_PTR\n"
+    "ADD R4, R4, #1\n"
+    "LD R0, SAVED_R0\n"
+    "RTI\n"
+    "TIMER_VECTOR .FILL x0181\n"
+    "TCR_PTR .FILL xFE08\n"
+    "TIR_PTR .FILL xFE0A\n"
+    "TSR_PTR .FILL xFE0C\n"
+    "INTERVAL_PTR .FILL x3100\n"
+    "ENABLE .FILL xC000\n"
+    "COUNT .FILL #1000\n"
+    "SAVED_R0 .BLKW #1\n"
+    ".END\n";
+
+static constexpr uint16_t PRIORITY_ADDR = 0x3100;
+static constexpr uint16_t TIMER_FLAG_ADDR = 0x3101;
+static constexpr uint16_t MASKED_COUNT_ADDR = 0x3108;
+static constexpr uint16_t KB_PSR_ADDR = 0x3109;
+static constexpr uint16_t TIMER_PSR_ADDR = 0x310A;
+static constexpr uint16_t LOG_ADDR = 0x3110;
+
+struct Machine
+{
+    Machine(void) : printer(output), simulator(printer, inputter, false, 1, false)
+    {
+        // the program sets up the interrupt vectors, devices and PSR itself
+        simulator.setIgnorePrivilege(true);
+        // An ISR that is preempted before its first instruction never gets to log anything, so the order in which
+        // the ISRs are entered is kept separately.
+        simulator.registerInterruptEnterCallback([this](lc3::core::MachineState & state) {
+            entered += state.pc == simulator.getMem(INTEX_TABLE_START + KBD_INT_VECTOR) ? 'k' : 'T';
+        });
+    }
+
+    std::ostringstream output;
+    lc3::StreamPrinter printer;
+    lc3::utils::NullInputter inputter;
+    lc3::sim simulator;
+    std::string entered;
+};
+
+// Runs the program with the given priority during the first wait, and the key scheduled to arrive during it.
+static std::string runInterrupts(std::string const & obj_filename, Machine & machine, uint16_t priority,
+    bool raise_timer)
+{
+    lc3::sim & simulator = machine.simulator;
+    CHECK(simulator.loadObjFile(obj_filename));
+    simulator.setMem(PRIORITY_ADDR, priority << 8);
+    simulator.setMem(TIMER_FLAG_ADDR, raise_timer ? 1 : 0);
+    simulator.scheduleInput(30, "k");
+    CHECK(simulator.run());
+    CHECK(machine.output.str().find("Halting") != std::string::npos);
+
+    std::string log;
+    for(uint16_t addr = LOG_ADDR; simulator.getMem(addr) != 0; addr += 1) {
+        log += static_cast<char>(simulator.getMem(addr));
+    }
+    return log;
+}
+
+static void testKeyboardInterrupt(std::string const & obj_filename)
+{
+    Machine machine;
+    std::string log = runInterrupts(obj_filename, machine, 0, false);
+    lc3::sim & simulator = machine.simulator;
+    CHECK(log == "k" && machine.entered == "k");
+    CHECK(simulator.getMem(MASKED_COUNT_ADDR) == 1);
+    // the ISR runs in supervisor mode at the keyboard's priority, and reading KBDR acknowledges the key
+    CHECK((simulator.getMem(KB_PSR_ADDR) & 0x8700) == (KBD_INT_PRIORITY << 8));
+    CHECK((simulator.getMem(KBSR) & 0x8000) == 0);
+    // and RTI returns to the program, which still has the end of the log
+    CHECK(simulator.getReg(5) == LOG_ADDR + 1);
+}
+
+static void testPriorityMasking(std::string const & obj_filename)
+{
+    for(uint16_t priority = 0; priority < 8; priority += 1) {
+        Machine machine;
+        std::string log = runInterrupts(obj_filename, machine, priority, false);
+        // a masked key is held until the priority drops
+        CHECK(log == "k");
+        uint16_t expected_count = priority < KBD_INT_PRIORITY ? 1 : 0;
+        if(machine.simulator.getMem(MASKED_COUNT_ADDR) != expected_count) {
+            std::cerr << "at priority " << priority << ", " << machine.simulator.getMem(MASKED_COUNT_ADDR)
+                      << " interrupts were taken instead of " << expected_count << "\n";
+            CHECK(false);
+        }
+    }
+}
+
+static void testInterruptPriority(std::string const & obj_filename)
+{
+    // Both are pending once the priority drops, and the timer goes first. The keyboard stays masked while the timer
+    // ISR runs at the timer's priority.
+    Machine both_masked;
+    CHECK(runInterrupts(obj_filename, both_masked, 7, true) == "Tk");
+    CHECK(both_masked.entered == "Tk");
+    CHECK(both_masked.simulator.getMem(MASKED_COUNT_ADDR) == 0);
+    CHECK((both_masked.simulator.getMem(TIMER_PSR_ADDR) & 0x8700) == (TIMER_INT_PRIORITY << 8));
+    CHECK((both_masked.simulator.getMem(KB_PSR_ADDR) & 0x8700) == (KBD_INT_PRIORITY << 8));
+
+    // between the two priorities, only the keyboard waits
+    Machine keyboard_masked;
+    CHECK(runInterrupts(obj_filename, keyboard_masked, 5, true) == "Tk");
+    CHECK(keyboard_masked.simulator.getMem(MASKED_COUNT_ADDR) == 1);
+
+    // and at 6, both do
+    Machine timer_masked;
+    CHECK(runInterrupts(obj_filename, timer_masked, 6, true) == "Tk");
+    CHECK(timer_masked.entered == "Tk");
+    CHECK(timer_masked.simulator.getMem(MASKED_COUNT_ADDR) == 0);
+}
+
+static void testTimer(std::string const & obj_filename)
+{
+    for(uint16_t interval : {50, 100, 333}) {
+        // A post-instruction callback keeps the machine from batching, so that the instruction count is up to date
+        // when each ISR is entered. A batched run must take its interrupts at the same points.
+        Machine machine;
+        std::vector<uint64_t> entries;
+        machine.simulator.registerPostInstructionCallback([](lc3::core::MachineState &) {});
+        machine.simulator.registerInterruptEnterCallback([&machine, &entries](lc3::core::MachineState &) {
+            entries.push_back(machine.simulator.getInstExecCount());
+        });
+        CHECK(machine.simulator.loadObjFile(obj_filename));
+        machine.simulator.setMem(0x3100, interval);
+        CHECK(machine.simulator.run());
+
+        Machine batched;
+        CHECK(batched.simulator.loadObjFile(obj_filename));
+        batched.simulator.setMem(0x3100, interval);
+        CHECK(batched.simulator.run());
+
+        // at least one expiry per interval of the 2000-instruction count down, each one handled before the next
+        CHECK(entries.size() >= 2000u / interval);
+        CHECK(machine.simulator.getReg(4) == entries.size());
+        CHECK(batched.simulator.getReg(4) == entries.size());
+        CHECK(batched.simulator.getInstExecCount() == machine.simulator.getInstExecCount());
+        // the ISR acknowledged the last expiry
+        CHECK((machine.simulator.getMem(TSR) & 0x8000) == 0);
+
+        // The timer counts from the instruction that writes TCR, which is the sixth, and then expires every interval,
+        // with the ISR entry counting as an instruction.
+        for(std::size_t i = 0; i < entries.size(); i += 1) {
+            uint64_t expected = 5 + interval * (i + 1);
+            if(entries[i] != expected) {
+                std::cerr << "timer interrupt " << i << " (interval " << interval << ") taken after " << entries[i]
+                          << " instructions instead of " << expected << "\n";
+                CHECK(false);
+                break;
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    lc3::StreamPrinter printer(std::cerr);
+    lc3::as assembler(printer, 0, false, false);
+    lc3::optional<std::string> obj_filename;
+    if(writeFile("interrupts.asm", interrupts_asm)) {
+        obj_filename = assembler.assemble("interrupts.asm");
+    }
+    if(! obj_filename) {
+        std::cerr << "could not assemble interrupts.asm\n";
+        return 1;
+    }
+
+    testKeyboardInterrupt(*obj_filename);
+    testPriorityMasking(*obj_filename);
+    testInterruptPriority(*obj_filename);
+
+    lc3::optional<std::string> timer_obj_filename;
+    if(writeFile("timer.asm", timer_asm)) {
+        timer_obj_filename = assembler.assemble("timer.asm");
+    }
+    if(! timer_obj_filename) {
+        std::cerr << "could not assemble timer.asm\n";
+        return 1;
+    }
+
+    testTimer(*timer_obj_filename);
+
+    return checkResult();
+}
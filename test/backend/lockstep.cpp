@@ -0,0 +1,344 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "interface.h"
+#include "lockstep.h"
+#include "stream_printer.h"
+
+// Counts the Collatz steps from the value at x3100, keeping the last 16 values at x4000, and prints the count and a
+// message. The mode at x3101 then picks how the program ends: 0 halts, 1 writes to supervisor memory, 2 executes an
+// illegal opcode, 3 spins forever, and 4 echoes a key before halting.
+static char const * collatz_asm =
+    ".ORIG x3000\n"
+    "LDI R1, VALUE_PTR\n"
+    "AND R3, R3, #0\n"
+    "LOOP ADD R4, R1, #-1\n"
+    "BRnz DONE\n"
+    "AND R4, R1, #1\n"
+    "BRz EVEN\n"
+    "ADD R4, R1, R1\n"
+    "ADD R1, R4, R1\n"
+    "ADD R1, R1, #1\n"
+    "BRnzp NEXT\n"
+    "EVEN JSR HALVE\n"
+    "NEXT ADD R3, R3, #1\n"
+    "AND R5, R3, #15\n"
+    "LD R4, ARRAY\n"
+    "ADD R5, R5, R4\n"
+    "STR R1, R5, #0\n"
+    "BRnzp LOOP\n"
+    "DONE LD R0, ZERO\n"
+    "ADD R0, R0, R3\n"
+    "OUT\n"
+    "LEA R0, MSG\n"
+    "PUTS\n"
+    "LDI R2, MODE_PTR\n"
+    "BRz FIN\n"
+    "ADD R2, R2, #-1\n"
+    "BRz ACV\n"
+    "ADD R2, R2, #-1\n"
+    "BRz ILLEGAL\n"
+    "ADD R2, R2, #-1\n"
+    "BRz SPIN\n"
+    "GETC\n"
+    "OUT\n"
+    "FIN HALT\n"
+    "ACV AND R0, R0, #0\n"
+    "STR R0, R0, #0\n"
+    "HALT\n"
+    "ILLEGAL .FILL xD000\n"
+    "SPIN BRnzp SPIN\n"
+    "HALVE AND R4, R4, #0\n"
+    "HALVE_LOOP ADD R1, R1, #-2\n"
+    "BRn HALVE_DONE\n"
+    "ADD R4, R4, #1\n"
+    "BRnzp HALVE_LOOP\n"
+    "HALVE_DONE ADD R1, R4, #0\n"
+    "RET\n"
+    "VALUE_PTR .FILL x3100\n"
+    "MODE_PTR .FILL x3101\n"
+    "ARRAY .FILL x4000\n"
+    "ZERO .FILL x30\n"
+    "MSG .STRINGZ \" steps\\n\"\n"
+    ".END\n";
+
+class TextInputter : public lc3::utils::IInputter
+{
+public:
+    TextInputter(std::string const & text) : text(text) {}
+
+    virtual void beginInput(void) override {}
+    virtual bool getChar(char & c) override
+    {
+        if(pos == text.size()) { return false; }
+        c = text[pos];
+        pos += 1;
+        return true;
+    }
+    virtual void endInput(void) override {}
+
+private:
+    std::string text;
+    std::size_t pos = 0;
+};
+
+struct Machine
+{
+    Machine(std::string const & input) : printer(output), inputter(input), simulator(printer, inputter, false, 1, false)
+    {}
+
+    std::ostringstream output;
+    lc3::StreamPrinter printer;
+    TextInputter inputter;
+    lc3::sim simulator;
+};
+
+// How a lane is set up before its run.
+struct LaneConfig
+{
+    uint16_t value;
+    uint16_t mode;
+    uint64_t inst_limit = 0;
+    uint64_t max_output_count = 0;
+    // 0 leaves the machine as it starts out.
+    uint64_t seed = 0;
+    std::string input;
+    // Keeps the machine out of lockstep.
+    bool detect_loops = false;
+
+    LaneConfig(uint16_t value, uint16_t mode) : value(value), mode(mode) {}
+};
+
+// Everything about a machine that a run in lockstep must leave exactly as a run on its own would.
+struct Snapshot
+{
+    bool result = false;
+    std::vector<uint16_t> regs;
+    uint16_t pc = 0;
+    std::vector<uint16_t> memory;
+    uint64_t inst_count = 0;
+    std::string output;
+    bool exceeded_inst_limit = false;
+    bool stopped_at_inst_limit = false;
+    bool exceeded_max_output = false;
+
+    Snapshot(void) = default;
+    Snapshot(Machine & machine, bool result) : result(result)
+    {
+        lc3::sim & simulator = machine.simulator;
+        for(uint16_t i = 0; i < 8; i += 1) {
+            regs.push_back(simulator.getReg(i));
+        }
+        pc = simulator.getPC();
+        for(uint32_t addr = 0; addr < (1 << 16); addr += 1) {
+            memory.push_back(simulator.getMem(static_cast<uint16_t>(addr)));
+        }
+        inst_count = simulator.getInstExecCount();
+        output = machine.output.str();
+        exceeded_inst_limit = simulator.didExceedInstLimit();
+        stopped_at_inst_limit = simulator.didStopAtInstLimit();
+        exceeded_max_output = simulator.didExceedMaxOutputCount();
+    }
+
+    bool operator==(Snapshot const & other) const
+    {
+        return result == other.result && regs == other.regs && pc == other.pc && memory == other.memory
+            && inst_count == other.inst_count && output == other.output
+            && exceeded_inst_limit == other.exceeded_inst_limit
+            && stopped_at_inst_limit == other.stopped_at_inst_limit
+            && exceeded_max_output == other.exceeded_max_output;
+    }
+};
+
+enum class RunType { RUN, UNTIL_HALT, UNTIL_INPUT };
+
+static std::unique_ptr<Machine> makeMachine(std::string const & obj_filename, LaneConfig const & config)
+{
+    std::unique_ptr<Machine> machine(new Machine(config.input));
+    lc3::sim & simulator = machine->simulator;
+    if(config.seed != 0) {
+        simulator.randomize(config.seed);
+    }
+    CHECK(simulator.loadObjFile(obj_filename));
+    simulator.setMem(0x3100, config.value);
+    simulator.setMem(0x3101, config.mode);
+    simulator.setRunInstLimit(config.inst_limit);
+    simulator.setMaxOutputCount(config.max_output_count);
+    simulator.setLoopDetection(config.detect_loops);
+    return machine;
+}
+
+static bool runAlone(lc3::sim & simulator, RunType run_type)
+{
+    switch(run_type) {
+        case RunType::RUN: return simulator.run();
+        case RunType::UNTIL_HALT: return simulator.runUntilHalt();
+        default: return simulator.runUntilInputPoll();
+    }
+}
+
+static Snapshot runIndependently(std::string const & obj_filename, LaneConfig const & config, RunType run_type)
+{
+    std::unique_ptr<Machine> machine = makeMachine(obj_filename, config);
+    bool result = runAlone(machine->simulator, run_type);
+    return Snapshot(*machine, result);
+}
+
+// Runs every lane in lockstep, a few lanes at a time, and checks each one against a run of the same machine on its
+// own.
+static void checkLanes(std::string const & obj_filename, std::vector<LaneConfig> const & configs, RunType run_type,
+    uint64_t expected_scalar_run_count)
+{
+    std::vector<std::unique_ptr<Machine>> machines;
+    std::vector<lc3::sim *> sims;
+    for(LaneConfig const & config : configs) {
+        machines.push_back(makeMachine(obj_filename, config));
+        sims.push_back(&machines.back()->simulator);
+    }
+
+    lc3::lockstep_sim lockstep(4);
+    std::vector<bool> results;
+    if(run_type == RunType::RUN) {
+        results = lockstep.run(sims);
+    } else if(run_type == RunType::UNTIL_HALT) {
+        results = lockstep.runUntilHalt(sims);
+    } else {
+        results = lockstep.runUntilInputPoll(sims);
+    }
+    CHECK(results.size() == configs.size());
+    CHECK(lockstep.getScalarRunCount() == expected_scalar_run_count);
+
+    for(uint32_t i = 0; i < configs.size() && i < results.size(); i += 1) {
+        Snapshot expected = runIndependently(obj_filename, configs[i], run_type);
+        if(! (Snapshot(*machines[i], results[i]) == expected)) {
+            std::cerr << "lane " << i << " differs from an independent run\n";
+            CHECK(false);
+        }
+    }
+}
+
+static std::vector<LaneConfig> getLaneConfigs(std::string const & obj_filename)
+{
+    std::vector<LaneConfig> configs = {
+        LaneConfig(1, 0), LaneConfig(6, 0), LaneConfig(7, 0), LaneConfig(27, 0), LaneConfig(9, 1),
+        LaneConfig(12, 2), LaneConfig(3, 3), LaneConfig(25, 0), LaneConfig(27, 0), LaneConfig(7, 0),
+        LaneConfig(6, 0), LaneConfig(5, 4), LaneConfig(9, 0)
+    };
+    configs[6].inst_limit = 5000;
+    configs[7].inst_limit = 50;
+    configs[8].max_output_count = 3;
+    configs[9].seed = 1234;
+    configs[10].seed = 99;
+    configs[11].input = "k";
+    configs[11].inst_limit = 5000;
+    configs[12].detect_loops = true;
+
+    // Limits of exactly the instructions a lane needs to halt, and one fewer.
+    Snapshot full = runIndependently(obj_filename, LaneConfig(6, 0), RunType::UNTIL_HALT);
+    CHECK(full.result && full.inst_count > 1);
+    configs.push_back(LaneConfig(6, 0));
+    configs.back().inst_limit = full.inst_count;
+    configs.push_back(LaneConfig(6, 0));
+    configs.back().inst_limit = full.inst_count - 1;
+    return configs;
+}
+
+static void testLanes(std::string const & obj_filename)
+{
+    std::vector<LaneConfig> configs = getLaneConfigs(obj_filename);
+    checkLanes(obj_filename, configs, RunType::UNTIL_HALT, 1);
+    checkLanes(obj_filename, configs, RunType::RUN, 1);
+
+    // Lanes that read a key stop at the poll, with or without a key waiting.
+    std::vector<LaneConfig> input_configs = {LaneConfig(5, 4), LaneConfig(7, 4), LaneConfig(6, 0)};
+    input_configs[1].input = "q";
+    checkLanes(obj_filename, input_configs, RunType::UNTIL_INPUT, 0);
+}
+
+// A member of a group runs a few values one after another on the same machine, as a grader test case does.
+static void runMember(Machine & machine, uint32_t member, std::vector<Snapshot> & snapshots)
+{
+    lc3::sim & simulator = machine.simulator;
+    for(uint16_t round = 0; round < 4; round += 1) {
+        simulator.setPC(0x3000);
+        simulator.setMem(0x3100, static_cast<uint16_t>(member * 5 + round + 2));
+        simulator.setMem(0x3101, member == 3 ? 4 : 0);
+        if(member == 3) {
+            // scheduled input keeps this member out of lockstep
+            simulator.scheduleInput(10, std::string(1, static_cast<char>('a' + round)));
+        }
+        simulator.setRunInstLimit(member == 1 && round == 2 ? 30 : 0);
+        bool result = simulator.runUntilHalt();
+        snapshots.push_back(Snapshot(machine, result));
+    }
+}
+
+static void testGroup(std::string const & obj_filename)
+{
+    uint32_t const member_count = 5;
+    uint32_t const running_member_count = 4;
+
+    std::vector<std::vector<Snapshot>> expected(member_count);
+    for(uint32_t member = 0; member < running_member_count; member += 1) {
+        std::unique_ptr<Machine> machine = makeMachine(obj_filename, LaneConfig(0, 0));
+        runMember(*machine, member, expected[member]);
+    }
+
+    std::vector<std::vector<Snapshot>> actual(member_count);
+    lc3::lockstep_group group(member_count, 2);
+    std::vector<std::thread> threads;
+    for(uint32_t member = 0; member < member_count; member += 1) {
+        threads.emplace_back([&, member]() {
+            if(member >= running_member_count) {
+                // nothing to run
+                group.leave();
+                return;
+            }
+            std::unique_ptr<Machine> machine = makeMachine(obj_filename, LaneConfig(0, 0));
+            machine->simulator.setLockstepGroup(&group);
+            runMember(*machine, member, actual[member]);
+        });
+    }
+    for(std::thread & thread : threads) {
+        thread.join();
+    }
+
+    for(uint32_t member = 0; member < member_count; member += 1) {
+        CHECK(actual[member].size() == expected[member].size());
+        for(uint32_t round = 0; round < actual[member].size() && round < expected[member].size(); round += 1) {
+            if(! (actual[member][round] == expected[member][round])) {
+                std::cerr << "member " << member << " differs from an independent run in round " << round << "\n";
+                CHECK(false);
+            }
+        }
+    }
+    // Only the member with scheduled input runs on its own.
+    CHECK(group.getScalarRunCount() == 4);
+}
+
+int main(void)
+{
+    lc3::StreamPrinter printer(std::cerr);
+    lc3::as assembler(printer, 0, false, false);
+    lc3::optional<std::string> obj_filename;
+    if(writeFile("collatz.asm", collatz_asm)) {
+        obj_filename = assembler.assemble("collatz.asm");
+    }
+    if(! obj_filename) {
+        std::cerr << "could not assemble collatz.asm\n";
+        return 1;
+    }
+
+    testLanes(*obj_filename);
+    testGroup(*obj_filename);
+
+    return checkResult();
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "check.h"
+#include "interface.h"
+#include "stream_printer.h"
+
+struct RunResult
+{
+    bool success = false;
+    bool detected_loop = false;
+    uint64_t inst_count = 0;
+    std::string output;
+};
+
+// Assembles source, then runs it until it halts with loop detection on. inst_limit is only a backstop, so that a loop
+// that is missed fails the test instead of hanging it.
+static RunResult runProgram(std::string const & name, std::string const & source, uint64_t inst_limit,
+    std::string const & input = "", uint64_t input_delay = 0)
+{
+    RunResult result;
+
+    lc3::StreamPrinter asm_printer(std::cerr);
+    lc3::as assembler(asm_printer, 0, false, false);
+    lc3::optional<std::string> obj_filename;
+    if(writeFile(name + ".asm", source)) {
+        obj_filename = assembler.assemble(name + ".asm");
+    }
+    CHECK(obj_filename);
+    if(! obj_filename) {
+        return result;
+    }
+
+    std::ostringstream output;
+    lc3::StreamPrinter printer(output);
+    lc3::utils::NullInputter inputter;
+    lc3::sim simulator(printer, inputter, false, 1, false);
+    simulator.setIgnorePrivilege(true);
+    simulator.setLoopDetection(true);
+    CHECK(simulator.loadObjFile(*obj_filename));
+    if(! input.empty()) {
+        simulator.scheduleInput(input_delay, input);
+    }
+    simulator.setRunInstLimit(inst_limit);
+    result.success = simulator.runUntilHalt();
+    result.detected_loop = simulator.didDetectLoop();
+    result.inst_count = simulator.getInstExecCount();
+    result.output = output.str();
+    return result;
+}
+
+// A branch to itself is caught within a few instructions.
+static void testTightLoop(void)
+{
+    RunResult result = runProgram("tight",
+        ".ORIG x3000\n"
+        "SPIN BRnzp SPIN\n"
+        ".END\n", 1000000);
+    CHECK(result.success && result.detected_loop);
+    CHECK(result.inst_count < 100);
+}
+
+// A loop that only starts after a long countdown is caught soon after it starts, not after a multiple of the
+// countdown.
+static void testLoopAfterCountdown(void)
+{
+    RunResult result = runProgram("countdown_then_spin",
+        ".ORIG x3000\n"
+        "LD R1, COUNT\n"
+        "LOOP ADD R1, R1, #-1\n"
+        "BRp LOOP\n"
+        "SPIN BRnzp SPIN\n"
+        "COUNT .FILL #20000\n"
+        ".END\n", 1000000);
+    CHECK(result.success && result.detected_loop);
+    CHECK(result.inst_count > 40000 && result.inst_count < 40000 + 2 * lc3::core::MachineState::LOOP_CHECK_WINDOW);
+}
+
+// A long counter loop changes a register every time around, so it is never mistaken for an infinite loop.
+static void testCounterLoopFinishes(void)
+{
+    RunResult result = runProgram("counter",
+        ".ORIG x3000\n"
+        "LD R2, OUTER\n"
+        "OUTER_LOOP LD R1, INNER\n"
+        "INNER_LOOP ADD R1, R1, #-1\n"
+        "BRp INNER_LOOP\n"
+        "ADD R2, R2, #-1\n"
+        "BRp OUTER_LOOP\n"
+        "LEA R0, DONE\n"
+        "PUTS\n"
+        "HALT\n"
+        "OUTER .FILL #4\n"
+        "INNER .FILL #30000\n"
+        "DONE .STRINGZ \"done\"\n"
+        ".END\n", 1000000);
+    CHECK(result.success && ! result.detected_loop);
+    CHECK(result.output == "done");
+}
+
+// An infinite loop whose body is longer than the first checkpoint's window is still caught by the second one.
+static void testLongLoop(void)
+{
+    RunResult result = runProgram("long_loop",
+        ".ORIG x3000\n"
+        "AGAIN LD R1, COUNT\n"
+        "LOOP ADD R1, R1, #-1\n"
+        "BRp LOOP\n"
+        "BRnzp AGAIN\n"
+        "COUNT .FILL #5000\n"
+        ".END\n", 2000000);
+    CHECK(result.success && result.detected_loop);
+    CHECK(result.inst_count < 2000000);
+}
+
+// Polling the keyboard repeats the same state until the key arrives, which must not count as a loop while the input
+// is still to come.
+static void testPendingInput(void)
+{
+    RunResult result = runProgram("poll_keyboard",
+        ".ORIG x3000\n"
+        "WAIT LDI R1, KBSR\n"
+        "BRzp WAIT\n"
+        "LDI R0, KBDR\n"
+        "OUT\n"
+        "HALT\n"
+        "KBSR .FILL xFE00\n"
+        "KBDR .FILL xFE02\n"
+        ".END\n", 1000000, "q", 50000);
+    CHECK(result.success && ! result.detected_loop);
+    CHECK(result.output == "q");
+    CHECK(result.inst_count > 50000);
+}
+
+// Likewise for waiting on a timer that is still running.
+static void testPendingTimer(void)
+{
+    RunResult result = runProgram("poll_timer",
+        ".ORIG x3000\n"
+        "LD R1, INTERVAL\n"
+        "STI R1, TIR\n"
+        "LD R1, ENABLE\n"
+        "STI R1, TCR\n"
+        "WAIT LDI R2, TSR\n"
+        "BRzp WAIT\n"
+        "LEA R0, DONE\n"
+        "PUTS\n"
+        "HALT\n"
+        "INTERVAL .FILL #30000\n"
+        "ENABLE .FILL x8000\n"
+        "TIR .FILL xFE0A\n"
+        "TCR .FILL xFE08\n"
+        "TSR .FILL xFE0C\n"
+        "DONE .STRINGZ \"tick\"\n"
+        ".END\n", 1000000);
+    CHECK(result.success && ! result.detected_loop);
+    CHECK(result.output == "tick");
+    CHECK(result.inst_count > 30000);
+}
+
+int main(void)
+{
+    testTightLoop();
+    testLoopAfterCountdown();
+    testCounterLoopFinishes();
+    testLongLoop();
+    testPendingInput();
+    testPendingTimer();
+    return checkResult();
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "check.h"
+#include "interface.h"
+#include "stream_printer.h"
+
+// Accesses the address at x3100 (x1100 when assembled for supervisor mode) as the kind at x3101 picks: 0 reads it
+// into R3, 1 writes 0 to it, 2 calls it as a subroutine, and 3 has a TRAP x40 handler read it into R3 before reading
+// it as well. It then prints "ok", unless the access violation handler halted the machine first.
+static std::string accessAsm(std::string const & origin, std::string const & addr_ptr, std::string const & kind_ptr)
+{
+    return ".ORIG " + origin + "\n"
+        "LDI R1, ADDR_PTR\n"
+        "LDI R2, KIND_PTR\n"
+        "BRz READ\n"
+        "ADD R2, R2, #-1\n"
+        "BRz WRITE\n"
+        "ADD R2, R2, #-1\n"
+        "BRz EXEC\n"
+        "TRAP x40\n"
+        "READ LDR R3, R1, #0\n"
+        "BRnzp DONE\n"
+        "WRITE STR R2, R1, #0\n"
+        "BRnzp DONE\n"
+        "EXEC JSRR R1\n"
+        "DONE LEA R0, OK\n"
+        "PUTS\n"
+        "HALT\n"
+        "OK .STRINGZ \"ok\\n\"\n"
+        "ADDR_PTR .FILL " + addr_ptr + "\n"
+        "KIND_PTR .FILL " + kind_ptr + "\n"
+        ".END\n";
+}
+
+enum class Access { READ = 0, WRITE, EXEC, TRAP_THEN_READ };
+
+static constexpr uint16_t USER_CONFIG = 0x3100;
+static constexpr uint16_t SUPERVISOR_CONFIG = 0x1100;
+static constexpr uint16_t TRAP_HANDLER = 0x0600;
+static constexpr uint16_t STORED_VALUE = 0x1234;
+
+struct Machine
+{
+    Machine(void) : printer(output), simulator(printer, inputter, false, 1, false) {}
+
+    std::ostringstream output;
+    lc3::StreamPrinter printer;
+    lc3::utils::NullInputter inputter;
+    lc3::sim simulator;
+};
+
+// Runs the program and returns whether the access went through. Anything that is called gets a RET to run, anything
+// that is read holds STORED_VALUE, and TRAP x40 goes to a handler in OS memory that reads the address and returns.
+static bool runAccess(Machine & machine, std::string const & obj_filename, bool supervisor, uint16_t addr,
+    Access access)
+{
+    lc3::sim & simulator = machine.simulator;
+    machine.output.str("");
+    CHECK(simulator.loadObjFile(obj_filename));
+    uint16_t config = supervisor ? SUPERVISOR_CONFIG : USER_CONFIG;
+    simulator.setMem(config, addr);
+    simulator.setMem(config + 1, static_cast<uint16_t>(access));
+    simulator.setMem(addr, access == Access::EXEC ? 0xC1C0 : STORED_VALUE);
+    simulator.setMem(0x0040, TRAP_HANDLER);
+    simulator.setMem(TRAP_HANDLER, 0x6640);        // LDR R3, R1, #0
+    simulator.setMem(TRAP_HANDLER + 1, 0x8000);    // RTI
+    simulator.setReg(3, 0);
+    if(supervisor) {
+        // TRAPs in supervisor mode push onto R6
+        simulator.setReg(6, 0x3000);
+    }
+    simulator.run();
+
+    std::string output = machine.output.str();
+    bool violated = output.find("Access violation") != std::string::npos;
+    bool done = output.find("ok") != std::string::npos;
+    CHECK(violated != done);
+    if(access == Access::READ && done && addr < 0xFE00) {
+        CHECK(simulator.getReg(3) == STORED_VALUE);
+    }
+    return done;
+}
+
+struct Programs
+{
+    std::string user;
+    std::string supervisor;
+};
+
+static void testDefaultAccess(Programs const & programs)
+{
+    Machine machine;
+    // user mode only has x3000 through xFDFF, and the page before x3000 belongs to the OS
+    for(Access access : {Access::READ, Access::WRITE, Access::EXEC}) {
+        CHECK(runAccess(machine, programs.user, false, 0x4000, access));
+        CHECK(runAccess(machine, programs.user, false, 0xFC00, access));
+        CHECK(! runAccess(machine, programs.user, false, 0x0500, access));
+        CHECK(! runAccess(machine, programs.user, false, 0x2FFF, access));
+    }
+    CHECK(! runAccess(machine, programs.user, false, 0xFE04, Access::READ));
+
+    // supervisor mode has everything
+    for(Access access : {Access::READ, Access::WRITE, Access::EXEC}) {
+        CHECK(runAccess(machine, programs.supervisor, true, 0x4000, access));
+        CHECK(runAccess(machine, programs.supervisor, true, 0x0500, access));
+    }
+    CHECK(runAccess(machine, programs.supervisor, true, 0xFE04, Access::READ));
+}
+
+static void testCustomAccess(Programs const & programs)
+{
+    Machine machine;
+    lc3::sim & simulator = machine.simulator;
+
+    // a read-only user region
+    simulator.setUserMemAccess(0x4000, 0x41FF, true, false, false);
+    CHECK(runAccess(machine, programs.user, false, 0x4000, Access::READ));
+    CHECK(! runAccess(machine, programs.user, false, 0x4000, Access::WRITE));
+    CHECK(! runAccess(machine, programs.user, false, 0x4000, Access::EXEC));
+    CHECK(runAccess(machine, programs.user, false, 0x4200, Access::WRITE));
+
+    // access is per 512-word page, so one word takes away the whole page
+    simulator.setUserMemAccess(0x4100, 0x4100, false, false, false);
+    CHECK(! runAccess(machine, programs.user, false, 0x4000, Access::READ));
+
+    // an OS page opened up to user mode
+    simulator.setUserMemAccess(0x0400, 0x05FF, true, true, false);
+    CHECK(runAccess(machine, programs.user, false, 0x0500, Access::READ));
+    CHECK(runAccess(machine, programs.user, false, 0x0500, Access::WRITE));
+    CHECK(! runAccess(machine, programs.user, false, 0x0500, Access::EXEC));
+
+    // and supervisor mode can be restricted as well
+    simulator.setSupervisorMemAccess(0x0400, 0x05FF, true, false, true);
+    CHECK(runAccess(machine, programs.supervisor, true, 0x0500, Access::READ));
+    CHECK(! runAccess(machine, programs.supervisor, true, 0x0500, Access::WRITE));
+    CHECK(runAccess(machine, programs.user, false, 0x0500, Access::WRITE));
+}
+
+static void testModeSwitch(Programs const & programs)
+{
+    Machine machine;
+    lc3::sim & simulator = machine.simulator;
+
+    // The TRAP handler runs in supervisor mode and may read the OS page; once RTI drops back to user mode, the
+    // program may not.
+    CHECK(! runAccess(machine, programs.user, false, 0x0500, Access::TRAP_THEN_READ));
+    CHECK(simulator.getReg(3) == STORED_VALUE);
+
+    // both may read user memory
+    CHECK(runAccess(machine, programs.user, false, 0x4000, Access::TRAP_THEN_READ));
+    CHECK(simulator.getReg(3) == STORED_VALUE);
+}
+
+static void testIgnorePrivilege(Programs const & programs)
+{
+    Machine machine;
+    lc3::sim & simulator = machine.simulator;
+    simulator.setUserMemAccess(0x4000, 0x41FF, false, false, false);
+
+    simulator.setIgnorePrivilege(true);
+    for(Access access : {Access::READ, Access::WRITE, Access::EXEC}) {
+        CHECK(runAccess(machine, programs.user, false, 0x0500, access));
+        CHECK(runAccess(machine, programs.user, false, 0x4000, access));
+    }
+    CHECK(runAccess(machine, programs.user, false, 0xFE04, Access::READ));
+
+    // turning it off brings back both the default and the custom permissions
+    simulator.setIgnorePrivilege(false);
+    for(Access access : {Access::READ, Access::WRITE, Access::EXEC}) {
+        CHECK(! runAccess(machine, programs.user, false, 0x0500, access));
+        CHECK(! runAccess(machine, programs.user, false, 0x4000, access));
+        CHECK(runAccess(machine, programs.user, false, 0x4200, access));
+    }
+}
+
+int main(void)
+{
+    lc3::StreamPrinter printer(std::cerr);
+    lc3::as assembler(printer, 0, false, false);
+    lc3::optional<std::string> user_obj_filename, supervisor_obj_filename;
+    if(writeFile("access_user.asm", accessAsm("x3000", "x3100", "x3101"))) {
+        user_obj_filename = assembler.assemble("access_user.asm");
+    }
+    if(writeFile("access_supervisor.asm", accessAsm("x1000", "x1100", "x1101"))) {
+        supervisor_obj_filename = assembler.assemble("access_supervisor.asm");
+    }
+    if(! user_obj_filename || ! supervisor_obj_filename) {
+        std::cerr << "could not assemble the access programs\n";
+        return 1;
+    }
+
+    Programs programs{*user_obj_filename, *supervisor_obj_filename};
+    testDefaultAccess(programs);
+    testCustomAccess(programs);
+    testModeSwitch(programs);
+    testIgnorePrivilege(programs);
+
+    return checkResult();
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "interface.h"
+#include "stream_printer.h"
+
+// Calls every OS service routine, with strings of different lengths (including an empty one and a packed string with
+// an odd number of characters), and leaves the registers it does not use set, so that anything a routine clobbers
+// shows up.
+static char const * traps_asm =
+    ".ORIG x3000\n"
+    "LD R1, ONE\n"
+    "LD R2, TWO\n"
+    "LD R3, THREE\n"
+    "LD R4, FOUR\n"
+    "LD R5, FIVE\n"
+    "GETC\n"
+    "ST R0, FIRST\n"
+    "OUT\n"
+    "IN\n"
+    "ST R0, SECOND\n"
+    "LEA R0, TEXT\n"
+    "PUTS\n"
+    "LEA R0, EMPTY\n"
+    "PUTS\n"
+    "LEA R0, PACKED_EVEN\n"
+    "PUTSP\n"
+    "LEA R0, PACKED_ODD\n"
+    "PUTSP\n"
+    "GETC\n"
+    "ST R0, THIRD\n"
+    "OUT\n"
+    "HALT\n"
+    "ONE .FILL x1111\n"
+    "TWO .FILL x2222\n"
+    "THREE .FILL x3333\n"
+    "FOUR .FILL x4444\n"
+    "FIVE .FILL x5555\n"
+    "FIRST .BLKW #1\n"
+    "SECOND .BLKW #1\n"
+    "THIRD .BLKW #1\n"
+    "TEXT .STRINGZ \"a string\\n\"\n"
+    "EMPTY .FILL x0000\n"
+    "PACKED_EVEN .FILL x6261\n"
+    ".FILL x6463\n"
+    ".FILL x0000\n"
+    "PACKED_ODD .FILL x6665\n"
+    ".FILL x0067\n"
+    ".FILL x0000\n"
+    ".END\n";
+
+class TextInputter : public lc3::utils::IInputter
+{
+public:
+    TextInputter(std::string const & text) : text(text) {}
+
+    virtual void beginInput(void) override {}
+    virtual bool getChar(char & c) override
+    {
+        if(pos == text.size()) { return false; }
+        c = text[pos];
+        pos += 1;
+        return true;
+    }
+    virtual void endInput(void) override {}
+
+private:
+    std::string text;
+    std::size_t pos = 0;
+};
+
+// The state a run leaves behind, which native TRAPs must leave exactly as the OS routines do.
+struct Snapshot
+{
+    bool result = false;
+    std::string output;
+    std::vector<uint16_t> regs;
+    uint16_t pc = 0;
+    std::vector<uint16_t> memory;
+    uint64_t inst_count = 0;
+};
+
+static Snapshot runTraps(std::string const & obj_filename, bool native_traps, bool native_trap_cost)
+{
+    Snapshot snapshot;
+
+    std::ostringstream output;
+    lc3::StreamPrinter printer(output);
+    // every key is waiting by the time a routine reads it
+    TextInputter inputter("xyz");
+    lc3::sim simulator(printer, inputter, false, 1, false);
+    simulator.setNativeTraps(native_traps);
+    simulator.setNativeTrapCost(native_trap_cost);
+    CHECK(simulator.loadObjFile(obj_filename));
+
+    snapshot.result = simulator.run();
+    snapshot.output = output.str();
+    for(uint16_t i = 0; i < 8; i += 1) {
+        snapshot.regs.push_back(simulator.getReg(i));
+    }
+    snapshot.pc = simulator.getPC();
+    for(uint32_t addr = 0; addr < (1 << 16); addr += 1) {
+        snapshot.memory.push_back(simulator.getMem(static_cast<uint16_t>(addr)));
+    }
+    snapshot.inst_count = simulator.getInstExecCount();
+    return snapshot;
+}
+
+// Reports the first word of memory that differs, which says much more than a failed comparison of all of it.
+static void checkMemory(std::vector<uint16_t> const & actual, std::vector<uint16_t> const & expected)
+{
+    CHECK(actual.size() == expected.size());
+    for(uint32_t addr = 0; addr < actual.size() && addr < expected.size(); addr += 1) {
+        if(actual[addr] != expected[addr]) {
+            std::cerr << "memory differs at address " << addr << ": " << actual[addr] << " instead of "
+                      << expected[addr] << "\n";
+            CHECK(false);
+            break;
+        }
+    }
+}
+
+static void testNativeTraps(std::string const & obj_filename)
+{
+    Snapshot os = runTraps(obj_filename, false, false);
+    CHECK(os.result);
+    CHECK(os.output.find("y\na string\nabcdefgz") != std::string::npos);
+    CHECK(os.output.find("--- Halting the LC-3 ---") != std::string::npos);
+    CHECK(os.memory[0x301B] == 'x' && os.memory[0x301C] == 'y' && os.memory[0x301D] == 'z');
+    // HALT itself uses R0 and R1.
+    CHECK(os.regs[2] == 0x2222 && os.regs[3] == 0x3333 && os.regs[4] == 0x4444 && os.regs[5] == 0x5555);
+
+    // With the cost of each routine counted, nothing tells the two apart.
+    Snapshot costed = runTraps(obj_filename, true, true);
+    CHECK(costed.result == os.result);
+    CHECK(costed.output == os.output);
+    CHECK(costed.regs == os.regs);
+    CHECK(costed.pc == os.pc);
+    checkMemory(costed.memory, os.memory);
+    CHECK(costed.inst_count == os.inst_count);
+
+    // Without it, only the instruction count changes.
+    Snapshot native = runTraps(obj_filename, true, false);
+    CHECK(native.result == os.result);
+    CHECK(native.output == os.output);
+    CHECK(native.regs == os.regs);
+    CHECK(native.pc == os.pc);
+    checkMemory(native.memory, os.memory);
+    CHECK(native.inst_count < os.inst_count);
+}
+
+int main(void)
+{
+    lc3::StreamPrinter printer(std::cerr);
+    lc3::as assembler(printer, 0, false, false);
+    lc3::optional<std::string> obj_filename;
+    if(writeFile("traps.asm", traps_asm)) {
+        obj_filename = assembler.assemble("traps.asm");
+    }
+    if(! obj_filename) {
+        std::cerr << "could not assemble traps.asm\n";
+        return 1;
+    }
+
+    testNativeTraps(*obj_filename);
+
+    return checkResult();
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "interface.h"
+#include "sim_pool.h"
+#include "stream_printer.h"
+
+// Prints the character at CHAR (x3003), which a job can overwrite.
+static char const * print_char_asm =
+    ".ORIG x3000\n"
+    "LD R0, CHAR\n"
+    "OUT\n"
+    "HALT\n"
+    "CHAR .FILL x41\n"
+    ".END\n";
+
+// Counts down from COUNT before printing, to keep one worker busy.
+static char const * count_asm =
+    ".ORIG x3000\n"
+    "LD R1, COUNT\n"
+    "LOOP ADD R1, R1, #-1\n"
+    "BRp LOOP\n"
+    "LEA R0, DONE\n"
+    "PUTS\n"
+    "HALT\n"
+    "COUNT .FILL #30000\n"
+    "DONE .STRINGZ \"done\"\n"
+    ".END\n";
+
+// Leaves its mark on the registers and on x4000, and prints more than a few characters.
+static char const * dirty_asm =
+    ".ORIG x3000\n"
+    "LD R1, MARK\n"
+    "ADD R2, R1, R1\n"
+    "ADD R3, R2, R1\n"
+    "STI R1, ADDR\n"
+    "LEA R0, TEXT\n"
+    "PUTS\n"
+    "HALT\n"
+    "MARK .FILL x1234\n"
+    "ADDR .FILL x4000\n"
+    "TEXT .STRINGZ \"dirty\"\n"
+    ".END\n";
+
+static char const * spin_asm =
+    ".ORIG x3000\n"
+    "SPIN BRnzp SPIN\n"
+    ".END\n";
+
+// The parts of a machine's final state that a reused machine must reproduce.
+struct Snapshot
+{
+    bool loaded = false;
+    bool success = false;
+    bool exceeded_limit = false;
+    bool detected_loop = false;
+    bool exceeded_max_output = false;
+    uint64_t inst_count = 0;
+    std::string output;
+    std::vector<uint16_t> regs;
+    uint16_t pc = 0;
+    uint16_t mem_4000 = 0;
+
+    bool operator==(Snapshot const & other) const
+    {
+        return loaded == other.loaded && success == other.success && exceeded_limit == other.exceeded_limit
+            && detected_loop == other.detected_loop && exceeded_max_output == other.exceeded_max_output
+            && inst_count == other.inst_count && output == other.output && regs == other.regs && pc == other.pc
+            && mem_4000 == other.mem_4000;
+    }
+};
+
+static lc3::sim_pool::Job makeJob(std::string const & obj_filename, Snapshot & snapshot)
+{
+    lc3::sim_pool::Job job;
+    job.obj_filenames.push_back(obj_filename);
+    // the HALT routine would add its own message to the output
+    job.until_halt = true;
+    job.on_complete = [&snapshot](lc3::sim & simulator, lc3::sim_pool::JobResult const & result) {
+        snapshot.loaded = result.loaded;
+        snapshot.success = result.success;
+        snapshot.exceeded_limit = result.exceeded_limit;
+        snapshot.detected_loop = simulator.didDetectLoop();
+        snapshot.exceeded_max_output = simulator.didExceedMaxOutputCount();
+        snapshot.inst_count = result.inst_count;
+        snapshot.output = result.output;
+        for(uint16_t i = 0; i < 8; i += 1) {
+            snapshot.regs.push_back(simulator.getReg(i));
+        }
+        snapshot.pc = simulator.getPC();
+        snapshot.mem_4000 = simulator.getMem(0x4000);
+    };
+    return job;
+}
+
+// Runs the job on a pool of its own, so on a machine that has never run anything else.
+static void runFresh(lc3::sim_pool::Job const & job)
+{
+    lc3::sim_pool pool(1);
+    pool.submit(job);
+    pool.wait();
+}
+
+// One long job and many short ones on two workers: the short jobs queued behind the long one must be stolen by the
+// other worker, and every job must still produce its own result.
+static void testWorkStealing(std::string const & print_char_obj, std::string const & count_obj)
+{
+    uint32_t const short_job_count = 20;
+
+    lc3::sim_pool pool(2);
+    std::mutex lock;
+    std::vector<std::string> outputs(short_job_count + 1);
+    std::vector<bool> succeeded(short_job_count + 1, false);
+
+    for(uint32_t i = 0; i <= short_job_count; i += 1) {
+        lc3::sim_pool::Job job;
+        job.until_halt = true;
+        if(i == 0) {
+            job.obj_filenames.push_back(count_obj);
+        } else {
+            job.obj_filenames.push_back(print_char_obj);
+            job.mem_writes.emplace_back(0x3003, 'A' + (i % 26));
+        }
+        job.on_complete = [&, i](lc3::sim &, lc3::sim_pool::JobResult const & result) {
+            std::lock_guard<std::mutex> guard(lock);
+            outputs[i] = result.output;
+            succeeded[i] = result.loaded && result.success && ! result.exceeded_limit;
+        };
+        pool.submit(job);
+    }
+    pool.wait();
+
+    CHECK(pool.getStolenJobCount() > 0);
+    CHECK(outputs[0] == "done");
+    for(uint32_t i = 0; i <= short_job_count; i += 1) {
+        CHECK(succeeded[i]);
+        if(i != 0) {
+            CHECK(outputs[i] == std::string(1, 'A' + (i % 26)));
+        }
+    }
+}
+
+// A reused machine must end a job in the same state as a machine that has never run anything else.
+static void testMachineReuse(std::string const & print_char_obj, std::string const & dirty_obj,
+    std::string const & spin_obj)
+{
+    Snapshot dirty, after_dirty;
+    Snapshot over_output, after_over_output;
+    Snapshot looped, after_loop;
+    Snapshot fresh_after_dirty, fresh_after_over_output, fresh_after_loop;
+
+    lc3::sim_pool::Job dirty_job = makeJob(dirty_obj, dirty);
+    dirty_job.input = "unread input";
+
+    lc3::sim_pool::Job over_output_job = makeJob(dirty_obj, over_output);
+    over_output_job.max_output_count = 2;
+
+    lc3::sim_pool::Job loop_job = makeJob(spin_obj, looped);
+    loop_job.detect_loops = true;
+
+    {
+        lc3::sim_pool pool(1);
+        pool.submit(dirty_job);
+        pool.submit(makeJob(print_char_obj, after_dirty));
+        pool.submit(over_output_job);
+        pool.submit(makeJob(dirty_obj, after_over_output));
+        pool.submit(loop_job);
+        pool.submit(makeJob(print_char_obj, after_loop));
+        pool.wait();
+    }
+    runFresh(makeJob(print_char_obj, fresh_after_dirty));
+    runFresh(makeJob(dirty_obj, fresh_after_over_output));
+    runFresh(makeJob(print_char_obj, fresh_after_loop));
+
+    CHECK(dirty.success && ! dirty.exceeded_limit && dirty.output == "dirty" && dirty.mem_4000 == 0x1234);
+    CHECK(after_dirty == fresh_after_dirty);
+    CHECK(after_dirty.output == "A");
+    CHECK(after_dirty.mem_4000 != 0x1234);
+
+    CHECK(over_output.exceeded_limit && over_output.exceeded_max_output);
+    CHECK(after_over_output == fresh_after_over_output);
+    CHECK(! after_over_output.exceeded_limit && after_over_output.output == "dirty");
+
+    CHECK(looped.exceeded_limit && looped.detected_loop);
+    CHECK(after_loop == fresh_after_loop);
+    CHECK(! after_loop.exceeded_limit && ! after_loop.detected_loop);
+}
+
+// A limit of exactly the instructions a program needs lets it finish; one fewer stops it.
+static void testInstLimit(std::string const & print_char_obj, bool until_halt)
+{
+    Snapshot unlimited, exact, short_by_one;
+
+    lc3::sim_pool::Job job = makeJob(print_char_obj, unlimited);
+    job.until_halt = until_halt;
+    runFresh(job);
+    CHECK(unlimited.success && ! unlimited.exceeded_limit && unlimited.inst_count > 0);
+
+    lc3::sim_pool pool(1);
+    lc3::sim_pool::Job exact_job = makeJob(print_char_obj, exact);
+    exact_job.until_halt = until_halt;
+    exact_job.inst_limit = unlimited.inst_count;
+    lc3::sim_pool::Job short_job = makeJob(print_char_obj, short_by_one);
+    short_job.until_halt = until_halt;
+    short_job.inst_limit = unlimited.inst_count - 1;
+    pool.submit(short_job);
+    pool.submit(exact_job);
+    pool.wait();
+
+    CHECK(! exact.exceeded_limit && exact.inst_count == unlimited.inst_count && exact.output == unlimited.output);
+    CHECK(short_by_one.exceeded_limit && short_by_one.inst_count == unlimited.inst_count - 1);
+}
+
+int main(void)
+{
+    lc3::StreamPrinter printer(std::cerr);
+    lc3::as assembler(printer, 0, false, false);
+
+    std::vector<std::pair<std::string, char const *>> programs = {
+        {"print_char.asm", print_char_asm}, {"count.asm", count_asm}, {"dirty.asm", dirty_asm},
+        {"spin.asm", spin_asm}
+    };
+    std::vector<std::string> obj_filenames;
+    for(auto const & program : programs) {
+        lc3::optional<std::string> obj_filename;
+        if(writeFile(program.first, program.second)) {
+            obj_filename = assembler.assemble(program.first);
+        }
+        if(! obj_filename) {
+            std::cerr << "could not assemble " << program.first << "\n";
+            return 1;
+        }
+        obj_filenames.push_back(*obj_filename);
+    }
+
+    testWorkStealing(obj_filenames[0], obj_filenames[1]);
+    testMachineReuse(obj_filenames[0], obj_filenames[2], obj_filenames[3]);
+    testInstLimit(obj_filenames[0], true);
+    testInstLimit(obj_filenames[0], false);
+
+    return checkResult();
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <string>
+
+#include "check.h"
+#include "utils.h"
+
+int main(void)
+{
+    // test vectors from FIPS 180-4, plus messages that end on either side of the padding boundary
+    CHECK(lc3::utils::sha256Hash("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    CHECK(lc3::utils::sha256Hash("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    CHECK(lc3::utils::sha256Hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")
+        == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    CHECK(lc3::utils::sha256Hash(std::string(1000000, 'a'))
+        == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    CHECK(lc3::utils::sha256Hash(std::string(55, 'x'))
+        == "d5e285683cd4efc02d021a5c62014694958901005d6f71e89e0989fac77e4072");
+    CHECK(lc3::utils::sha256Hash(std::string(56, 'x'))
+        == "04c26261370ee7541549d16dee320c723e3fd14671e66a099afe0a377c16888e");
+    CHECK(lc3::utils::sha256Hash(std::string(64, 'x'))
+        == "7ce100971f64e7001e8fe5a51973ecdfe1ced42befe7ee8d5fd6219506b5393c");
+
+    return checkResult();
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// A failed CHECK is reported and counted, but the test carries on, so that one run shows every failure. A test
+// program returns checkResult() from main.
+
+inline uint32_t & checkFailureCount(void)
+{
+    static uint32_t failure_count = 0;
+    return failure_count;
+}
+
+#define CHECK(cond) do { \
+    if(! (cond)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #cond << "\n"; \
+        checkFailureCount() += 1; \
+    } \
+} while(0)
+
+inline int checkResult(void)
+{
+    if(checkFailureCount() != 0) {
+        std::cerr << checkFailureCount() << " check(s) failed\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Writes source to filename in the working directory, for tests that assemble their own programs.
+inline bool writeFile(std::string const & filename, std::string const & source)
+{
+    std::ofstream file(filename);
+    file << source;
+    return static_cast<bool>(file);
+}
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2020 McGraw-Hill Education. All rights reserved. No reproduction or distribution without the prior written consent of McGraw-Hill Education.
+ */
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "framework.h"
+#include "stream_printer.h"
+
+std::vector<TestCase> tests;
+
+// Feeds text to a matcher for pattern and returns the index of the character that completed the match, or npos.
+// Checks along the way that the match is only reported once.
+static std::size_t feedAll(std::string const & pattern, std::string const & text)
+{
+    OutputMatcher matcher(pattern);
+    std::size_t match_pos = std::string::npos;
+    for(std::size_t i = 0; i < text.size(); i += 1) {
+        if(matcher.feed(text[i])) {
+            CHECK(match_pos == std::string::npos);
+            match_pos = i;
+        }
+    }
+    CHECK(matcher.isMatched() == (match_pos != std::string::npos || pattern.empty()));
+    return match_pos;
+}
+
+// Where the first occurrence of pattern in text ends, which is where the matcher must report it.
+static std::size_t expectedMatch(std::string const & pattern, std::string const & text)
+{
+    std::size_t pos = text.find(pattern);
+    return (pos == std::string::npos || pattern.empty()) ? std::string::npos : pos + pattern.size() - 1;
+}
+
+static void testCases(void)
+{
+    struct Case
+    {
+        char const * pattern;
+        char const * text;
+    };
+    // Each of these falls back through the failure function at least once before it matches (or fails to).
+    std::vector<Case> cases = {
+        {"aab", "aaab"}, {"aaa", "aaaa"}, {"abab", "abaabab"}, {"abcabd", "abcabcabd"}, {"aabaaa", "aabaabaaa"},
+        {"abab", "ababab"}, {"abc", "ababc"}, {"aba", "abba"}, {"abcd", "abc"}, {"x", ""}, {"abc", "xyz"},
+        {"Enter a number: ", "Enter a numbeEnter a number: 12\n"}, {"\n\n", "a\nb\n\n"}
+    };
+    for(Case const & test_case : cases) {
+        CHECK(feedAll(test_case.pattern, test_case.text) == expectedMatch(test_case.pattern, test_case.text));
+    }
+
+    // An empty pattern is matched before any output.
+    OutputMatcher empty("");
+    CHECK(empty.isMatched());
+    CHECK(! empty.feed('a'));
+
+    // Nothing after the first match is reported, and reset starts over.
+    OutputMatcher matcher("ab");
+    CHECK(! matcher.feed('a') && matcher.feed('b') && matcher.isMatched());
+    CHECK(! matcher.feed('a') && ! matcher.feed('b'));
+    matcher.reset();
+    CHECK(! matcher.isMatched());
+    CHECK(! matcher.feed('b') && ! matcher.feed('a') && matcher.feed('b'));
+}
+
+// Every pattern of up to 4 characters over {a, b} against every text of up to 10 characters, which covers every way a
+// partial match can overlap the next one.
+static void testExhaustive(void)
+{
+    std::vector<std::string> patterns;
+    for(uint32_t length = 1; length <= 4; length += 1) {
+        for(uint32_t bits = 0; bits < (1u << length); bits += 1) {
+            std::string pattern;
+            for(uint32_t i = 0; i < length; i += 1) {
+                pattern += (bits >> i) & 1 ? 'b' : 'a';
+            }
+            patterns.push_back(pattern);
+        }
+    }
+    uint32_t mismatch_count = 0;
+    for(uint32_t length = 0; length <= 10; length += 1) {
+        for(uint32_t bits = 0; bits < (1u << length); bits += 1) {
+            std::string text;
+            for(uint32_t i = 0; i < length; i += 1) {
+                text += (bits >> i) & 1 ? 'b' : 'a';
+            }
+            for(std::string const & pattern : patterns) {
+                mismatch_count += feedAll(pattern, text) != expectedMatch(pattern, text);
+            }
+        }
+    }
+    CHECK(mismatch_count == 0);
+}
+
+// Registered strings are matched across separate prints and newlines; others are found by scanning the output.
+static void testBufferedPrinter(void)
+{
+    std::ostringstream output;
+    BufferedPrinter printer(false, output);
+    printer.expectOutput("ab\nab");
+    printer.forbidOutput("error");
+
+    printer.print("a");
+    printer.print("ba");
+    printer.print("b");
+    printer.newline();
+    CHECK(! printer.hadOutput("ab\nab"));
+    printer.print("abx");
+    CHECK(printer.hadOutput("ab\nab"));
+    CHECK(! printer.hadOutput("error"));
+    CHECK(printer.hadOutput("bab\nabx"));
+    CHECK(! printer.hadOutput("ab\nabab"));
+
+    printer.print("err");
+    printer.print("or");
+    CHECK(printer.hadOutput("error"));
+
+    printer.clear();
+    CHECK(! printer.hadOutput("ab\nab") && ! printer.hadOutput("error"));
+    printer.print("ab");
+    printer.newline();
+    printer.print("ab");
+    CHECK(printer.hadOutput("ab\nab"));
+
+    // Output past the capacity is still matched, and found again in the spill file.
+    BufferedPrinter spilling(false, output);
+    spilling.setCapacity(4, true);
+    spilling.expectOutput("needle");
+    spilling.print("haystack hay");
+    spilling.print("nee");
+    spilling.print("dle hay");
+    CHECK(spilling.hadOutput("needle"));
+    CHECK(spilling.hadOutput("hayneedle h"));
+    CHECK(! spilling.hadOutput("needles"));
+}
+
+// Output that differs from the reference stops the machine at that character, without making it look like the machine
+// ran out of instructions.
+static void testReferenceDivergence(void)
+{
+    lc3::StreamPrinter asm_printer(std::cerr);
+    lc3::as assembler(asm_printer, 0, false, false);
+    lc3::optional<std::string> obj_filename;
+    if(writeFile("diverge.asm",
+        ".ORIG x3000\n"
+        "LEA R0, TEXT\n"
+        "PUTS\n"
+        "LD R1, COUNT\n"
+        "LOOP ADD R1, R1, #-1\n"
+        "BRp LOOP\n"
+        "HALT\n"
+        "COUNT .FILL #10000\n"
+        "TEXT .STRINGZ \"helXo\"\n"
+        ".END\n"))
+    {
+        obj_filename = assembler.assemble("diverge.asm");
+    }
+    CHECK(obj_filename);
+    if(! obj_filename) {
+        return;
+    }
+
+    std::ostringstream output;
+    BufferedPrinter printer(false, output);
+    lc3::utils::NullInputter inputter;
+    lc3::sim simulator(printer, inputter, false, 1, false);
+    printer.setSimulator(&simulator);
+    std::string const reference = "hello";
+    printer.setReferenceTranscript(&reference);
+    CHECK(simulator.loadObjFile(*obj_filename));
+    simulator.setMaxInstCount(100000);
+
+    simulator.runUntilHalt();
+    CHECK(printer.didDiverge() && printer.getReferencePos() == 3 && printer.getDivergentChar() == 'X');
+    CHECK(simulator.isCancelled());
+    CHECK(! simulator.didExceedMaxInstCount() && ! simulator.didStopAtInstLimit());
+    // stopped in PUTS, long before the countdown
+    uint64_t inst_count = simulator.getInstExecCount();
+    CHECK(inst_count < 1000);
+
+    // Later runs of the test case do not start.
+    simulator.setPC(0x3000);
+    simulator.runUntilHalt();
+    CHECK(simulator.getInstExecCount() == inst_count);
+}
+
+int main(void)
+{
+    testCases();
+    testExhaustive();
+    testBufferedPrinter();
+    testReferenceDivergence();
+    return checkResult();
+}